@@ -0,0 +1,98 @@
+#pragma once
+#include <vector>
+#include <memory>
+#include <functional>
+#include <cstddef>
+#include "Water.h"
+
+class ThreadPool;
+
+// A coarse WaterGrid with finer patches where detail matters, e.g. around a
+// cloth. The coarse grid is split into kPatchBlock-square blocks of cells;
+// a refined block is a WaterGrid at dx / ratio covering the block plus a
+// ring of kPatchHalo coarse cells. Every coarse substep:
+//   - patch halos are prolonged from the coarse grid, then overwritten by
+//     the cells of neighbouring patches where there are any,
+//   - the coarse grid steps, and each patch steps the same time in as many
+//     substeps as its own stability needs,
+//   - patch cells are restricted (averaged) back onto the coarse cells
+//     under them.
+// Restriction and prolongation are both conservative: a coarse cell equals
+// the mean of its children in either direction, so refining and
+// coarsening a block neither adds nor removes water or momentum.
+class AdaptiveWaterGrid {
+public:
+    static const int kPatchBlock = 16;
+    static const int kPatchHalo = 4;
+
+    // ratio is 2 or 4.
+    AdaptiveWaterGrid(int nx, int nz, float dx, const Vec3& origin, float baseLevel, int ratio = 2);
+    AdaptiveWaterGrid(const AdaptiveWaterGrid&) = delete;
+    AdaptiveWaterGrid& operator=(const AdaptiveWaterGrid&) = delete;
+
+    // Refines exactly the blocks within radius of some point; blocks no
+    // longer covered are coarsened. Kept blocks keep their fine state and
+    // new ones start from the coarse grid.
+    void refineAround(const std::vector<Vec3>& points, float radius);
+
+    // Substeps follow the coarse grid's stable step.
+    void step(float dt);
+    void step(float dt, int substeps);
+    float estimateStableTimeStep() const { return base.estimateStableTimeStep(); }
+
+    // Finest level covering the point.
+    float sampleHeight(float x, float z) const;
+    Vec3 sampleVelocity(float x, float z) const;
+    // Level 0 is the coarse grid, level 1 the patches (coarse where none).
+    float sampleHeight(float x, float z, int level) const;
+    Vec3 sampleVelocity(float x, float z, int level) const;
+
+    // Applied to the coarse grid and to every patch the impulse reaches;
+    // coarse cells under a patch are replaced by the patch at the end of
+    // the step, so nothing is counted twice.
+    void addImpulse(float x, float z, float du, float dv, float dh);
+    void addRadialImpulse(float x, float z, float radius, float dh, float momentumScale);
+    // Batched as WaterGrid::addRadialImpulses, per grid.
+    void addRadialImpulses(const float* xs, const float* zs, const float* dhs, size_t n, float radius,
+                           float momentumScale);
+
+    // Run on the coarse grid now and on every newly built patch.
+    void setGridSetup(std::function<void(WaterGrid&)> fn);
+    void setRestDepth(float depth);
+    void setThreadPool(ThreadPool* p);
+    ThreadPool* getThreadPool() const { return pool; }
+
+    WaterGrid& getBase() { return base; }
+    const WaterGrid& getBase() const { return base; }
+    int getRatio() const { return ratio; }
+    size_t getPatchCount() const { return patches.size(); }
+    const WaterGrid& getPatch(size_t i) const { return *patches[i].grid; }
+    void getPatchBlock(size_t i, int& bx, int& bz) const { bx = patches[i].bx; bz = patches[i].bz; }
+    // Fraction of the coarse blocks that are refined.
+    float getRefinedFraction() const { return static_cast<float>(patches.size()) / (blocksX * blocksZ); }
+
+private:
+    struct Patch {
+        int bx, bz;
+        std::unique_ptr<WaterGrid> grid;
+    };
+
+    WaterGrid base;
+    int ratio;
+    int blocksX, blocksZ;
+    ThreadPool* pool;
+    std::function<void(WaterGrid&)> gridSetup;
+
+    std::vector<Patch> patches;
+    std::vector<int> blockPatch;  // patch index per block, -1 if coarse
+    std::vector<std::unique_ptr<WaterGrid>> freePatches;
+    std::vector<unsigned char> wanted;
+    std::vector<float> patchPoints;  // addRadialImpulses scratch
+
+    // Patch index of the block under (x, z), -1 if it is not refined.
+    int patchAt(float x, float z) const;
+    void addPatch(int bx, int bz);
+    void removePatch(size_t i);
+    void fillHalos();
+    void restrictPatches();
+};
@@ -1,17 +1,108 @@
 #pragma once
 #include <vector>
+#include <optional>
+#include <cstddef>
+#include <cmath>
+#include <functional>
+#include <utility>
 #include "SimpleMath.h"
+#include "ClothKernels.h"
+#include "ImplicitSolver.h"
+#include "XpbdSolver.h"
+#include "SelfCollision.h"
+#include "ClothTopology.h"
 
-struct Particle {
-    Vec3 position;
-    Vec3 velocity;
-    Vec3 force;
-    Vec3 normal;
-    float mass;
+class ThreadPool;
+class CollisionMesh;
+
+// Reference proxy onto three SoA float lanes so code written against the old
+// AoS Particle (p.position.x, p.force += f, ...) keeps working.
+template <typename F>
+struct BasicVec3Ref {
+    F& x;
+    F& y;
+    F& z;
+
+    BasicVec3Ref(F& x, F& y, F& z) : x(x), y(y), z(z) {}
+
+    operator Vec3() const { return Vec3(x, y, z); }
+    BasicVec3Ref& operator=(const Vec3& o) { x = o.x; y = o.y; z = o.z; return *this; }
+    BasicVec3Ref& operator=(const BasicVec3Ref& o) { return *this = Vec3(o); }
+    BasicVec3Ref& operator+=(const Vec3& o) { x += o.x; y += o.y; z += o.z; return *this; }
+    BasicVec3Ref& operator-=(const Vec3& o) { x -= o.x; y -= o.y; z -= o.z; return *this; }
+    Vec3 operator+(const Vec3& o) const { return Vec3(x + o.x, y + o.y, z + o.z); }
+    Vec3 operator-(const Vec3& o) const { return Vec3(x - o.x, y - o.y, z - o.z); }
+    Vec3 operator*(float s) const { return Vec3(x * s, y * s, z * s); }
+};
+
+using Vec3Ref = BasicVec3Ref<float>;
+using ConstVec3Ref = BasicVec3Ref<const float>;
+
+template <typename F>
+struct BasicParticleRef {
+    BasicVec3Ref<F> position;
+    BasicVec3Ref<F> velocity;
+    BasicVec3Ref<F> force;
+    BasicVec3Ref<F> normal;
+    F& mass;
     bool fixed;
-    
-    Particle(const Vec3& pos, float m = 1.0f) 
-        : position(pos), velocity(Vec3(0.0f)), force(Vec3(0.0f)), mass(m), fixed(false) {}
+
+    template <typename Store>
+    BasicParticleRef(Store& s, size_t i)
+        : position(s.px[i], s.py[i], s.pz[i]),
+          velocity(s.vx[i], s.vy[i], s.vz[i]),
+          force(s.fx[i], s.fy[i], s.fz[i]),
+          normal(s.nx[i], s.ny[i], s.nz[i]),
+          mass(s.mass[i]),
+          fixed(s.invMass[i] == 0.0f) {}
+};
+
+using ParticleRef = BasicParticleRef<float>;
+using ConstParticleRef = BasicParticleRef<const float>;
+
+// Indexable/iterable adapter over a ParticleStore. The iterator stashes the
+// proxy it hands out so `for (auto& p : cloth.getParticles())` binds.
+class ParticleView {
+public:
+    template <typename Ref, typename Store>
+    class Iterator {
+    public:
+        Iterator(Store* store, size_t i) : store(store), i(i) {}
+        Ref& operator*() const { cur.emplace(*store, i); return *cur; }
+        Iterator& operator++() { ++i; return *this; }
+        bool operator!=(const Iterator& o) const { return i != o.i; }
+        bool operator==(const Iterator& o) const { return i == o.i; }
+
+    private:
+        Store* store;
+        size_t i;
+        mutable std::optional<Ref> cur;
+    };
+
+    using iterator = Iterator<ParticleRef, ParticleStore>;
+    using const_iterator = Iterator<ConstParticleRef, const ParticleStore>;
+
+    explicit ParticleView(ParticleStore* store) : store(store) {}
+
+    size_t size() const { return store->size(); }
+    bool empty() const { return store->size() == 0; }
+
+    ParticleRef operator[](size_t i) { return ParticleRef(*store, i); }
+    ConstParticleRef operator[](size_t i) const { return ConstParticleRef(static_cast<const ParticleStore&>(*store), i); }
+
+    iterator begin() { return iterator(store, 0); }
+    iterator end() { return iterator(store, store->size()); }
+    const_iterator begin() const { return const_iterator(store, 0); }
+    const_iterator end() const { return const_iterator(store, store->size()); }
+
+private:
+    ParticleStore* store;
+};
+
+enum class ClothSolver {
+    ExplicitEuler,  // symplectic Euler, needs small steps at high stiffness
+    ImplicitEuler,  // backward Euler + PCG, stable at frame-sized steps
+    XPBD,           // springs as compliant distance constraints, substepped
 };
 
 struct Spring {
@@ -20,41 +111,158 @@ struct Spring {
     float restLength;
     float stiffness;
     float damping;
-    
+
     Spring(int p1, int p2, float rest, float k = 100.0f, float d = 5.0f)
         : particle1(p1), particle2(p2), restLength(rest), stiffness(k), damping(d) {}
 };
 
 class Cloth {
 public:
-    Cloth(int width, int height, float spacing = 0.1f);
+    Cloth(int width, int height, float spacing = 0.1f, ClothSolver solver = ClothSolver::ExplicitEuler);
     ~Cloth() = default;
-    
+    Cloth(const Cloth&) = delete;
+    Cloth& operator=(const Cloth&) = delete;
+
     void update(float deltaTime, const Vec3& gravity, float dragCoefficient, const Vec3& airVelocity);
     void applyGravity(const Vec3& gravity);
     void applyAirDrag(float dragCoefficient, const Vec3& airVelocity);
     void handleCollision(const Vec3& surfaceNormal, float surfaceHeight);
+    // Keeps particles `thickness` outside a static BVH mesh; particles are
+    // queried in parallel batches.
+    void handleMeshCollision(const CollisionMesh& mesh, float thickness, float friction = 0.2f);
 
     void calculateNormals();
-    
+
     void prepareForces();
     void finalizeIntegration(float deltaTime);
-    
-    const std::vector<Particle>& getParticles() const { return particles; }
-    std::vector<Particle>& getParticles() { return particles; }
+
+    const ParticleView& getParticles() const { return particleView; }
+    ParticleView& getParticles() { return particleView; }
+    const ParticleStore& getParticleStore() const { return store; }
+    ParticleStore& getParticleStore() { return store; }
     const std::vector<Spring>& getSprings() const { return springs; }
-    
+    // Springs are stored grouped by color; no two springs in a color share a
+    // particle, so each color can be accumulated in parallel.
+    const SpringStore& getSpringStore() const { return springStore; }
+    const std::vector<size_t>& getSpringColorOffsets() const { return springColorOffsets; }
+    const ClothTopology& getTopology() const { return topology; }
+    int getWidth() const { return topology.width; }
+    int getHeight() const { return topology.height; }
+
+    // Largest step the current solver stays stable at: for symplectic Euler
+    // a Gershgorin bound on the spring stiffness and damping over mass (taken
+    // from the rest configuration), infinity for the implicit and XPBD solvers.
+    float estimateStableTimeStep() const;
+
+    void setSolver(ClothSolver s) { solver = s; }
+    ClothSolver getSolver() const { return solver; }
+    const ImplicitSolver& getImplicitSolver() const { return implicitSolver; }
+    ImplicitSolver& getImplicitSolver() { return implicitSolver; }
+    const XpbdSolver& getXpbdSolver() const { return xpbdSolver; }
+    XpbdSolver& getXpbdSolver() { return xpbdSolver; }
+
+    void setSelfCollisionEnabled(bool enabled) { selfCollisionEnabled = enabled; }
+    bool isSelfCollisionEnabled() const { return selfCollisionEnabled; }
+    const SelfCollision& getSelfCollision() const { return selfCollision; }
+    SelfCollision& getSelfCollision() { return selfCollision; }
+
+    // Sleeping: the grid is split into kSleepTile x kSleepTile regions; a
+    // region whose kinetic energy per unit mass, measured from how far its
+    // particles moved over the last step, stays below `energy` for
+    // `frames` steps (with quiet neighbours) is put to sleep. Sleeping
+    // particles are held in place with invMass = 0, so every solver and
+    // collision pass treats them as pinned, and springs, drag and explicit
+    // integration skip them entirely. wakeParticle takes effect at the start
+    // of the next step; a wind change or a moving neighbour also wakes a region.
+    static const int kSleepTile = 8;
+    void setSleepEnabled(bool enabled);
+    bool isSleepEnabled() const { return sleepEnabled; }
+    void setSleepThreshold(float energy, int frames) { sleepEnergy = energy; sleepFrames = frames; }
+    // Relative speed below which an impulse is too weak to wake a region.
+    float getWakeSpeed() const { return std::sqrt(2.0f * sleepEnergy); }
+    bool isAsleep(size_t particle) const { return sleepEnabled && tileAsleep[tileOf(particle)] != 0; }
+    // Sleeping particles read as fixed through the store; this looks past it.
+    bool isPinned(size_t particle) const {
+        return (isAsleep(particle) ? sleepInvMass[particle] : store.invMass[particle]) == 0.0f;
+    }
+    void wakeParticle(size_t particle);
+    void wakeAll();
+    // Speed a force held for one step would give a sleeping particle at its
+    // real mass (zero for pinned particles), to compare with getWakeSpeed().
+    float getSleepingResponse(size_t particle, float force) const {
+        return std::fabs(force) * sleepInvMass[particle] * sleepDeltaTime;
+    }
+    // Water depth at each particle as of its last awake step. The coupling
+    // records it, so a sleeping particle notices its buoyancy changing.
+    float getRestingDepth(size_t particle) const { return restingDepth[particle]; }
+    void setRestingDepth(size_t particle, float depth) { restingDepth[particle] = depth; }
+    size_t getSleepingParticleCount() const { return sleepingParticles; }
+
+    // nullptr runs every pass serially; results are bitwise identical either way.
+    void setThreadPool(ThreadPool* p) { pool = p; }
+    ThreadPool* getThreadPool() const { return pool; }
+
     void fixCorner(int corner);
     void setWind(const Vec3& windVel) { windVelocity = windVel; }
     void setInitialVelocity(const Vec3& velocity);
+    void translate(const Vec3& offset);
 
 private:
-    std::vector<Particle> particles;
+    ClothTopology topology;
+    ParticleStore store;
+    ParticleView particleView;
     std::vector<Spring> springs;
+    SpringStore springStore;
+    std::vector<size_t> springColorOffsets;
     Vec3 windVelocity;
-    
+    ThreadPool* pool;
+    ClothSolver solver;
+    ImplicitSolver implicitSolver;
+    XpbdSolver xpbdSolver;
+    std::vector<float> faceNormals;  // 3 floats per topology triangle
+    float explicitStableStep;
+    // Per-particle position and signed mesh distance from the last exact
+    // query; while a particle stays inside that clearance sphere it cannot
+    // have reached the mesh and the BVH is not touched.
+    const CollisionMesh* meshCacheOwner;
+    std::vector<float> meshCacheX, meshCacheY, meshCacheZ, meshCacheDist;
+    bool selfCollisionEnabled;
+    SelfCollision selfCollision;
+
+    bool sleepEnabled;
+    float sleepEnergy;
+    int sleepFrames;
+    int tilesX, tilesY;
+    std::vector<unsigned char> tileAsleep;
+    std::vector<unsigned char> tileWake;   // wake requests for the next step
+    std::vector<int> tileQuiet;            // consecutive low-energy steps
+    std::vector<float> sleepInvMass;       // real invMass while a particle sleeps
+    std::vector<float> restingDepth;       // see getRestingDepth
+    std::vector<float> sleepX, sleepY, sleepZ;  // positions at the last sleep check
+    float sleepDeltaTime;
+    size_t sleepingParticles;
+    bool activeDirty;
+    Vec3 lastAirVelocity;
+    // Awake particles as row runs of at most kParticleGrain, and the springs
+    // touching at least one awake particle, still grouped by color.
+    std::vector<std::pair<size_t, size_t>> activeChunks;
+    SpringStore activeSprings;
+    std::vector<size_t> activeColorOffsets;
+
     void createSprings();
+    void colorSprings();
+    void computeStableStep();
     void applySpringForces();
     void integrateVelocities(float deltaTime);
     void integratePositions(float deltaTime);
-}; 
\ No newline at end of file
+
+    int tileOf(size_t particle) const {
+        int x = static_cast<int>(particle) % topology.width, y = static_cast<int>(particle) / topology.width;
+        return (y / kSleepTile) * tilesX + x / kSleepTile;
+    }
+    void forEachActiveChunk(const std::function<void(size_t, size_t)>& fn);
+    void setTileAsleep(int tile, bool asleep);
+    void processWakeRequests();
+    void rebuildActiveSets();
+    void updateSleep();
+};
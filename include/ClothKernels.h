@@ -0,0 +1,48 @@
+#pragma once
+#include <vector>
+#include <cstddef>
+#include "SimpleMath.h"
+
+// Structure-of-arrays particle storage. Fixed particles have invMass == 0,
+// which lets the integration kernels run without a per-particle branch.
+struct ParticleStore {
+    std::vector<float> px, py, pz;
+    std::vector<float> vx, vy, vz;
+    std::vector<float> fx, fy, fz;
+    std::vector<float> nx, ny, nz;
+    std::vector<float> mass;
+    std::vector<float> invMass;
+
+    size_t size() const { return px.size(); }
+    void reserve(size_t n);
+    void add(const Vec3& pos, float m = 1.0f);
+    void clearForces();
+
+    Vec3 position(size_t i) const { return Vec3(px[i], py[i], pz[i]); }
+    Vec3 velocity(size_t i) const { return Vec3(vx[i], vy[i], vz[i]); }
+};
+
+// Spring endpoints and coefficients split into flat arrays for the SIMD kernel.
+struct SpringStore {
+    std::vector<int> p1, p2;
+    std::vector<float> rest;
+    std::vector<float> stiffness;
+    std::vector<float> damping;
+
+    size_t size() const { return p1.size(); }
+    void clear();
+    void add(int a, int b, float restLength, float k, float d);
+};
+
+// Spring forces for springs [begin, end). Forces are accumulated into
+// ps.f* in spring order; blocks of 8 (AVX2) or 4 (SSE) springs are evaluated
+// together and the tail falls back to scalar code.
+void accumulateSpringForces(ParticleStore& ps, const SpringStore& springs, size_t begin, size_t end, float maxForce);
+
+void accumulateGravity(ParticleStore& ps, const Vec3& gravity, size_t begin, size_t end);
+void accumulateAirDrag(ParticleStore& ps, float dragCoefficient, const Vec3& airVelocity, size_t begin, size_t end);
+void integrateVelocitiesKernel(ParticleStore& ps, float deltaTime, float velocityDamping, size_t begin, size_t end);
+void integratePositionsKernel(ParticleStore& ps, float deltaTime, size_t begin, size_t end);
+
+// Name of the instruction set the kernels were compiled for ("AVX2", "SSE2", "scalar").
+const char* clothKernelIsa();
@@ -1,6 +1,7 @@
 #pragma once
 #include <GL/glut.h>
 #include <cmath>
+#include <vector>
 #include "Water.h"
 
 inline void drawWaterSurface(const WaterGrid& water) {
@@ -24,6 +25,16 @@ inline void drawWaterSurface(const WaterGrid& water) {
     glVertex3f(org.x,                 bottomY, org.z + (nz - 1) * dx);
     glEnd();
 
+    // Foam needs the flow at every vertex; sample it in one batch.
+    std::vector<float> nodeX(nx * nz), nodeZ(nx * nz), velU(nx * nz), velV(nx * nz);
+    for (int k = 0; k < nz; ++k) {
+        for (int i = 0; i < nx; ++i) {
+            nodeX[k * nx + i] = org.x + i * dx;
+            nodeZ[k * nx + i] = org.z + k * dx;
+        }
+    }
+    water.sampleVelocities(nodeX.data(), nodeZ.data(), velU.data(), velV.data(), nodeX.size());
+
     glBegin(GL_QUADS);
     for (int k = 0; k < nz - 1; ++k) {
         for (int i = 0; i < nx - 1; ++i) {
@@ -72,8 +83,8 @@ inline void drawWaterSurface(const WaterGrid& water) {
                 float dhdx = (hR - hL) / (2.0f * dx);
                 float dhdz = (hU - hD) / (2.0f * dx);
                 float slope = std::sqrt(dhdx * dhdx + dhdz * dhdz);
-                Vec3 vel = water.sampleVelocity(x, z);
-                float speed = std::sqrt(vel.x * vel.x + vel.z * vel.z);
+                const int id = kk * nx + ii;
+                float speed = std::sqrt(velU[id] * velU[id] + velV[id] * velV[id]);
                 float foam = std::max(0.0f, std::min(1.0f, (slope * 3.0f + speed * 0.7f - 0.35f) * 1.4f));
                 outR = outR * (1.0f - foam) + 1.0f * foam;
                 outG = outG * (1.0f - foam) + 1.0f * foam;
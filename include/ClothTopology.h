@@ -0,0 +1,30 @@
+#pragma once
+#include <vector>
+#include <cstddef>
+#include "ClothKernels.h"
+
+// Connectivity of a width x height particle grid, built once per cloth and
+// shared by normals, rendering, collision and the implicit solver.
+// Adjacency is stored in CSR form: the entries of vertex i live in
+// [offsets[i], offsets[i + 1]).
+struct ClothTopology {
+    int width = 0;
+    int height = 0;
+
+    std::vector<int> triangles;           // 3 indices per triangle, two per grid quad
+
+    std::vector<int> vertexFaceOffsets;   // vertex -> incident triangles
+    std::vector<int> vertexFaces;
+
+    std::vector<int> vertexSpringOffsets; // vertex -> incident springs (SpringStore order);
+    std::vector<int> vertexSprings;       // stored as ~s when the vertex is the spring's p2
+
+    int index(int x, int y) const { return y * width + x; }
+    size_t vertexCount() const { return static_cast<size_t>(width) * height; }
+    size_t triangleCount() const { return triangles.size() / 3; }
+    float u(int i) const { return width > 1 ? static_cast<float>(i % width) / (width - 1) : 0.0f; }
+    float v(int i) const { return height > 1 ? static_cast<float>(i / width) / (height - 1) : 0.0f; }
+
+    void build(int w, int h);
+    void buildSpringAdjacency(const SpringStore& springs);
+};
@@ -0,0 +1,90 @@
+#pragma once
+#include <vector>
+#include <memory>
+#include <cstddef>
+#include "Cloth.h"
+#include "Water.h"
+#include "Coupling.h"
+
+class ThreadPool;
+class CollisionMesh;
+
+// Forces shared by every cloth in a world.
+struct ClothEnvironment {
+    Vec3 gravity = Vec3(0.0f, -9.81f, 0.0f);
+    float dragCoefficient = 0.1f;
+    Vec3 airVelocity = Vec3(0.0f);
+    // Fraction of the air velocity added directly to particle velocities
+    // per second, on top of the drag force.
+    float windCarry = 0.0f;
+};
+
+// Owns a set of independent cloths and steps them against one shared water
+// grid. With at least as many cloths as threads, each cloth is a single task
+// on the pool and the parallel loops inside it run inline on that thread;
+// with fewer, cloths are stepped one after another and parallelise
+// internally. Water is only read while cloths step; their deposits are
+// applied afterwards in cloth order, so a step gives the same result for any
+// thread count.
+class ClothWorld {
+public:
+    ClothWorld();
+    explicit ClothWorld(ThreadPool* pool);
+    ClothWorld(const ClothWorld&) = delete;
+    ClothWorld& operator=(const ClothWorld&) = delete;
+
+    Cloth& addCloth(std::unique_ptr<Cloth> cloth);
+    void clear();
+
+    size_t size() const { return cloths.size(); }
+    bool empty() const { return cloths.empty(); }
+    Cloth& getCloth(size_t i) { return *cloths[i]; }
+    const Cloth& getCloth(size_t i) const { return *cloths[i]; }
+
+    // The grid is not owned; nullptr disables coupling. The world does not
+    // step the water itself.
+    void setWater(WaterGrid* grid, const CouplingParams& params) { water = grid; coupling = params; }
+    WaterGrid* getWater() const { return water; }
+    void setObstacle(const CollisionMesh* mesh, float thickness) { obstacle = mesh; obstacleThickness = thickness; }
+
+    void setThreadPool(ThreadPool* p) { pool = p; }
+    ThreadPool* getThreadPool() const { return pool; }
+
+    // Forces, integration, obstacle collision and water coupling for every cloth.
+    void step(float deltaTime, const ClothEnvironment& env);
+
+    // With deposits deferred, step() queues each cloth's deposits after those
+    // of earlier steps instead of applying them, so a water step can take
+    // everything the cloth sent since the last one. Each deposit already
+    // carries its own step's dt, so the queue holds the same momentum as
+    // applying every step's deposits at once. Turning deferral off applies
+    // the queue.
+    void setDeferDeposits(bool defer);
+    bool getDeferDeposits() const { return deferDeposits; }
+    // Applies the queued deposits in cloth order and empties the queue.
+    void applyPendingDeposits();
+    size_t getPendingDepositCount() const;
+
+    // Wall-clock milliseconds of each cloth's share of the last step (the
+    // serial deposit pass is not included), and of the whole step.
+    const std::vector<double>& getClothStepTimes() const { return stepTimes; }
+    double getLastStepTime() const { return lastStepTime; }
+    size_t getParticleCount() const;
+    // Smallest Cloth::estimateStableTimeStep over all cloths.
+    float estimateStableTimeStep() const;
+
+private:
+    std::vector<std::unique_ptr<Cloth>> cloths;
+    std::vector<std::vector<ClothDeposit>> deposits;
+    std::vector<std::vector<ClothDeposit>> pendingDeposits;
+    bool deferDeposits = false;
+    std::vector<double> stepTimes;
+    double lastStepTime = 0.0;
+    ThreadPool* pool;
+    WaterGrid* water = nullptr;
+    CouplingParams coupling{ 0.0f, 0.0f, 0.0f };
+    const CollisionMesh* obstacle = nullptr;
+    float obstacleThickness = 0.0f;
+
+    void stepCloth(size_t i, float deltaTime, const ClothEnvironment& env);
+};
@@ -0,0 +1,63 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <cstdint>
+#include "SimpleMath.h"
+
+struct TriangleMesh {
+    std::vector<Vec3> vertices;
+    std::vector<int> indices;  // 3 per triangle
+
+    size_t triangleCount() const { return indices.size() / 3; }
+    // Positions and faces only; polygons are fan-triangulated. Returns false
+    // if the file cannot be read or has no faces.
+    bool loadObj(const std::string& path);
+};
+
+struct MeshHit {
+    Vec3 point;        // closest point on the surface
+    Vec3 normal;       // angle-weighted pseudonormal at that feature
+    float distance;    // signed: negative inside the mesh
+    int triangle;
+};
+
+// Static triangle mesh obstacle with a binned-SAH bounding volume hierarchy.
+// Closest-point queries prune by box distance, so cost is logarithmic in the
+// triangle count. The sign comes from angle-weighted pseudonormals
+// (Baerentzen & Aanaes 2005), which is exact for closed, consistently
+// oriented meshes.
+class CollisionMesh {
+public:
+    explicit CollisionMesh(const TriangleMesh& mesh);
+
+    // Closest surface point within maxDistance; false if there is none.
+    bool closestPoint(const Vec3& p, float maxDistance, MeshHit& hit) const;
+    // Unbounded query used as the deep-penetration fallback.
+    MeshHit signedDistance(const Vec3& p) const;
+    bool insideBounds(const Vec3& p) const;
+    // Lower bound on the distance from p to the mesh (0 inside the bounds).
+    float boundsDistance(const Vec3& p) const;
+
+    const TriangleMesh& getMesh() const { return mesh; }
+    const std::vector<Vec3>& getFaceNormals() const { return faceNormals; }
+    size_t getNodeCount() const { return nodes.size(); }
+
+private:
+    struct Node {
+        float bmin[3];
+        float bmax[3];
+        int start;   // first child index for interior nodes, first triangle for leaves
+        int count;   // 0 for interior nodes
+    };
+
+    TriangleMesh mesh;
+    std::vector<Node> nodes;
+    std::vector<int> triOrder;
+    std::vector<Vec3> faceNormals;
+    std::vector<Vec3> vertexNormals;
+    std::vector<Vec3> edgeNormals;  // 3 per triangle: edges (0,1), (1,2), (2,0)
+
+    void build();
+    void buildPseudonormals();
+    bool query(const Vec3& p, float maxDistance2, MeshHit& hit) const;
+};
@@ -0,0 +1,34 @@
+#pragma once
+#include <vector>
+#include "Cloth.h"
+#include "Water.h"
+
+class AdaptiveWaterGrid;
+
+struct CouplingParams {
+    float pressureCoeff;
+    float dragCoeff;
+    float depositionCoeff;
+};
+
+void applyWaterToCloth(const WaterGrid& water, Cloth& cloth, const CouplingParams& p);
+void applyClothToWater(WaterGrid& water, const Cloth& cloth, const CouplingParams& p, float dt);
+
+// One water impulse requested by a cloth particle.
+struct ClothDeposit {
+    float x, z;
+    float dh;
+    float du, dv;
+};
+
+// applyClothToWater split in two: deposits are gathered from a read-only grid,
+// so several cloths can be collected concurrently, then applied serially in a
+// fixed order so the result does not depend on scheduling. Within one cloth
+// both directions run over particle ranges on the cloth's pool, and the
+// radial deposits are binned and splatted on the grid's pool.
+void collectClothDeposits(const WaterGrid& water, const Cloth& cloth, const CouplingParams& p, float dt,
+                          std::vector<ClothDeposit>& out);
+void applyClothDeposits(WaterGrid& water, const std::vector<ClothDeposit>& deposits);
+
+// Same deposits on an adaptive grid; they reach its refined patches.
+void applyClothDeposits(AdaptiveWaterGrid& water, const std::vector<ClothDeposit>& deposits);
@@ -0,0 +1,49 @@
+#pragma once
+#include <vector>
+#include <cstddef>
+#include "ClothKernels.h"
+#include "ClothTopology.h"
+
+class ThreadPool;
+
+// Backward Euler step for a mass-spring cloth (Baraff & Witkin 1998).
+// Solves (M - h D - h^2 K) dv = h (f + h K v) with block-Jacobi
+// preconditioned CG, where K and D are the spring position/velocity
+// Jacobians. The matrix is stored as 3x3 blocks: one per particle on the
+// diagonal and one per spring off the diagonal, gathered per particle
+// through the topology's vertex->spring CSR.
+class ImplicitSolver {
+public:
+    // Uses ps.f* (already holding spring + external forces) as f, then
+    // updates ps.v* and ps.p*. Returns the number of CG iterations.
+    int step(ParticleStore& ps, const SpringStore& springs, const ClothTopology& topology,
+             float deltaTime, float velocityDamping, ThreadPool* pool);
+
+    void setTolerance(float t) { tolerance = t; }
+    void setMaxIterations(int n) { maxIterations = n; }
+    int getLastIterations() const { return lastIterations; }
+    float getLastResidual() const { return lastResidual; }
+
+private:
+    size_t n = 0;
+    const ClothTopology* topo = nullptr;
+
+    std::vector<unsigned char> fixed;
+    std::vector<float> diag;      // 9 floats per particle
+    std::vector<float> diagInv;   // 9 floats per particle
+    std::vector<float> offDiag;   // 9 floats per spring, A_ab == A_ba
+    std::vector<float> springKs;  // 9 floats per spring, stiffness Jacobian block
+
+    std::vector<float> rhs, dv, r, z, p, Ap;  // 3 floats per particle
+    std::vector<double> partials;
+
+    float tolerance = 1e-4f;
+    int maxIterations = 100;
+    int lastIterations = 0;
+    float lastResidual = 0.0f;
+
+    void resize(size_t particleCount, size_t springCount);
+    void assemble(const ParticleStore& ps, const SpringStore& springs, float h, ThreadPool* pool);
+    void multiply(const std::vector<float>& x, std::vector<float>& y, const SpringStore& springs, ThreadPool* pool);
+    double dotProduct(const std::vector<float>& a, const std::vector<float>& b, ThreadPool* pool);
+};
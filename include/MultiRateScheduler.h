@@ -0,0 +1,34 @@
+#pragma once
+
+class ClothWorld;
+struct ClothEnvironment;
+struct StepPlan;
+
+// Steps a cloth world and its water at their own substep rates instead of in
+// lockstep. Each water step runs first; the cloth steps that start inside it
+// then sample the water blended between the states before and after it, at
+// their own start time. Their deposits are queued by the world and reach the
+// water at the start of its next step, so the water sees every cloth step's
+// deposit once, carrying the momentum of that step's dt, whatever the two
+// rates are.
+class MultiRateScheduler {
+public:
+    // Without interpolation the cloth samples the water after the step that
+    // contains it.
+    void setInterpolateWater(bool enabled) { interpolateWater = enabled; }
+    bool getInterpolateWater() const { return interpolateWater; }
+
+    // Advances by plan.frameTime with plan.clothSubsteps cloth steps and
+    // plan.waterSubsteps water steps. Turns on the world's deposit deferral
+    // and, when interpolating, the water's previous-state copy. Without
+    // water the cloth simply takes its substeps.
+    void advance(ClothWorld& world, const StepPlan& plan, const ClothEnvironment& env);
+
+    int getLastWaterSteps() const { return lastWaterSteps; }
+    int getLastClothSteps() const { return lastClothSteps; }
+
+private:
+    bool interpolateWater = true;
+    int lastWaterSteps = 0;
+    int lastClothSteps = 0;
+};
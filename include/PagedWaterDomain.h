@@ -0,0 +1,119 @@
+#pragma once
+#include <vector>
+#include <memory>
+#include <unordered_map>
+#include <functional>
+#include <cstdint>
+#include <cstddef>
+#include "Water.h"
+
+class ThreadPool;
+
+// Unbounded water surface made of fixed-size pages. Page (px, pz) owns the
+// pageCells-square block of cells whose first node is at origin + (px, pz) *
+// pageCells * dx; each is a WaterGrid with a haloCells-wide ring around that
+// block, refreshed from the neighbouring pages before every substep. A page
+// is created when an impulse lands in it or a neighbour's halo facing it is
+// disturbed, and starts from that halo. It is released back to a pool once
+// it and the halos facing it are quiet, so memory follows the disturbed
+// region rather than the world extent. Lookups outside any page see rest.
+//
+// The window limits which pages may exist. Moving it with setWindow drops
+// the pages that leave it and lets new ones appear there; cell data never
+// moves. Nothing moves it on its own, so the caller has to.
+// The halo has to cover the reach of one substep, so it is at least
+// kMinHaloCells wide; the implicit solvers see their neighbours only through
+// it, one exchange per substep, and are not exact across pages.
+class PagedWaterDomain {
+public:
+    // Cells one substep reaches: the ten Jacobi sweeps of the diffuse.
+    static const int kMinHaloCells = 10;
+
+    // pageCells and haloCells are raised to kMinHaloCells, and haloCells is
+    // capped at pageCells since halos are copied from the neighbour's edge.
+    PagedWaterDomain(int pageCells, int haloCells, float dx, const Vec3& origin, float baseLevel);
+    PagedWaterDomain(const PagedWaterDomain&) = delete;
+    PagedWaterDomain& operator=(const PagedWaterDomain&) = delete;
+
+    // Splits dt into the fewest substeps that keep every page stable.
+    void step(float dt);
+    void step(float dt, int substeps);
+    float estimateStableTimeStep() const;
+
+    // Rest water where no page exists.
+    float sampleHeight(float x, float z) const;
+    Vec3 sampleVelocity(float x, float z) const;
+
+    // Creates the page under (x, z) if it is inside the window; impulses
+    // outside it are dropped.
+    void addImpulse(float x, float z, float du, float dv, float dh);
+    // Applied to every page the circle overlaps; the radius must stay below
+    // haloCells * dx so no page is reached beyond its halo.
+    void addRadialImpulse(float x, float z, float radius, float dh, float momentumScale);
+
+    // Pages may exist within radiusPages (Chebyshev distance) of the page
+    // containing center. A negative radius removes the limit.
+    void setWindow(const Vec3& center, int radiusPages);
+    bool inWindow(int px, int pz) const;
+
+    // Run on every newly built page, e.g. to pick solvers; recycled pages
+    // keep what it set.
+    void setPageSetup(std::function<void(WaterGrid&)> fn) { pageSetup = std::move(fn); }
+    void setRestDepth(float depth);
+    // Largest deviation from rest (as WaterGrid::maxDeviation) at which a
+    // page counts as quiet.
+    void setQuietThreshold(float eps) { quietThreshold = eps; }
+    // Released pages kept for reuse; beyond this they are freed.
+    void setMaxFreePages(size_t n) { maxFreePages = n; }
+
+    void setThreadPool(ThreadPool* p);
+    ThreadPool* getThreadPool() const { return pool; }
+
+    int getPageCells() const { return pageCells; }
+    int getHaloCells() const { return haloCells; }
+    float getDx() const { return dx; }
+    float getBaseLevel() const { return baseLevel; }
+    size_t getPageCount() const { return pages.size(); }
+    size_t getFreePageCount() const { return freePages.size(); }
+    // Grid for page (px, pz), or nullptr if it does not exist.
+    const WaterGrid* findPage(int px, int pz) const;
+    void getPageCoords(size_t i, int& px, int& pz) const { px = pages[i].px; pz = pages[i].pz; }
+    const WaterGrid& getPage(size_t i) const { return *pages[i].grid; }
+
+private:
+    struct Page {
+        int px, pz;
+        std::unique_ptr<WaterGrid> grid;
+    };
+
+    int pageCells, haloCells;
+    float dx;
+    Vec3 origin;
+    float baseLevel;
+    float restDepth;
+    float quietThreshold;
+    size_t maxFreePages;
+    ThreadPool* pool;
+    std::function<void(WaterGrid&)> pageSetup;
+
+    bool windowed;
+    int windowX, windowZ, windowRadius;
+
+    std::vector<Page> pages;
+    std::unordered_map<uint64_t, size_t> table;
+    std::vector<std::unique_ptr<WaterGrid>> freePages;
+    // Per page after a step: interior quiet, and for each of the eight
+    // directions whether the halo on that side is disturbed.
+    std::vector<unsigned char> quiet;
+    std::vector<unsigned char> edges;
+
+    static uint64_t key(int px, int pz) {
+        return (static_cast<uint64_t>(static_cast<uint32_t>(px)) << 32) | static_cast<uint32_t>(pz);
+    }
+    void pageAt(float x, float z, int& px, int& pz) const;
+    WaterGrid* findPage(int px, int pz);
+    WaterGrid* acquirePage(int px, int pz);
+    void releasePage(size_t i);
+    void exchangeHalos();
+    void updatePages();
+};
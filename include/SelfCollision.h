@@ -0,0 +1,49 @@
+#pragma once
+#include <vector>
+#include <atomic>
+#include <memory>
+#include <cstdint>
+#include <cstddef>
+#include "ClothKernels.h"
+
+class ThreadPool;
+
+// Point-triangle self-collision for a grid cloth. Triangles are binned by
+// centroid into a uniform spatial hash that is rebuilt every step with a
+// parallel counting sort; each particle then gathers nearby triangles from
+// the 27 surrounding cells, so the cost stays linear in particle count.
+// Only the querying particle is corrected, which keeps the pass free of
+// write conflicts; the opposite side of a fold is handled by its own queries.
+class SelfCollision {
+public:
+    void setThickness(float t) { thickness = t; }
+    float getThickness() const { return thickness; }
+    void setFriction(float f) { friction = f; }
+
+    // triangles: 3 indices per triangle. gridWidth is used to skip the
+    // particle's own 1-ring. deltaTime recovers the pre-step position that
+    // decides which side of a triangle the particle came from.
+    void resolve(ParticleStore& ps, const std::vector<int>& triangles, int gridWidth, float deltaTime, ThreadPool* pool);
+
+    size_t getLastContactCount() const { return lastContacts; }
+
+private:
+    float thickness = 0.02f;
+    float friction = 0.1f;
+    size_t lastContacts = 0;
+
+    size_t tableSize = 0;
+    std::unique_ptr<std::atomic<int>[]> bucketCounts;
+    std::vector<int> bucketStart;       // tableSize + 1
+    std::vector<uint32_t> triBucket;    // bucket of each triangle
+    std::vector<uint64_t> triCell;      // packed cell coordinate of each triangle
+    std::vector<float> triCentroid;
+    std::vector<int> sortedTris;
+    std::vector<uint64_t> sortedCells;
+    std::vector<float> sortedCentroid;
+    std::vector<float> dpx, dpy, dpz, dvx, dvy, dvz;
+    std::vector<int> hits;
+    std::vector<float> partialRadius;
+
+    void buildHash(const ParticleStore& ps, const std::vector<int>& triangles, float cellSize, ThreadPool* pool);
+};
@@ -0,0 +1,83 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+#include "SimpleMath.h"
+
+class ThreadPool;
+class WaterGrid;
+
+// Deep-water ambient waves (Tessendorf 2001): random amplitudes drawn once
+// from a wind-driven spectrum, advanced in time analytically by the
+// dispersion relation and brought to a periodic n x n tile of heights and
+// surface velocities with an inverse FFT. The FFT is an in-repo radix-2
+// transform; rows are split over the pool, columns are transformed as whole
+// row segments so every butterfly runs over contiguous floats. Each output
+// field is real, so heights and x velocity share one complex transform and
+// z and vertical velocity the other.
+class SpectralOcean {
+public:
+    // Phillips: the classic Tessendorf spectrum, scaled so that amplitude 1
+    // gives roughly the fully developed wave height for the wind. Jonswap:
+    // fetch-limited wind sea (Hasselmann et al. 1973) with cos^2 spreading.
+    // The amplitude scales the variance of either.
+    enum class Spectrum { Phillips, Jonswap };
+
+    // n is rounded up to a power of two; patchSize is the tile edge in metres.
+    SpectralOcean(int n, float patchSize);
+
+    void setSpectrum(Spectrum s) { spectrum = s; dirty = true; }
+    // Wind at 10 m, in the xz plane (y is ignored).
+    void setWind(const Vec3& w) { wind = w; dirty = true; }
+    void setAmplitude(float a) { amplitude = a; dirty = true; }
+    void setFetch(float metres) { fetch = metres; dirty = true; }
+    void setPeakEnhancement(float gamma) { peakEnhancement = gamma; dirty = true; }
+    // Water depth used by the dispersion relation.
+    void setDepth(float d) { depth = d; dirty = true; }
+    void setSeed(uint32_t s) { seed = s; dirty = true; }
+    void setThreadPool(ThreadPool* p) { pool = p; }
+
+    // Evaluates the field at time t (seconds).
+    void update(float t);
+
+    // Bilinear and periodic, relative to the still water level.
+    float sampleHeight(float x, float z) const;
+    Vec3 sampleVelocity(float x, float z) const;
+
+    // Relaxation zone: blends the `width` cells next to the grid's border
+    // toward the ocean (around the grid's base level), strongest at the
+    // border and fading inwards. Incoming waves enter the grid and outgoing
+    // ones are absorbed instead of reflecting off the wall.
+    void driveBoundary(WaterGrid& grid, int width, float dt, float timeScale = 0.25f) const;
+
+    int getN() const { return n; }
+    float getPatchSize() const { return patchSize; }
+    const std::vector<float>& getHeights() const { return height; }
+    // Four times the standard deviation of the current heights.
+    float getSignificantWaveHeight() const;
+
+private:
+    int n;
+    float patchSize;
+    Spectrum spectrum;
+    Vec3 wind;
+    float amplitude;
+    float fetch;
+    float peakEnhancement;
+    float depth;
+    uint32_t seed;
+    bool dirty;
+    ThreadPool* pool;
+
+    std::vector<float> h0Re, h0Im;  // initial amplitudes, zero on the Nyquist row and column
+    std::vector<float> omega;
+    std::vector<float> speed;       // surface orbital speed per unit height
+    std::vector<float> aRe, aIm, bRe, bIm;
+    std::vector<float> height, velX, velY, velZ;
+
+    std::vector<int> bitReverse;
+    std::vector<float> twiddleRe, twiddleIm;  // per stage, concatenated
+
+    void buildSpectrum();
+    float spectrumAt(float kx, float kz) const;
+    void inverseFft(std::vector<float>& re, std::vector<float>& im);
+};
@@ -0,0 +1,61 @@
+#pragma once
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <algorithm>
+#include <cstddef>
+
+// Persistent worker pool used by the cloth and water solvers. parallelFor
+// splits a range into fixed chunks of `grain` items, so chunk boundaries
+// never depend on the number of threads; the calling thread takes chunks
+// too. Calls made from inside a running chunk execute inline.
+class ThreadPool {
+public:
+    explicit ThreadPool(int threads = 0);
+    ~ThreadPool();
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // Number of threads that take part in a parallelFor, including the caller.
+    int size() const { return static_cast<int>(workers.size()) + 1; }
+
+    void parallelFor(size_t begin, size_t end, size_t grain, const std::function<void(size_t, size_t)>& fn);
+
+    static ThreadPool& shared();
+
+private:
+    struct Job {
+        const std::function<void(size_t, size_t)>* fn = nullptr;
+        size_t begin = 0;
+        size_t end = 0;
+        size_t grain = 1;
+        std::atomic<size_t> next{ 0 };
+    };
+
+    std::vector<std::thread> workers;
+    std::mutex submitMutex;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+    Job job;
+    unsigned long long generation = 0;
+    int inFlight = 0;
+    bool stopping = false;
+
+    void workerLoop();
+    void runChunks();
+};
+
+// parallelFor that degrades to a plain loop over the same chunks when no pool
+// is given, so serial and threaded callers see identical chunk boundaries.
+inline void parallelFor(ThreadPool* pool, size_t begin, size_t end, size_t grain,
+                        const std::function<void(size_t, size_t)>& fn) {
+    if (pool) {
+        pool->parallelFor(begin, end, grain, fn);
+        return;
+    }
+    for (size_t b = begin; b < end; b += grain) fn(b, std::min(end, b + grain));
+}
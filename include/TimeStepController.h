@@ -0,0 +1,44 @@
+#pragma once
+
+class ClothWorld;
+class WaterGrid;
+
+// Substeps chosen for one frame. Margins are the estimated stable step over
+// the step actually taken, so anything >= 1 is inside the stability bound.
+struct StepPlan {
+    float frameTime = 0.0f;
+    int clothSubsteps = 1;
+    float clothStep = 0.0f;
+    float clothMargin = 0.0f;
+    int waterSubsteps = 1;
+    float waterStep = 0.0f;
+    float waterMargin = 0.0f;
+};
+
+// Picks per-frame substep counts for the cloth and the water from their
+// stability estimates instead of fixed caps: the fewest substeps whose length
+// stays within `safety` times the stable step. Unconditionally stable solvers
+// are still limited to maxStep for accuracy, and a frame never takes more
+// than maxSubsteps.
+class TimeStepController {
+public:
+    void setMaxFrameTime(float t) { maxFrameTime = t; }
+    void setMaxStep(float t) { maxStep = t; }
+    void setSafety(float s) { safety = s; }
+    void setMaxSubsteps(int n) { maxSubsteps = n > 0 ? n : 1; }
+    float getMaxFrameTime() const { return maxFrameTime; }
+
+    // frameTime is the wall-clock time since the last frame; it is clamped to
+    // maxFrameTime. water may be nullptr.
+    const StepPlan& plan(float frameTime, const ClothWorld& world, const WaterGrid* water);
+    const StepPlan& getLastPlan() const { return last; }
+
+private:
+    float maxFrameTime = 0.033f;
+    float maxStep = 0.033f;
+    float safety = 0.9f;
+    int maxSubsteps = 16;
+    StepPlan last;
+
+    int substepsFor(float frameTime, float stableStep) const;
+};
@@ -1,18 +1,59 @@
 #pragma once
 #include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <atomic>
+#include <functional>
 #include "SimpleMath.h"
 
+class ThreadPool;
+
 class WaterGrid {
 public:
     WaterGrid(int nx, int nz, float dx, const Vec3& origin, float baseLevel);
 
+    // Splits dt into the fewest substeps that keep the estimated stable step.
     void step(float dt);
+    void step(float dt, int substeps);
+
+    // Largest stable substep: CFL limit from the fastest of the flow speed
+    // and the gravity wave speed sqrt(g * depth), scaled by the CFL number.
+    float estimateStableTimeStep() const;
+    void setCflNumber(float c) { cflNumber = c; }
+    float getCflNumber() const { return cflNumber; }
+    // Depth of the resting water column below baseLevel; sets the wave speed.
+    void setRestDepth(float depth) { bedLevel = baseLevel - depth; }
+    float getRestDepth() const { return baseLevel - bedLevel; }
 
+    // Value of the cell whose node, at origin + (i, k) * dx, is nearest the
+    // point; impulses land on that cell too.
     float sampleHeight(float x, float z) const;
     Vec3 sampleVelocity(float x, float z) const;
+    // Bilinear between cell values placed at origin + (i, k) * dx, where
+    // the renderers draw them; points beyond the grid take the edge. Eight
+    // points at a time with AVX2 gathers. Read-only on every storage, so
+    // any number of threads may sample at once.
+    void sampleHeights(const float* xs, const float* zs, float* out, size_t n) const;
+    void sampleVelocities(const float* xs, const float* zs, float* us, float* vs, size_t n) const;
+
+    // Multi-rate coupling. With the previous state kept, step() first saves
+    // heights and velocities as fp32, and a sample blend a < 1 makes the
+    // batch samplers return (1 - a) * saved + a * current: the water
+    // between its last two steps. Before the first saved step they return
+    // the current state.
+    void setKeepPreviousState(bool keep);
+    bool getKeepPreviousState() const { return keepPrevious; }
+    void setSampleBlend(float a) { sampleBlend = a; }
+    float getSampleBlend() const { return sampleBlend; }
 
     void addImpulse(float x, float z, float du, float dv, float dh);
     void addRadialImpulse(float x, float z, float radius, float dh, float momentumScale);
+    // addRadialImpulse at n points with one radius, up to summation order.
+    // The impulses are binned by cell and each occupied cell is splatted
+    // once with weights tabulated for the radius. Binning and splatting
+    // run on the pool; the result does not depend on the thread count.
+    void addRadialImpulses(const float* xs, const float* zs, const float* dhs, size_t n, float radius,
+                           float momentumScale);
 
     int getNx() const { return nx; }
     int getNz() const { return nz; }
@@ -20,13 +61,131 @@ public:
     const Vec3& getOrigin() const { return origin; }
     float getBaseLevel() const { return baseLevel; }
 
-    const std::vector<float>& getH() const { return h; }
+    // With compact storage this is a widened copy, refreshed on the first
+    // call after the heights change, so it is not for concurrent readers;
+    // the batch samplers are.
+    const std::vector<float>& getH() const;
+
+    // Every phase of step() runs in row bands on this pool; nullptr runs
+    // serially. Results are bitwise identical either way.
+    void setThreadPool(ThreadPool* p) { pool = p; }
+    ThreadPool* getThreadPool() const { return pool; }
+
+    // Fused mode cuts a substep from ~15 grid passes to 4. diffuse runs its
+    // Jacobi sweeps kDiffuseBlock at a time inside cache-sized tiles with a
+    // halo of the same width (temporal blocking), and project, sources,
+    // boundary and smoothing share one row-band pass. Boundary cells are
+    // held fixed instead of alternating between h/u/v and their Tmp twins,
+    // which only differs from the reference path when an impulse lands on
+    // a boundary cell.
+    static const int kTileX = 128;
+    static const int kTileZ = 64;
+    static const int kDiffuseBlock = 5;
+    void setFusedStep(bool enabled) { fusedStep = enabled; }
+    bool isFusedStep() const { return fusedStep; }
+
+    // Jacobi applies the fixed ten sweeps of the original step. Multigrid
+    // solves the backward Euler system (1 - a lap) u' = u to a relative
+    // residual with V-cycles of red-black Gauss-Seidel. Its work per cycle
+    // is linear in the cell count and the cycle count does not grow with the
+    // grid. Fused mode keeps its tiled sweeps only with Jacobi.
+    enum class DiffusionSolver { Jacobi, Multigrid };
+    void setDiffusionSolver(DiffusionSolver s) { diffusionSolver = s; }
+    DiffusionSolver getDiffusionSolver() const { return diffusionSolver; }
+    // Max-norm residual relative to the max-norm right-hand side.
+    void setDiffusionTolerance(float t) { diffusionTolerance = t; }
+    void setMaxDiffusionCycles(int n) { maxDiffusionCycles = n; }
+    // Sweeps (Jacobi) or V-cycles (Multigrid) of the last diffuse, the
+    // larger of the u and v solves.
+    int getLastDiffusionIterations() const { return lastDiffusionIterations; }
+
+    // Nearest copies the cell the backtrace lands in, as the original step
+    // did. Bilinear interpolates the four cells around it; MacCormack adds
+    // a limited error correction from a second, forward trace, at about
+    // twice the cost. Both sample eight cells per gather with AVX2.
+    enum class AdvectionScheme { Nearest, Bilinear, MacCormack };
+    void setAdvectionScheme(AdvectionScheme s) { advectionScheme = s; }
+    AdvectionScheme getAdvectionScheme() const { return advectionScheme; }
+
+    // Explicit accelerates the flow by the surface slope and leaves the
+    // height to advection; its substep is bounded by the gravity wave speed.
+    // SemiImplicit adds the continuity term and solves heights and
+    // velocities together, linearised about the rest depth, so waves no
+    // longer limit the substep and a 33 ms frame usually takes one. Fused
+    // mode keeps its combined pass only with Explicit.
+    enum class WaveSolver { Explicit, SemiImplicit };
+    void setWaveSolver(WaveSolver s) { waveSolver = s; }
+    WaveSolver getWaveSolver() const { return waveSolver; }
+    void setWaveTolerance(float t) { waveTolerance = t; }
+    void setMaxWaveCycles(int n) { maxWaveCycles = n; }
+    // V-cycles of the last height solve.
+    int getLastWaveIterations() const { return lastWaveIterations; }
+
+    // Active-tile tracking steps only kActiveTile-square tiles that are
+    // disturbed, plus a one-tile halo. A tile is disturbed while any cell
+    // deviates from rest (h at baseLevel, no velocity, no pending source) by
+    // more than the threshold, or when an impulse lands in it. Tiles leaving
+    // the halo are reset exactly to rest. Each substep re-evaluates the
+    // stepped tiles, so a disturbance spreads one tile per substep at most.
+    // Fused mode is not used while tracking is on. The multigrid coarse
+    // levels still span the whole grid, at a quarter of the fine-level
+    // cells and less.
+    static const int kActiveTile = 16;
+    void setActiveTracking(bool enabled);
+    bool isActiveTracking() const { return activeTracking; }
+    void setActivityThreshold(float eps) { activityThreshold = eps; }
+    // Fraction of tiles stepped by the last substep (1 without tracking).
+    float getActiveFraction() const { return activeTracking ? activeFraction : 1.0f; }
+
+    // Compact storage keeps h, u, v, q and their Tmp twins in 16 bits per
+    // cell; all arithmetic stays in fp32 registers. Half stores heights as their deviation from baseLevel
+    // and the other fields as they are, in IEEE half precision (converted
+    // with F16C where available). Fixed16 stores the same values as signed
+    // multiples of range / 32767, saturating at +-range: heightRange for
+    // heights and pending sources, speedRange for velocities. Only the
+    // fused explicit step with Jacobi diffusion and Nearest or Bilinear
+    // advection, without active tracking, runs on the 16-bit fields and
+    // streams half the memory of fp32. Every other configuration widens all
+    // eight fields to fp32 for each step() and narrows them afterwards: it
+    // streams more than plain fp32 and briefly holds both copies, so there
+    // the 16-bit storage only saves memory between steps.
+    enum class FieldStorage { Float32, Half, Fixed16 };
+    void setFieldStorage(FieldStorage s, float heightRange = 0.5f, float speedRange = 2.0f);
+    FieldStorage getFieldStorage() const { return fieldStorage; }
+    // True when step() runs on the 16-bit fields rather than a widened copy.
+    bool stepsCompactFields() const { return packed && packedStep(); }
+
+    // Block access for domains built from several grids. Blocks are w x d
+    // cells with their low corner at (i, k) and must lie inside the grid.
+    void setOrigin(const Vec3& o) { origin = o; }
+    // Every cell back to rest; settings and the thread pool are kept.
+    void reset();
+    // Copies h, u, v and pending sources from a block of src.
+    void copyCells(const WaterGrid& src, int si, int sk, int di, int dk, int w, int d);
+    void resetCells(int i, int k, int w, int d);
+    // Largest deviation from rest over the block, as measured by tracking.
+    float maxDeviation(int i, int k, int w, int d) const;
+    // Fills a block from a grid whose cells this one's subdivide (an integer
+    // dx ratio, aligned cell corners, each half a cell before the cell's
+    // node) by limited linear reconstruction; the
+    // children of a coarse cell average to its value. Sources are cleared.
+    void prolongFrom(const WaterGrid& coarse, int i, int k, int w, int d);
+    // Averages a block made of whole coarse cells into the coarse grid.
+    void restrictTo(WaterGrid& coarse, int i, int k, int w, int d) const;
+
+    // Relaxation zone: cells within `width` of the border move toward
+    // target(x, z) -> (h, u, v) at their centre by blend * (1 - d / width)^2,
+    // d being the distance to the border in cells.
+    using BorderTarget = std::function<void(float x, float z, float& h, float& u, float& v)>;
+    void relaxBorder(int width, float blend, const BorderTarget& target);
 
 private:
     int nx, nz;
     float dx;
     Vec3 origin;
     float baseLevel;
+    float bedLevel;
+    float cflNumber;
 
     std::vector<float> h;
     std::vector<float> u;
@@ -41,11 +200,116 @@ private:
     float gravity;
     float viscosity;
     float waveDamping;
+    ThreadPool* pool;
+    bool fusedStep;
+
+    // Multigrid level: interior cells plus a one-cell border that stays zero.
+    // Level 0 solves on u/v in place and only uses r.
+    struct MultigridLevel {
+        int nx, nz;
+        std::vector<float> x, b, r;
+    };
+    std::vector<MultigridLevel> levels;
+    std::vector<float> partials;
+    DiffusionSolver diffusionSolver;
+    float diffusionTolerance;
+    int maxDiffusionCycles;
+    int lastDiffusionIterations;
+    AdvectionScheme advectionScheme;
+    // MacCormack output, allocated on first use.
+    std::vector<float> uBack, vBack, hBack;
+    WaveSolver waveSolver;
+    float waveTolerance;
+    int maxWaveCycles;
+    int lastWaveIterations;
+
+    // Compact storage. The 16-bit arrays carry one element of padding so a
+    // 32-bit gather can read any cell. While packed they hold the state and
+    // the fp32 arrays are only a working copy for configurations that need
+    // one; hView backs getH().
+    enum Field { kHeight, kVelocityX, kVelocityZ, kSource };
+    struct FieldCodec {
+        bool half;
+        float offset, scale, inv;
+        float decode(uint16_t s) const;
+        uint16_t encode(float f) const;
+        void decodeRow(const uint16_t* s, float* f, int n) const;
+        void encodeRow(const float* f, uint16_t* s, int n) const;
+    };
+    FieldStorage fieldStorage;
+    FieldCodec codecs[4];
+    bool packed;
+    std::vector<uint16_t> h16, u16, v16, q16;
+    std::vector<uint16_t> h16Tmp, u16Tmp, v16Tmp, q16Tmp;
+    mutable std::vector<float> hView;
+    mutable std::atomic<bool> hViewStale;
+
+    // addRadialImpulses: per window offset the source weight and the
+    // momentum push per unit of clamped dh, zero outside the disc; per
+    // window row the half-width of the disc (-1 if empty). Each chunk of
+    // impulses bins into its own sorted list; the reduction ends in the
+    // first.
+    struct SplatBin {
+        int cell;
+        float dh;
+    };
+    float splatRadius;
+    int splatCells;
+    std::vector<float> splatWeight, splatPushX, splatPushZ;
+    std::vector<int> splatExtent;
+    std::vector<std::vector<SplatBin>> splatLists;
+
+    bool keepPrevious;
+    bool previousValid;
+    float sampleBlend;
+    std::vector<float> prevH, prevU, prevV;
+
+    bool activeTracking;
+    float activityThreshold;
+    float activeFraction;
+    int tilesX, tilesZ;
+    std::vector<unsigned char> tileWoken;   // hit by an impulse since the last update
+    std::vector<unsigned char> tileActive;  // disturbed at the last update
+    std::vector<unsigned char> tileStepped; // active or next to an active tile
+    std::vector<int> steppedTiles;
+    // Per tile row, [begin, end) tile columns of stepped tiles (CSR).
+    std::vector<int> tileSpanOffsets;
+    std::vector<int> tileSpans;
 
     int idx(int i, int k) const { return k * nx + i; }
+    // Node nearest to (x, z), clamped to the grid. Node (i, k) sits at
+    // origin + (i, k) * dx, as the bilinear samplers and renderers take it.
+    void nearestNode(float x, float z, int& i, int& k) const;
     void applyBoundary();
     void diffuse(float dt);
     void advect(float dt);
+    void advectSemiLagrangian(float dt);
     void project(float dt);
-    void addHeightDamping(float dt);
+    void applySources(float dt);
+    void smoothHeights(float alpha);
+    size_t rowGrain() const;
+    void diffuseTiled(float dt);
+    void finishSubstepFused(float dt, float smoothing);
+    void diffuseMultigrid(float dt);
+    void solveWaves(float dt);
+    void wakeTile(int i, int k) { tileWoken[(k / kActiveTile) * tilesX + i / kActiveTile] = 1; }
+    void wakeDisturbed(int i, int k, int w, int d);
+    void updateActiveTiles();
+    void resetTile(int t);
+    float cell(Field f, int id) const;
+    void setCell(Field f, int id, float value);
+    void buildSplatTable(float radius);
+    void sampleBilinear(const float* xs, const float* zs, size_t n, const Field* fields, float* const* out,
+                        int count, bool previous) const;
+    void sampleBlended(const float* xs, const float* zs, size_t n, const Field* fields, float* const* out,
+                       int count) const;
+    void savePreviousState();
+    bool packedStep() const;
+    void packFields();
+    void releaseWideFields();
+    void unpackFields();
+    void advectPacked(float dt);
+    void buildMultigridLevels();
+    int solveMultigrid(float* x, const float* b, float a, float tolerance, int maxCycles);
+    void vCycle(size_t level, float* x, const float* b, float a);
 };
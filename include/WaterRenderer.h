@@ -4,12 +4,18 @@
 #include "SimpleMath.h"
 #include "Water.h"
 
+class SpectralOcean;
+
 class WaterRenderer {
 public:
     WaterRenderer(int nx, int nz, float dx, const Vec3& origin, float baseLevel, float bottomLevel);
     ~WaterRenderer();
 
     void updateFromWater(const WaterGrid& water);
+    // Far field: ocean out to `extent` from the grid's centre on a mesh of
+    // cells x cells quads, leaving out the quads inside the grid.
+    void setFarField(float extent, int cells);
+    void updateFromOcean(const SpectralOcean& ocean);
     void draw(const float* view, const float* proj);
 
 private:
@@ -29,6 +35,16 @@ private:
     std::vector<Vec3> normals;
     std::vector<unsigned int> indices;
 
+    int farCells;
+    float farExtent;
+    GLuint farVao;
+    GLuint farVbo;
+    GLuint farNbo;
+    GLuint farIbo;
+    std::vector<Vec3> farPositions;
+    std::vector<Vec3> farNormals;
+    std::vector<unsigned int> farIndices;
+
     GLint uView;
     GLint uProj;
     GLint uModel;
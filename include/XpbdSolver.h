@@ -0,0 +1,33 @@
+#pragma once
+#include <vector>
+#include <cstddef>
+#include "ClothKernels.h"
+
+class ThreadPool;
+
+// Extended position-based dynamics backend (Macklin et al. 2016, with the
+// small-steps variant of 2019). Every spring is a distance constraint with
+// compliance 1/stiffness and constraint damping derived from its damping
+// coefficient. Constraints are projected with colored Gauss-Seidel: colors
+// run in sequence, springs inside a color in parallel.
+class XpbdSolver {
+public:
+    // Forces in ps.f* are treated as external and held constant over the
+    // step. Updates ps.p* and ps.v*.
+    void step(ParticleStore& ps, const SpringStore& springs, const std::vector<size_t>& colorOffsets,
+              float deltaTime, float velocityDamping, ThreadPool* pool);
+
+    void setSubsteps(int n) { substeps = n > 0 ? n : 1; }
+    void setIterations(int n) { iterations = n > 0 ? n : 1; }
+    int getSubsteps() const { return substeps; }
+    int getIterations() const { return iterations; }
+
+private:
+    int substeps = 8;
+    int iterations = 1;
+
+    std::vector<float> prevX, prevY, prevZ;
+    std::vector<float> lambda;
+
+    void projectSprings(ParticleStore& ps, const SpringStore& springs, size_t begin, size_t end, float h);
+};
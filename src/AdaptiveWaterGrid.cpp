@@ -0,0 +1,244 @@
+#include "AdaptiveWaterGrid.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <cmath>
+
+// Neighbour directions.
+static const int kDirX[8] = { -1, 0, 1, -1, 1, -1, 0, 1 };
+static const int kDirZ[8] = { -1, -1, -1, 0, 0, 1, 1, 1 };
+
+AdaptiveWaterGrid::AdaptiveWaterGrid(int nx, int nz, float dx, const Vec3& origin, float baseLevel, int ratio)
+    : base(nx, nz, dx, origin, baseLevel), ratio(ratio >= 4 ? 4 : 2),
+      blocksX((nx + kPatchBlock - 1) / kPatchBlock), blocksZ((nz + kPatchBlock - 1) / kPatchBlock),
+      pool(&ThreadPool::shared()), blockPatch(blocksX * blocksZ, -1) {}
+
+void AdaptiveWaterGrid::setGridSetup(std::function<void(WaterGrid&)> fn) {
+    gridSetup = std::move(fn);
+    if (gridSetup) gridSetup(base);
+}
+
+void AdaptiveWaterGrid::setRestDepth(float depth) {
+    base.setRestDepth(depth);
+    for (auto& patch : patches) patch.grid->setRestDepth(depth);
+    for (auto& grid : freePatches) grid->setRestDepth(depth);
+}
+
+void AdaptiveWaterGrid::setThreadPool(ThreadPool* p) {
+    pool = p;
+    base.setThreadPool(p);
+    for (auto& patch : patches) patch.grid->setThreadPool(p);
+    for (auto& grid : freePatches) grid->setThreadPool(p);
+}
+
+// New patches start from the coarse grid, halo included. The children of a
+// coarse cell straddle its node, so the first fine node sits (ratio - 1) / 2
+// fine cells before the first coarse one.
+void AdaptiveWaterGrid::addPatch(int bx, int bz) {
+    const float dx = base.getDx();
+    const Vec3& org = base.getOrigin();
+    const float shift = 0.5f * (ratio - 1) * dx / ratio;
+    const Vec3 corner(org.x + (bx * kPatchBlock - kPatchHalo) * dx - shift, org.y,
+                      org.z + (bz * kPatchBlock - kPatchHalo) * dx - shift);
+    const int cells = (kPatchBlock + 2 * kPatchHalo) * ratio;
+    std::unique_ptr<WaterGrid> grid;
+    if (!freePatches.empty()) {
+        grid = std::move(freePatches.back());
+        freePatches.pop_back();
+        grid->setOrigin(corner);
+    } else {
+        grid = std::make_unique<WaterGrid>(cells, cells, dx / ratio, corner, base.getBaseLevel());
+        grid->setRestDepth(base.getRestDepth());
+        grid->setThreadPool(pool);
+        if (gridSetup) gridSetup(*grid);
+    }
+    grid->prolongFrom(base, 0, 0, cells, cells);
+    blockPatch[bz * blocksX + bx] = static_cast<int>(patches.size());
+    patches.push_back(Patch{ bx, bz, std::move(grid) });
+}
+
+// The coarse cells under the patch already hold its restriction from the
+// last step, so nothing is written back. Swaps the last patch into slot i.
+void AdaptiveWaterGrid::removePatch(size_t i) {
+    blockPatch[patches[i].bz * blocksX + patches[i].bx] = -1;
+    patches[i].grid->reset();
+    freePatches.push_back(std::move(patches[i].grid));
+    if (i + 1 != patches.size()) {
+        patches[i] = std::move(patches.back());
+        blockPatch[patches[i].bz * blocksX + patches[i].bx] = static_cast<int>(i);
+    }
+    patches.pop_back();
+}
+
+void AdaptiveWaterGrid::refineAround(const std::vector<Vec3>& points, float radius) {
+    const float dx = base.getDx();
+    const Vec3& org = base.getOrigin();
+    const float block = kPatchBlock * dx;
+    wanted.assign(blockPatch.size(), 0);
+    for (const Vec3& p : points) {
+        const int bx0 = std::max(0, (int)std::floor((p.x - radius - org.x) / block));
+        const int bx1 = std::min(blocksX - 1, (int)std::floor((p.x + radius - org.x) / block));
+        const int bz0 = std::max(0, (int)std::floor((p.z - radius - org.z) / block));
+        const int bz1 = std::min(blocksZ - 1, (int)std::floor((p.z + radius - org.z) / block));
+        for (int bz = bz0; bz <= bz1; ++bz) {
+            for (int bx = bx0; bx <= bx1; ++bx) {
+                // Distance from the point to the block rectangle.
+                const float x0 = org.x + bx * block, z0 = org.z + bz * block;
+                const float ex = std::max(0.0f, std::max(x0 - p.x, p.x - (x0 + block)));
+                const float ez = std::max(0.0f, std::max(z0 - p.z, p.z - (z0 + block)));
+                if (ex * ex + ez * ez <= radius * radius) wanted[bz * blocksX + bx] = 1;
+            }
+        }
+    }
+    for (size_t i = patches.size(); i-- > 0;) {
+        if (!wanted[patches[i].bz * blocksX + patches[i].bx]) removePatch(i);
+    }
+    for (int b = 0; b < blocksX * blocksZ; ++b) {
+        if (wanted[b] && blockPatch[b] < 0) addPatch(b % blocksX, b / blocksX);
+    }
+}
+
+// The block holding the coarse node nearest the point.
+int AdaptiveWaterGrid::patchAt(float x, float z) const {
+    const float dx = base.getDx();
+    const int bx = (int)std::floor(((x - base.getOrigin().x) / dx + 0.5f) / kPatchBlock);
+    const int bz = (int)std::floor(((z - base.getOrigin().z) / dx + 0.5f) / kPatchBlock);
+    if (bx < 0 || bx >= blocksX || bz < 0 || bz >= blocksZ) return -1;
+    return blockPatch[bz * blocksX + bx];
+}
+
+float AdaptiveWaterGrid::sampleHeight(float x, float z) const {
+    return sampleHeight(x, z, 1);
+}
+
+Vec3 AdaptiveWaterGrid::sampleVelocity(float x, float z) const {
+    return sampleVelocity(x, z, 1);
+}
+
+float AdaptiveWaterGrid::sampleHeight(float x, float z, int level) const {
+    const int p = level > 0 ? patchAt(x, z) : -1;
+    return p >= 0 ? patches[p].grid->sampleHeight(x, z) : base.sampleHeight(x, z);
+}
+
+Vec3 AdaptiveWaterGrid::sampleVelocity(float x, float z, int level) const {
+    const int p = level > 0 ? patchAt(x, z) : -1;
+    return p >= 0 ? patches[p].grid->sampleVelocity(x, z) : base.sampleVelocity(x, z);
+}
+
+// A point impulse lands on one coarse cell, so a patch spreads it over all
+// children of that cell, each hit at its own node, to end up with the same
+// average.
+void AdaptiveWaterGrid::addImpulse(float x, float z, float du, float dv, float dh) {
+    base.addImpulse(x, z, du, dv, dh);
+    const int p = patchAt(x, z);
+    if (p < 0) return;
+    WaterGrid& patch = *patches[p].grid;
+    const float dx = base.getDx(), fdx = dx / ratio;
+    const float cx = base.getOrigin().x + std::floor((x - base.getOrigin().x) / dx + 0.5f) * dx;
+    const float cz = base.getOrigin().z + std::floor((z - base.getOrigin().z) / dx + 0.5f) * dx;
+    const float first = -0.5f * (ratio - 1);
+    for (int k = 0; k < ratio; ++k) {
+        for (int i = 0; i < ratio; ++i) patch.addImpulse(cx + (first + i) * fdx, cz + (first + k) * fdx, du, dv, dh);
+    }
+}
+
+// Patches whose grid does not contain the centre are skipped; their cells
+// in the circle are prolonged from the coarse grid's copy instead. A grid's
+// cells reach half a cell before its first node.
+void AdaptiveWaterGrid::addRadialImpulse(float x, float z, float radius, float dh, float momentumScale) {
+    base.addRadialImpulse(x, z, radius, dh, momentumScale);
+    for (auto& patch : patches) {
+        WaterGrid& grid = *patch.grid;
+        const float span = grid.getNx() * grid.getDx();
+        const Vec3 org = grid.getOrigin() - Vec3(0.5f * grid.getDx(), 0.0f, 0.5f * grid.getDx());
+        if (x < org.x || z < org.z || x >= org.x + span || z >= org.z + span) continue;
+        grid.addRadialImpulse(x, z, radius, dh, momentumScale);
+    }
+}
+
+// Each patch takes the impulses whose centre its grid contains, as in
+// addRadialImpulse, laid out as x, z and dh runs.
+void AdaptiveWaterGrid::addRadialImpulses(const float* xs, const float* zs, const float* dhs, size_t n,
+                                          float radius, float momentumScale) {
+    base.addRadialImpulses(xs, zs, dhs, n, radius, momentumScale);
+    for (auto& patch : patches) {
+        WaterGrid& grid = *patch.grid;
+        const float span = grid.getNx() * grid.getDx();
+        const Vec3 org = grid.getOrigin() - Vec3(0.5f * grid.getDx(), 0.0f, 0.5f * grid.getDx());
+        auto inside = [&](size_t p) {
+            return xs[p] >= org.x && zs[p] >= org.z && xs[p] < org.x + span && zs[p] < org.z + span;
+        };
+        size_t m = 0;
+        for (size_t p = 0; p < n; ++p) m += inside(p);
+        if (m == 0) continue;
+        patchPoints.resize(3 * m);
+        for (size_t p = 0, j = 0; p < n; ++p) {
+            if (!inside(p)) continue;
+            patchPoints[j] = xs[p];
+            patchPoints[m + j] = zs[p];
+            patchPoints[2 * m + j] = dhs[p];
+            ++j;
+        }
+        grid.addRadialImpulses(patchPoints.data(), patchPoints.data() + m, patchPoints.data() + 2 * m, m, radius,
+                               momentumScale);
+    }
+}
+
+// Halos come from the coarse grid, then from the cells of neighbouring
+// patches where there are any. Halos and patch cells are disjoint, so
+// patches fill in parallel.
+void AdaptiveWaterGrid::fillHalos() {
+    const int P = kPatchBlock * ratio, H = kPatchHalo * ratio, G = P + 2 * H;
+    parallelFor(pool, 0, patches.size(), 1, [&](size_t b, size_t e) {
+        for (size_t p = b; p < e; ++p) {
+            WaterGrid& grid = *patches[p].grid;
+            grid.prolongFrom(base, 0, 0, G, H);
+            grid.prolongFrom(base, 0, H + P, G, H);
+            grid.prolongFrom(base, 0, H, H, P);
+            grid.prolongFrom(base, H + P, H, H, P);
+            for (int d = 0; d < 8; ++d) {
+                const int bx = patches[p].bx + kDirX[d], bz = patches[p].bz + kDirZ[d];
+                if (bx < 0 || bx >= blocksX || bz < 0 || bz >= blocksZ) continue;
+                const int n = blockPatch[bz * blocksX + bx];
+                if (n < 0) continue;
+                const int w = kDirX[d] == 0 ? P : H, depth = kDirZ[d] == 0 ? P : H;
+                const int di = kDirX[d] < 0 ? 0 : (kDirX[d] == 0 ? H : H + P);
+                const int dk = kDirZ[d] < 0 ? 0 : (kDirZ[d] == 0 ? H : H + P);
+                const int si = kDirX[d] < 0 ? P : H, sk = kDirZ[d] < 0 ? P : H;
+                grid.copyCells(*patches[n].grid, si, sk, di, dk, w, depth);
+            }
+        }
+    });
+}
+
+// Patches cover disjoint coarse cells.
+void AdaptiveWaterGrid::restrictPatches() {
+    const int P = kPatchBlock * ratio, H = kPatchHalo * ratio;
+    parallelFor(pool, 0, patches.size(), 1, [&](size_t b, size_t e) {
+        for (size_t p = b; p < e; ++p) patches[p].grid->restrictTo(base, H, H, P, P);
+    });
+}
+
+void AdaptiveWaterGrid::step(float dt) {
+    float stable = estimateStableTimeStep();
+    step(dt, std::max(1, (int)std::ceil(dt / stable)));
+}
+
+// As in ClothWorld: with at least as many patches as threads each patch is
+// one task, otherwise they step one after another and parallelise inside.
+void AdaptiveWaterGrid::step(float dt, int substeps) {
+    int iters = std::max(1, substeps);
+    float hdt = dt / iters;
+    const int threads = pool ? pool->size() : 1;
+    for (int it = 0; it < iters; ++it) {
+        fillHalos();
+        base.step(hdt, 1);
+        if (patches.size() >= static_cast<size_t>(threads)) {
+            parallelFor(pool, 0, patches.size(), 1, [&](size_t b, size_t e) {
+                for (size_t p = b; p < e; ++p) patches[p].grid->step(hdt);
+            });
+        } else {
+            for (auto& patch : patches) patch.grid->step(hdt);
+        }
+        restrictPatches();
+    }
+}
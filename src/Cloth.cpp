@@ -1,207 +1,505 @@
 #include "Cloth.h"
 #include <cmath>
+#include <algorithm>
 #include "SimpleMath.h"
+#include "ThreadPool.h"
+#include "CollisionMesh.h"
+#include <cstdint>
+#include <limits>
 
-Cloth::Cloth(int width, int height, float spacing) : windVelocity(Vec3(0.0f)) {
-    particles.reserve(width * height);
+static const size_t kSpringGrain = 2048;
+static const size_t kParticleGrain = 4096;
+
+Cloth::Cloth(int width, int height, float spacing, ClothSolver solver)
+    : particleView(&store), windVelocity(Vec3(0.0f)),
+      pool(&ThreadPool::shared()), solver(solver), meshCacheOwner(nullptr), selfCollisionEnabled(false),
+      sleepEnabled(false), sleepEnergy(1e-4f), sleepFrames(30), sleepDeltaTime(0.0f), sleepingParticles(0), activeDirty(true),
+      lastAirVelocity(Vec3(0.0f)) {
+    topology.build(width, height);
+    store.reserve(topology.vertexCount());
     
     for (int y = 0; y < height; ++y) {
         for (int x = 0; x < width; ++x) {
             Vec3 pos(x * spacing, 0.0f, y * spacing);
-            particles.emplace_back(pos);
+            store.add(pos);
         }
     }
     
     createSprings();
+    computeStableStep();
+    selfCollision.setThickness(spacing * 0.4f);
+
+    tilesX = (width + kSleepTile - 1) / kSleepTile;
+    tilesY = (height + kSleepTile - 1) / kSleepTile;
+    tileAsleep.assign(static_cast<size_t>(tilesX) * tilesY, 0);
+    tileWake.assign(tileAsleep.size(), 0);
+    tileQuiet.assign(tileAsleep.size(), 0);
+    sleepInvMass.assign(store.size(), 0.0f);
+    restingDepth.assign(store.size(), 0.0f);
+    sleepX = store.px; sleepY = store.py; sleepZ = store.pz;
 }
 
+// Face normals are computed per triangle, then each vertex gathers its
+// incident faces through the topology's CSR. Every particle writes only its
+// own normal, so both passes run in parallel without conflicts, and faces are
+// summed in triangle order so the result does not depend on the thread count.
 void Cloth::calculateNormals() {
-    // Reset all normals
-    for (auto& p : particles) {
-        p.normal = Vec3(0.0f);
-    }
-
-    int width = static_cast<int>(sqrt(particles.size()));
-    int height = width;
+    const std::vector<int>& tris = topology.triangles;
+    const size_t numTris = topology.triangleCount();
+    faceNormals.resize(3 * numTris);
 
-    // Calculate face normals and add them to the vertices
-    for (int y = 0; y < height - 1; ++y) {
-        for (int x = 0; x < width - 1; ++x) {
-            Particle& p1 = particles[y * width + x];
-            Particle& p2 = particles[y * width + x + 1];
-            Particle& p3 = particles[(y + 1) * width + x + 1];
-            Particle& p4 = particles[(y + 1) * width + x];
-
-            // Calculate normals for the two triangles that form the quad: (p1, p2, p3) and (p1, p3, p4)
-            //Vec3 normal1 = cross(p2.position - p1.position, p3.position - p1.position);
-            Vec3 normal1 = (p2.position - p1.position).cross(p3.position - p1.position);
-            p1.normal += normal1;
-            p2.normal += normal1;
-            p3.normal += normal1;
-
-            //Vec3 normal2 = cross(p3.position - p1.position, p4.position - p1.position);
-            Vec3 normal2 = (p3.position - p1.position).cross(p4.position - p1.position);
-            p1.normal += normal2;
-            p3.normal += normal2;
-            p4.normal += normal2;
+    parallelFor(pool, 0, numTris, kParticleGrain, [&](size_t b, size_t e) {
+        for (size_t t = b; t < e; ++t) {
+            Vec3 p1 = store.position(tris[3 * t]);
+            Vec3 p2 = store.position(tris[3 * t + 1]);
+            Vec3 p3 = store.position(tris[3 * t + 2]);
+            Vec3 n = (p2 - p1).cross(p3 - p1);
+            faceNormals[3 * t] = n.x; faceNormals[3 * t + 1] = n.y; faceNormals[3 * t + 2] = n.z;
         }
-    }
+    });
 
     // Normalize all the vertex normals for smooth shading
-    for (auto& p : particles) {
-        p.normal = normalize(p.normal);
-    }
+    parallelFor(pool, 0, store.size(), kParticleGrain, [&](size_t b, size_t e) {
+        for (size_t i = b; i < e; ++i) {
+            Vec3 n(0.0f);
+            for (int k = topology.vertexFaceOffsets[i]; k < topology.vertexFaceOffsets[i + 1]; ++k) {
+                int t = topology.vertexFaces[k];
+                n += Vec3(faceNormals[3 * t], faceNormals[3 * t + 1], faceNormals[3 * t + 2]);
+            }
+            n = normalize(n);
+            store.nx[i] = n.x; store.ny[i] = n.y; store.nz[i] = n.z;
+        }
+    });
 }
 
 void Cloth::createSprings() {
-    int width = static_cast<int>(sqrt(particles.size()));
-    int height = width;
-    
+    const int width = topology.width;
+    const int height = topology.height;
+
     for (int y = 0; y < height; ++y) {
         for (int x = 0; x < width; ++x) {
-            int current = y * width + x;
-            
+            int current = topology.index(x, y);
+
             if (x < width - 1) {
-                int right = y * width + (x + 1);
-                float restLength = length(particles[right].position - particles[current].position);
+                int right = topology.index(x + 1, y);
+                float restLength = length(store.position(right) - store.position(current));
                 springs.emplace_back(current, right, restLength, 500.0f, 10.0f);
             }
-            
+
             if (y < height - 1) {
-                int down = (y + 1) * width + x;
-                float restLength = length(particles[down].position - particles[current].position);
+                int down = topology.index(x, y + 1);
+                float restLength = length(store.position(down) - store.position(current));
                 springs.emplace_back(current, down, restLength, 500.0f, 10.0f);
             }
-            
+
             if (x < width - 1 && y < height - 1) {
-                int diagonal = (y + 1) * width + (x + 1);
-                float restLength = length(particles[diagonal].position - particles[current].position);
+                int diagonal = topology.index(x + 1, y + 1);
+                float restLength = length(store.position(diagonal) - store.position(current));
                 springs.emplace_back(current, diagonal, restLength, 250.0f, 6.0f);
             }
         }
     }
+
+    // Bending springs skip one particle along each grid axis.
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            int current = topology.index(x, y);
+
+            if (x < width - 2) {
+                int right = topology.index(x + 2, y);
+                float restLength = length(store.position(right) - store.position(current));
+                springs.emplace_back(current, right, restLength, 100.0f, 2.0f);
+            }
+
+            if (y < height - 2) {
+                int down = topology.index(x, y + 2);
+                float restLength = length(store.position(down) - store.position(current));
+                springs.emplace_back(current, down, restLength, 100.0f, 2.0f);
+            }
+        }
+    }
+
+    colorSprings();
+    topology.buildSpringAdjacency(springStore);
 }
 
-void Cloth::update(float deltaTime, const Vec3& gravity, float dragCoefficient, const Vec3& airVelocity) {
-    for (auto& particle : particles) particle.force = Vec3(0.0f);
+// Greedy edge coloring: each spring takes the lowest color not yet used at
+// either endpoint. The grid has degree <= 12, so this stays well under 64
+// colors; anything that does not fit goes into a final group run serially.
+void Cloth::colorSprings() {
+    const int kMaxColors = 64;
+    std::vector<uint64_t> used(store.size(), 0);
+    std::vector<std::vector<int>> groups(kMaxColors + 1);
+    for (int i = 0; i < static_cast<int>(springs.size()); ++i) {
+        const Spring& s = springs[i];
+        uint64_t taken = used[s.particle1] | used[s.particle2];
+        int color = kMaxColors;
+        for (int c = 0; c < kMaxColors; ++c) {
+            if (!(taken & (uint64_t(1) << c))) { color = c; break; }
+        }
+        if (color < kMaxColors) {
+            used[s.particle1] |= uint64_t(1) << color;
+            used[s.particle2] |= uint64_t(1) << color;
+        }
+        groups[color].push_back(i);
+    }
+
+    springStore.clear();
+    springColorOffsets.assign(1, 0);
+    for (int c = 0; c < kMaxColors; ++c) {
+        if (groups[c].empty()) continue;
+        for (int i : groups[c]) {
+            const Spring& s = springs[i];
+            springStore.add(s.particle1, s.particle2, s.restLength, s.stiffness, s.damping);
+        }
+        springColorOffsets.push_back(springStore.size());
+    }
+    for (int i : groups[kMaxColors]) {
+        const Spring& s = springs[i];
+        springStore.add(s.particle1, s.particle2, s.restLength, s.stiffness, s.damping);
+        springColorOffsets.push_back(springStore.size());
+    }
+}
 
-    applySpringForces();
+// For one damped spring mode, symplectic Euler is stable while
+// h^2 w^2 + 2 h g < 4, with w^2 and g the largest eigenvalues of M^-1 K and
+// M^-1 D. Both are bounded by Gershgorin row sums, 2 * sum(k) / m and
+// 2 * sum(d) / m over each particle's springs.
+void Cloth::computeStableStep() {
+    std::vector<float> sumK(store.size(), 0.0f), sumD(store.size(), 0.0f);
+    for (size_t s = 0; s < springStore.size(); ++s) {
+        for (int p : { springStore.p1[s], springStore.p2[s] }) {
+            sumK[p] += springStore.stiffness[s];
+            sumD[p] += springStore.damping[s];
+        }
+    }
+    float w2 = 0.0f, g = 0.0f;
+    for (size_t i = 0; i < store.size(); ++i) {
+        w2 = std::max(w2, 2.0f * sumK[i] / store.mass[i]);
+        g = std::max(g, 2.0f * sumD[i] / store.mass[i]);
+    }
+    if (w2 > 0.0f) explicitStableStep = (std::sqrt(g * g + 4.0f * w2) - g) / w2;
+    else if (g > 0.0f) explicitStableStep = 2.0f / g;
+    else explicitStableStep = std::numeric_limits<float>::infinity();
+}
+
+float Cloth::estimateStableTimeStep() const {
+    if (solver == ClothSolver::ExplicitEuler) return explicitStableStep;
+    return std::numeric_limits<float>::infinity();
+}
+
+void Cloth::update(float deltaTime, const Vec3& gravity, float dragCoefficient, const Vec3& airVelocity) {
+    prepareForces();
 
     applyGravity(gravity);
     applyAirDrag(dragCoefficient, airVelocity);
 
-    integrateVelocities(deltaTime);
-    integratePositions(deltaTime);
+    finalizeIntegration(deltaTime);
 }
 
+// Under XPBD springs are constraints, so only external forces are gathered.
 void Cloth::prepareForces() {
-    for (auto& particle : particles) particle.force = Vec3(0.0f);
-    applySpringForces();
+    if (sleepEnabled) {
+        updateSleep();
+        processWakeRequests();
+    }
+    store.clearForces();
+    if (solver != ClothSolver::XPBD) applySpringForces();
 }
 
 void Cloth::finalizeIntegration(float deltaTime) {
-    integrateVelocities(deltaTime);
-    integratePositions(deltaTime);
+    sleepDeltaTime = deltaTime;
+    if (solver == ClothSolver::ImplicitEuler) {
+        implicitSolver.step(store, springStore, topology, deltaTime, 0.997f, pool);
+    } else if (solver == ClothSolver::XPBD) {
+        bool sleeping = sleepingParticles > 0;
+        xpbdSolver.step(store, sleeping ? activeSprings : springStore, sleeping ? activeColorOffsets : springColorOffsets,
+                        deltaTime, 0.997f, pool);
+    } else {
+        integrateVelocities(deltaTime);
+        integratePositions(deltaTime);
+    }
+
+    if (selfCollisionEnabled) {
+        selfCollision.resolve(store, topology.triangles, topology.width, deltaTime, pool);
+    }
 }
 
+// Colors run one after another; springs inside a color touch disjoint
+// particles, so their chunks can scatter concurrently. Chunk boundaries are
+// fixed multiples of kSpringGrain, which keeps every particle's summation
+// order (and the SIMD/scalar split) independent of the thread count.
 void Cloth::applySpringForces() {
-    for (const auto& spring : springs) {
-        Particle& p1 = particles[spring.particle1];
-        Particle& p2 = particles[spring.particle2];
-        
-        Vec3 delta = p2.position - p1.position;
-        float distance = length(delta);
-        
-        if (distance > 0.0f) {
-            Vec3 direction = delta / distance;
-            float displacement = distance - spring.restLength;
-            
-            Vec3 springForce = direction * displacement * spring.stiffness;
-            
-            Vec3 relativeVelocity = p2.velocity - p1.velocity;
-            Vec3 dampingForce = direction * dot(relativeVelocity, direction) * spring.damping;
-            
-            Vec3 totalForce = springForce + dampingForce;
-            float maxForce = 800.0f;
-            float mag = length(totalForce);
-            if (mag > maxForce && mag > 0.0f) {
-                totalForce = totalForce * (maxForce / mag);
-            }
-            
-            if (!p1.fixed) p1.force += totalForce;
-            if (!p2.fixed) p2.force -= totalForce;
-        }
+    const bool sleeping = sleepingParticles > 0;
+    const SpringStore& s = sleeping ? activeSprings : springStore;
+    const std::vector<size_t>& offsets = sleeping ? activeColorOffsets : springColorOffsets;
+    for (size_t c = 0; c + 1 < offsets.size(); ++c) {
+        parallelFor(pool, offsets[c], offsets[c + 1], kSpringGrain, [&](size_t b, size_t e) {
+            accumulateSpringForces(store, s, b, e, 800.0f);
+        });
     }
 }
 
 void Cloth::integrateVelocities(float deltaTime) {
-    for (auto& particle : particles) {
-        if (!particle.fixed) {
-            particle.velocity += (particle.force / particle.mass) * deltaTime;
-            particle.velocity = particle.velocity * 0.997f;
-        }
-    }
+    forEachActiveChunk([&](size_t b, size_t e) {
+        integrateVelocitiesKernel(store, deltaTime, 0.997f, b, e);
+    });
 }
 
 void Cloth::integratePositions(float deltaTime) {
-    for (auto& particle : particles) {
-        if (!particle.fixed) {
-            particle.position += particle.velocity * deltaTime;
+    forEachActiveChunk([&](size_t b, size_t e) {
+        integratePositionsKernel(store, deltaTime, b, e);
+    });
+}
+
+void Cloth::applyGravity(const Vec3& gravity) {
+    forEachActiveChunk([&](size_t b, size_t e) {
+        accumulateGravity(store, gravity, b, e);
+    });
+}
+
+void Cloth::applyAirDrag(float dragCoefficient, const Vec3& airVelocity) {
+    if (sleepEnabled && length(airVelocity - lastAirVelocity) > 1e-3f) {
+        std::fill(tileWake.begin(), tileWake.end(), 1);
+    }
+    lastAirVelocity = airVelocity;
+    forEachActiveChunk([&](size_t b, size_t e) {
+        accumulateAirDrag(store, dragCoefficient, airVelocity, b, e);
+    });
+}
+
+// With nothing asleep this is the plain fixed-grain loop over every particle.
+void Cloth::forEachActiveChunk(const std::function<void(size_t, size_t)>& fn) {
+    if (sleepingParticles == 0) {
+        parallelFor(pool, 0, store.size(), kParticleGrain, fn);
+        return;
+    }
+    parallelFor(pool, 0, activeChunks.size(), 1, [&](size_t b, size_t e) {
+        for (size_t c = b; c < e; ++c) fn(activeChunks[c].first, activeChunks[c].second);
+    });
+}
+
+void Cloth::setSleepEnabled(bool enabled) {
+    if (!enabled) wakeAll();
+    sleepEnabled = enabled;
+    std::fill(tileQuiet.begin(), tileQuiet.end(), 0);
+}
+
+void Cloth::wakeParticle(size_t particle) {
+    if (sleepEnabled) tileWake[tileOf(particle)] = 1;
+}
+
+void Cloth::wakeAll() {
+    for (int t = 0; t < static_cast<int>(tileAsleep.size()); ++t) {
+        if (tileAsleep[t]) setTileAsleep(t, false);
+        tileWake[t] = 0;
+    }
+    if (activeDirty) rebuildActiveSets();
+}
+
+void Cloth::setTileAsleep(int tile, bool asleep) {
+    const int x0 = (tile % tilesX) * kSleepTile, y0 = (tile / tilesX) * kSleepTile;
+    const int x1 = std::min(x0 + kSleepTile, topology.width), y1 = std::min(y0 + kSleepTile, topology.height);
+    for (int y = y0; y < y1; ++y) {
+        for (int x = x0; x < x1; ++x) {
+            int i = topology.index(x, y);
+            if (asleep) {
+                sleepInvMass[i] = store.invMass[i];
+                store.invMass[i] = 0.0f;
+                store.vx[i] = 0.0f; store.vy[i] = 0.0f; store.vz[i] = 0.0f;
+            } else {
+                store.invMass[i] = sleepInvMass[i];
+            }
         }
     }
+    size_t count = static_cast<size_t>(x1 - x0) * (y1 - y0);
+    if (asleep) sleepingParticles += count; else sleepingParticles -= count;
+    tileAsleep[tile] = asleep ? 1 : 0;
+    tileQuiet[tile] = 0;
+    activeDirty = true;
 }
 
-void Cloth::applyGravity(const Vec3& gravity) {
-    for (auto& particle : particles) {
-        if (!particle.fixed) {
-            particle.force += gravity * particle.mass;
+void Cloth::processWakeRequests() {
+    for (int t = 0; t < static_cast<int>(tileWake.size()); ++t) {
+        if (!tileWake[t]) continue;
+        tileWake[t] = 0;
+        if (tileAsleep[t]) setTileAsleep(t, false);
+    }
+    if (activeDirty) rebuildActiveSets();
+}
+
+void Cloth::rebuildActiveSets() {
+    activeDirty = false;
+    activeChunks.clear();
+    activeSprings.clear();
+    activeColorOffsets.assign(1, 0);
+    if (sleepingParticles == 0) return;
+
+    const size_t n = store.size();
+    size_t runStart = 0;
+    bool inRun = false;
+    for (size_t i = 0; i <= n; ++i) {
+        bool awake = i < n && !tileAsleep[tileOf(i)];
+        if (awake && !inRun) { runStart = i; inRun = true; }
+        if (inRun && (!awake || i - runStart == kParticleGrain)) {
+            activeChunks.emplace_back(runStart, i);
+            runStart = i;
+            inRun = awake;
+        }
+    }
+
+    for (size_t c = 0; c + 1 < springColorOffsets.size(); ++c) {
+        size_t before = activeSprings.size();
+        for (size_t s = springColorOffsets[c]; s < springColorOffsets[c + 1]; ++s) {
+            int a = springStore.p1[s], b = springStore.p2[s];
+            if (tileAsleep[tileOf(a)] && tileAsleep[tileOf(b)]) continue;
+            activeSprings.add(a, b, springStore.rest[s], springStore.stiffness[s], springStore.damping[s]);
         }
+        if (activeSprings.size() != before) activeColorOffsets.push_back(activeSprings.size());
     }
 }
 
-void Cloth::applyAirDrag(float dragCoefficient, const Vec3& airVelocity) {
-    for (auto& particle : particles) {
-        if (!particle.fixed) {
-            Vec3 relativeVelocity = particle.velocity - airVelocity;
-            float speed = length(relativeVelocity);
-            
-            if (speed > 0.0f) {
-                Vec3 dragForce = -normalize(relativeVelocity) * speed * dragCoefficient;
-                particle.force += dragForce;
+// Kinetic energy per unit mass of every awake region, compared against the
+// threshold. Velocities come from the displacement since the previous check
+// rather than from v, so a particle resting on a collider (whose v still
+// carries the gravity it gained inside the step) reads as still. A region
+// that is moving wakes its sleeping neighbours; a region only falls asleep
+// once all of its neighbours are quiet as well.
+void Cloth::updateSleep() {
+    const int tileCount = static_cast<int>(tileAsleep.size());
+    const float invDt = sleepDeltaTime > 0.0f ? 1.0f / sleepDeltaTime : 0.0f;
+    parallelFor(pool, 0, tileCount, 16, [&](size_t b, size_t e) {
+        for (size_t t = b; t < e; ++t) {
+            if (tileAsleep[t]) continue;
+            const int x0 = (static_cast<int>(t) % tilesX) * kSleepTile, y0 = (static_cast<int>(t) / tilesX) * kSleepTile;
+            const int x1 = std::min(x0 + kSleepTile, topology.width), y1 = std::min(y0 + kSleepTile, topology.height);
+            float energy = 0.0f, mass = 0.0f;
+            for (int y = y0; y < y1; ++y) {
+                for (int x = x0; x < x1; ++x) {
+                    int i = topology.index(x, y);
+                    float dx = store.px[i] - sleepX[i], dy = store.py[i] - sleepY[i], dz = store.pz[i] - sleepZ[i];
+                    sleepX[i] = store.px[i]; sleepY[i] = store.py[i]; sleepZ[i] = store.pz[i];
+                    if (store.invMass[i] == 0.0f) continue;
+                    energy += 0.5f * store.mass[i] * (dx * dx + dy * dy + dz * dz) * invDt * invDt;
+                    mass += store.mass[i];
+                }
             }
+            bool quiet = sleepDeltaTime > 0.0f && energy <= sleepEnergy * mass;
+            tileQuiet[t] = quiet ? tileQuiet[t] + 1 : 0;
         }
+    });
+
+    auto forNeighbours = [&](int t, const std::function<void(int)>& fn) {
+        int tx = t % tilesX, ty = t / tilesX;
+        for (int dy = -1; dy <= 1; ++dy) {
+            for (int dx = -1; dx <= 1; ++dx) {
+                int nx = tx + dx, ny = ty + dy;
+                if ((dx || dy) && nx >= 0 && nx < tilesX && ny >= 0 && ny < tilesY) fn(ny * tilesX + nx);
+            }
+        }
+    };
+
+    for (int t = 0; t < tileCount; ++t) {
+        if (tileAsleep[t] || tileQuiet[t] > 0) continue;
+        forNeighbours(t, [&](int o) { if (tileAsleep[o]) tileWake[o] = 1; });
+    }
+    for (int t = 0; t < tileCount; ++t) {
+        if (tileAsleep[t] || tileQuiet[t] < sleepFrames) continue;
+        bool settled = true;
+        forNeighbours(t, [&](int o) { if (!tileAsleep[o] && tileQuiet[o] == 0) settled = false; });
+        if (settled) setTileAsleep(t, true);
     }
 }
 
 void Cloth::handleCollision(const Vec3& surfaceNormal, float surfaceHeight) {
-    for (auto& particle : particles) {
-        if (!particle.fixed) {
-            float dotProduct = dot(particle.position, surfaceNormal);
-            
-            if (dotProduct < surfaceHeight) {
-                particle.position = particle.position - surfaceNormal * (dotProduct - surfaceHeight);
-                
-                float velocityDot = dot(particle.velocity, surfaceNormal);
-                if (velocityDot < 0.0f) {
-                    particle.velocity = particle.velocity - surfaceNormal * velocityDot * 0.8f;
-                }
+    for (size_t i = 0; i < store.size(); ++i) {
+        if (store.invMass[i] == 0.0f) continue;
+        Vec3 position = store.position(i);
+        float dotProduct = dot(position, surfaceNormal);
+
+        if (dotProduct < surfaceHeight) {
+            position = position - surfaceNormal * (dotProduct - surfaceHeight);
+            store.px[i] = position.x; store.py[i] = position.y; store.pz[i] = position.z;
+
+            Vec3 velocity = store.velocity(i);
+            float velocityDot = dot(velocity, surfaceNormal);
+            if (velocityDot < 0.0f) {
+                velocity = velocity - surfaceNormal * velocityDot * 0.8f;
+                store.vx[i] = velocity.x; store.vy[i] = velocity.y; store.vz[i] = velocity.z;
             }
         }
     }
 }
 
+void Cloth::handleMeshCollision(const CollisionMesh& mesh, float thickness, float friction) {
+    if (meshCacheOwner != &mesh || meshCacheDist.size() != store.size()) {
+        meshCacheOwner = &mesh;
+        meshCacheX.assign(store.size(), 0.0f);
+        meshCacheY.assign(store.size(), 0.0f);
+        meshCacheZ.assign(store.size(), 0.0f);
+        meshCacheDist.assign(store.size(), 0.0f);
+    }
+
+    parallelFor(pool, 0, store.size(), 256, [&](size_t b, size_t e) {
+        for (size_t i = b; i < e; ++i) {
+            if (store.invMass[i] == 0.0f) continue;
+            Vec3 position = store.position(i);
+            Vec3 moved = position - Vec3(meshCacheX[i], meshCacheY[i], meshCacheZ[i]);
+            if (length(moved) < meshCacheDist[i] - thickness) continue;
+
+            MeshHit hit;
+            float boundsDist = mesh.boundsDistance(position);
+            if (boundsDist > thickness) {
+                hit.distance = boundsDist;
+            } else if (!mesh.closestPoint(position, thickness, hit)) {
+                // Nothing within reach: either clear of the mesh or buried
+                // deeper than `thickness`, which only the signed distance tells.
+                hit = mesh.signedDistance(position);
+                if (hit.triangle < 0) continue;
+            }
+            meshCacheX[i] = position.x; meshCacheY[i] = position.y; meshCacheZ[i] = position.z;
+            meshCacheDist[i] = hit.distance;
+            if (hit.distance >= thickness) continue;
+
+            position = hit.point + hit.normal * thickness;
+            store.px[i] = position.x; store.py[i] = position.y; store.pz[i] = position.z;
+            meshCacheX[i] = position.x; meshCacheY[i] = position.y; meshCacheZ[i] = position.z;
+            meshCacheDist[i] = thickness;
+
+            Vec3 velocity = store.velocity(i);
+            float vn = dot(velocity, hit.normal);
+            if (vn < 0.0f) {
+                Vec3 tangential = velocity - hit.normal * vn;
+                velocity = tangential * (1.0f - friction);
+                store.vx[i] = velocity.x; store.vy[i] = velocity.y; store.vz[i] = velocity.z;
+            }
+        }
+    });
+}
+
 void Cloth::fixCorner(int corner) {
-    if (corner >= 0 && corner < static_cast<int>(particles.size())) {
-        particles[corner].fixed = true;
+    if (corner >= 0 && corner < static_cast<int>(store.size())) {
+        store.invMass[corner] = 0.0f;
+        sleepInvMass[corner] = 0.0f;
+        store.vx[corner] = 0.0f;
+        store.vy[corner] = 0.0f;
+        store.vz[corner] = 0.0f;
     }
 }
 
 void Cloth::setInitialVelocity(const Vec3& velocity) {
-    for (auto& particle : particles) {
+    wakeAll();
+    for (auto& particle : particleView) {
         if (!particle.fixed) {
             particle.velocity = velocity;
         }
     }
-} 
-
+}
 
+void Cloth::translate(const Vec3& offset) {
+    for (size_t i = 0; i < store.size(); ++i) {
+        store.px[i] += offset.x;
+        store.py[i] += offset.y;
+        store.pz[i] += offset.z;
+    }
+}
@@ -0,0 +1,234 @@
+#include "ClothKernels.h"
+#include <cmath>
+#include <algorithm>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define CLOTH_SIMD_AVX2 1
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define CLOTH_SIMD_SSE2 1
+#endif
+
+void ParticleStore::reserve(size_t n) {
+    for (auto* a : { &px, &py, &pz, &vx, &vy, &vz, &fx, &fy, &fz, &nx, &ny, &nz, &mass, &invMass }) {
+        a->reserve(n);
+    }
+}
+
+void ParticleStore::add(const Vec3& pos, float m) {
+    px.push_back(pos.x); py.push_back(pos.y); pz.push_back(pos.z);
+    vx.push_back(0.0f); vy.push_back(0.0f); vz.push_back(0.0f);
+    fx.push_back(0.0f); fy.push_back(0.0f); fz.push_back(0.0f);
+    nx.push_back(0.0f); ny.push_back(0.0f); nz.push_back(0.0f);
+    mass.push_back(m);
+    invMass.push_back(1.0f / m);
+}
+
+void ParticleStore::clearForces() {
+    std::fill(fx.begin(), fx.end(), 0.0f);
+    std::fill(fy.begin(), fy.end(), 0.0f);
+    std::fill(fz.begin(), fz.end(), 0.0f);
+}
+
+void SpringStore::clear() {
+    p1.clear(); p2.clear(); rest.clear(); stiffness.clear(); damping.clear();
+}
+
+void SpringStore::add(int a, int b, float restLength, float k, float d) {
+    p1.push_back(a); p2.push_back(b);
+    rest.push_back(restLength);
+    stiffness.push_back(k);
+    damping.push_back(d);
+}
+
+// Thin wrappers so each kernel is written once for AVX2 and SSE2.
+#if defined(CLOTH_SIMD_AVX2)
+typedef __m256 vfloat;
+static const size_t kLanes = 8;
+static inline vfloat vload(const float* p) { return _mm256_loadu_ps(p); }
+static inline void vstore(float* p, vfloat a) { _mm256_storeu_ps(p, a); }
+static inline vfloat vset1(float s) { return _mm256_set1_ps(s); }
+static inline vfloat vadd(vfloat a, vfloat b) { return _mm256_add_ps(a, b); }
+static inline vfloat vsub(vfloat a, vfloat b) { return _mm256_sub_ps(a, b); }
+static inline vfloat vmul(vfloat a, vfloat b) { return _mm256_mul_ps(a, b); }
+static inline vfloat vdiv(vfloat a, vfloat b) { return _mm256_div_ps(a, b); }
+static inline vfloat vsqrt(vfloat a) { return _mm256_sqrt_ps(a); }
+static inline vfloat vmin(vfloat a, vfloat b) { return _mm256_min_ps(a, b); }
+static inline vfloat vmax(vfloat a, vfloat b) { return _mm256_max_ps(a, b); }
+static inline vfloat vgt(vfloat a, vfloat b) { return _mm256_cmp_ps(a, b, _CMP_GT_OQ); }
+static inline vfloat vand(vfloat a, vfloat b) { return _mm256_and_ps(a, b); }
+static inline vfloat vselect(vfloat mask, vfloat a, vfloat b) { return _mm256_blendv_ps(b, a, mask); }
+static inline vfloat vgather(const float* base, const int* idx) {
+    return _mm256_i32gather_ps(base, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(idx)), 4);
+}
+#elif defined(CLOTH_SIMD_SSE2)
+typedef __m128 vfloat;
+static const size_t kLanes = 4;
+static inline vfloat vload(const float* p) { return _mm_loadu_ps(p); }
+static inline void vstore(float* p, vfloat a) { _mm_storeu_ps(p, a); }
+static inline vfloat vset1(float s) { return _mm_set1_ps(s); }
+static inline vfloat vadd(vfloat a, vfloat b) { return _mm_add_ps(a, b); }
+static inline vfloat vsub(vfloat a, vfloat b) { return _mm_sub_ps(a, b); }
+static inline vfloat vmul(vfloat a, vfloat b) { return _mm_mul_ps(a, b); }
+static inline vfloat vdiv(vfloat a, vfloat b) { return _mm_div_ps(a, b); }
+static inline vfloat vsqrt(vfloat a) { return _mm_sqrt_ps(a); }
+static inline vfloat vmin(vfloat a, vfloat b) { return _mm_min_ps(a, b); }
+static inline vfloat vmax(vfloat a, vfloat b) { return _mm_max_ps(a, b); }
+static inline vfloat vgt(vfloat a, vfloat b) { return _mm_cmpgt_ps(a, b); }
+static inline vfloat vand(vfloat a, vfloat b) { return _mm_and_ps(a, b); }
+static inline vfloat vselect(vfloat mask, vfloat a, vfloat b) { return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b)); }
+static inline vfloat vgather(const float* base, const int* idx) {
+    return _mm_setr_ps(base[idx[0]], base[idx[1]], base[idx[2]], base[idx[3]]);
+}
+#endif
+
+const char* clothKernelIsa() {
+#if defined(CLOTH_SIMD_AVX2)
+    return "AVX2";
+#elif defined(CLOTH_SIMD_SSE2)
+    return "SSE2";
+#else
+    return "scalar";
+#endif
+}
+
+static inline void springScalar(ParticleStore& ps, const SpringStore& s, size_t i, float maxForce) {
+    int a = s.p1[i];
+    int b = s.p2[i];
+    float dx = ps.px[b] - ps.px[a];
+    float dy = ps.py[b] - ps.py[a];
+    float dz = ps.pz[b] - ps.pz[a];
+    float distance = std::sqrt(dx * dx + dy * dy + dz * dz);
+    if (distance <= 0.0f) return;
+
+    float dirx = dx / distance, diry = dy / distance, dirz = dz / distance;
+    float rvx = ps.vx[b] - ps.vx[a];
+    float rvy = ps.vy[b] - ps.vy[a];
+    float rvz = ps.vz[b] - ps.vz[a];
+    // Spring and damping forces are both along the spring axis, so the force
+    // clamp reduces to clamping the signed magnitude.
+    float mag = (distance - s.rest[i]) * s.stiffness[i] + (rvx * dirx + rvy * diry + rvz * dirz) * s.damping[i];
+    mag = std::max(-maxForce, std::min(maxForce, mag));
+
+    float fxs = dirx * mag, fys = diry * mag, fzs = dirz * mag;
+    ps.fx[a] += fxs; ps.fy[a] += fys; ps.fz[a] += fzs;
+    ps.fx[b] -= fxs; ps.fy[b] -= fys; ps.fz[b] -= fzs;
+}
+
+void accumulateSpringForces(ParticleStore& ps, const SpringStore& s, size_t begin, size_t end, float maxForce) {
+    size_t i = begin;
+#if defined(CLOTH_SIMD_AVX2) || defined(CLOTH_SIMD_SSE2)
+    const vfloat zero = vset1(0.0f);
+    const vfloat one = vset1(1.0f);
+    const vfloat vMax = vset1(maxForce);
+    const vfloat vMin = vset1(-maxForce);
+    alignas(32) float outX[kLanes], outY[kLanes], outZ[kLanes];
+    for (; i + kLanes <= end; i += kLanes) {
+        const int* ia = &s.p1[i];
+        const int* ib = &s.p2[i];
+        vfloat dx = vsub(vgather(ps.px.data(), ib), vgather(ps.px.data(), ia));
+        vfloat dy = vsub(vgather(ps.py.data(), ib), vgather(ps.py.data(), ia));
+        vfloat dz = vsub(vgather(ps.pz.data(), ib), vgather(ps.pz.data(), ia));
+        vfloat distance = vsqrt(vadd(vadd(vmul(dx, dx), vmul(dy, dy)), vmul(dz, dz)));
+        vfloat valid = vgt(distance, zero);
+        vfloat safe = vselect(valid, distance, one);
+
+        vfloat dirx = vdiv(dx, safe), diry = vdiv(dy, safe), dirz = vdiv(dz, safe);
+        vfloat rvx = vsub(vgather(ps.vx.data(), ib), vgather(ps.vx.data(), ia));
+        vfloat rvy = vsub(vgather(ps.vy.data(), ib), vgather(ps.vy.data(), ia));
+        vfloat rvz = vsub(vgather(ps.vz.data(), ib), vgather(ps.vz.data(), ia));
+        vfloat relDot = vadd(vadd(vmul(rvx, dirx), vmul(rvy, diry)), vmul(rvz, dirz));
+        vfloat mag = vadd(vmul(vsub(distance, vload(&s.rest[i])), vload(&s.stiffness[i])),
+                          vmul(relDot, vload(&s.damping[i])));
+        mag = vand(vmax(vMin, vmin(vMax, mag)), valid);
+
+        vstore(outX, vmul(dirx, mag));
+        vstore(outY, vmul(diry, mag));
+        vstore(outZ, vmul(dirz, mag));
+        // No scatter instruction below AVX-512, and endpoints may repeat
+        // within a block, so the accumulation stays scalar and ordered.
+        for (size_t j = 0; j < kLanes; ++j) {
+            int a = ia[j], b = ib[j];
+            ps.fx[a] += outX[j]; ps.fy[a] += outY[j]; ps.fz[a] += outZ[j];
+            ps.fx[b] -= outX[j]; ps.fy[b] -= outY[j]; ps.fz[b] -= outZ[j];
+        }
+    }
+#endif
+    for (; i < end; ++i) springScalar(ps, s, i, maxForce);
+}
+
+void accumulateGravity(ParticleStore& ps, const Vec3& gravity, size_t begin, size_t end) {
+    size_t i = begin;
+#if defined(CLOTH_SIMD_AVX2) || defined(CLOTH_SIMD_SSE2)
+    const vfloat gx = vset1(gravity.x), gy = vset1(gravity.y), gz = vset1(gravity.z);
+    for (; i + kLanes <= end; i += kLanes) {
+        vfloat m = vload(&ps.mass[i]);
+        vstore(&ps.fx[i], vadd(vload(&ps.fx[i]), vmul(gx, m)));
+        vstore(&ps.fy[i], vadd(vload(&ps.fy[i]), vmul(gy, m)));
+        vstore(&ps.fz[i], vadd(vload(&ps.fz[i]), vmul(gz, m)));
+    }
+#endif
+    for (; i < end; ++i) {
+        ps.fx[i] += gravity.x * ps.mass[i];
+        ps.fy[i] += gravity.y * ps.mass[i];
+        ps.fz[i] += gravity.z * ps.mass[i];
+    }
+}
+
+// Linear drag: -normalize(v - air) * |v - air| * c is just -(v - air) * c.
+void accumulateAirDrag(ParticleStore& ps, float dragCoefficient, const Vec3& airVelocity, size_t begin, size_t end) {
+    size_t i = begin;
+#if defined(CLOTH_SIMD_AVX2) || defined(CLOTH_SIMD_SSE2)
+    const vfloat c = vset1(dragCoefficient);
+    const vfloat ax = vset1(airVelocity.x), ay = vset1(airVelocity.y), az = vset1(airVelocity.z);
+    for (; i + kLanes <= end; i += kLanes) {
+        vstore(&ps.fx[i], vsub(vload(&ps.fx[i]), vmul(vsub(vload(&ps.vx[i]), ax), c)));
+        vstore(&ps.fy[i], vsub(vload(&ps.fy[i]), vmul(vsub(vload(&ps.vy[i]), ay), c)));
+        vstore(&ps.fz[i], vsub(vload(&ps.fz[i]), vmul(vsub(vload(&ps.vz[i]), az), c)));
+    }
+#endif
+    for (; i < end; ++i) {
+        ps.fx[i] -= (ps.vx[i] - airVelocity.x) * dragCoefficient;
+        ps.fy[i] -= (ps.vy[i] - airVelocity.y) * dragCoefficient;
+        ps.fz[i] -= (ps.vz[i] - airVelocity.z) * dragCoefficient;
+    }
+}
+
+// Fixed particles have invMass == 0 and zero velocity, so they stay put.
+void integrateVelocitiesKernel(ParticleStore& ps, float deltaTime, float velocityDamping, size_t begin, size_t end) {
+    size_t i = begin;
+#if defined(CLOTH_SIMD_AVX2) || defined(CLOTH_SIMD_SSE2)
+    const vfloat dt = vset1(deltaTime);
+    const vfloat damp = vset1(velocityDamping);
+    for (; i + kLanes <= end; i += kLanes) {
+        vfloat s = vmul(vload(&ps.invMass[i]), dt);
+        vstore(&ps.vx[i], vmul(vadd(vload(&ps.vx[i]), vmul(vload(&ps.fx[i]), s)), damp));
+        vstore(&ps.vy[i], vmul(vadd(vload(&ps.vy[i]), vmul(vload(&ps.fy[i]), s)), damp));
+        vstore(&ps.vz[i], vmul(vadd(vload(&ps.vz[i]), vmul(vload(&ps.fz[i]), s)), damp));
+    }
+#endif
+    for (; i < end; ++i) {
+        float s = ps.invMass[i] * deltaTime;
+        ps.vx[i] = (ps.vx[i] + ps.fx[i] * s) * velocityDamping;
+        ps.vy[i] = (ps.vy[i] + ps.fy[i] * s) * velocityDamping;
+        ps.vz[i] = (ps.vz[i] + ps.fz[i] * s) * velocityDamping;
+    }
+}
+
+void integratePositionsKernel(ParticleStore& ps, float deltaTime, size_t begin, size_t end) {
+    size_t i = begin;
+#if defined(CLOTH_SIMD_AVX2) || defined(CLOTH_SIMD_SSE2)
+    const vfloat dt = vset1(deltaTime);
+    for (; i + kLanes <= end; i += kLanes) {
+        vstore(&ps.px[i], vadd(vload(&ps.px[i]), vmul(vload(&ps.vx[i]), dt)));
+        vstore(&ps.py[i], vadd(vload(&ps.py[i]), vmul(vload(&ps.vy[i]), dt)));
+        vstore(&ps.pz[i], vadd(vload(&ps.pz[i]), vmul(vload(&ps.vz[i]), dt)));
+    }
+#endif
+    for (; i < end; ++i) {
+        ps.px[i] += ps.vx[i] * deltaTime;
+        ps.py[i] += ps.vy[i] * deltaTime;
+        ps.pz[i] += ps.vz[i] * deltaTime;
+    }
+}
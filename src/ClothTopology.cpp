@@ -0,0 +1,46 @@
+#include "ClothTopology.h"
+
+void ClothTopology::build(int w, int h) {
+    width = w;
+    height = h;
+
+    triangles.clear();
+    triangles.reserve(static_cast<size_t>(6) * (w > 1 ? w - 1 : 0) * (h > 1 ? h - 1 : 0));
+    for (int y = 0; y < height - 1; ++y) {
+        for (int x = 0; x < width - 1; ++x) {
+            int i1 = index(x, y);
+            int i2 = index(x + 1, y);
+            int i3 = index(x + 1, y + 1);
+            int i4 = index(x, y + 1);
+            triangles.insert(triangles.end(), { i1, i2, i3, i1, i3, i4 });
+        }
+    }
+
+    // Faces are appended in triangle order, so gathering them per vertex
+    // adds contributions in the same order the old scatter loop did.
+    const size_t n = vertexCount();
+    vertexFaceOffsets.assign(n + 1, 0);
+    for (int idx : triangles) ++vertexFaceOffsets[idx + 1];
+    for (size_t i = 0; i < n; ++i) vertexFaceOffsets[i + 1] += vertexFaceOffsets[i];
+    vertexFaces.assign(triangles.size(), 0);
+    std::vector<int> fill(vertexFaceOffsets.begin(), vertexFaceOffsets.end() - 1);
+    for (size_t t = 0; t < triangleCount(); ++t) {
+        for (int k = 0; k < 3; ++k) vertexFaces[fill[triangles[3 * t + k]]++] = static_cast<int>(t);
+    }
+}
+
+void ClothTopology::buildSpringAdjacency(const SpringStore& springs) {
+    const size_t n = vertexCount();
+    vertexSpringOffsets.assign(n + 1, 0);
+    for (size_t s = 0; s < springs.size(); ++s) {
+        ++vertexSpringOffsets[springs.p1[s] + 1];
+        ++vertexSpringOffsets[springs.p2[s] + 1];
+    }
+    for (size_t i = 0; i < n; ++i) vertexSpringOffsets[i + 1] += vertexSpringOffsets[i];
+    vertexSprings.assign(vertexSpringOffsets[n], 0);
+    std::vector<int> fill(vertexSpringOffsets.begin(), vertexSpringOffsets.end() - 1);
+    for (size_t s = 0; s < springs.size(); ++s) {
+        vertexSprings[fill[springs.p1[s]]++] = static_cast<int>(s);
+        vertexSprings[fill[springs.p2[s]]++] = ~static_cast<int>(s);
+    }
+}
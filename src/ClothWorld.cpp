@@ -0,0 +1,103 @@
+#include "ClothWorld.h"
+#include "ThreadPool.h"
+#include "CollisionMesh.h"
+#include <chrono>
+#include <limits>
+#include <algorithm>
+
+ClothWorld::ClothWorld() : pool(&ThreadPool::shared()) {}
+
+ClothWorld::ClothWorld(ThreadPool* pool) : pool(pool) {}
+
+Cloth& ClothWorld::addCloth(std::unique_ptr<Cloth> cloth) {
+    cloths.push_back(std::move(cloth));
+    deposits.resize(cloths.size());
+    pendingDeposits.resize(cloths.size());
+    stepTimes.resize(cloths.size(), 0.0);
+    return *cloths.back();
+}
+
+void ClothWorld::clear() {
+    cloths.clear();
+    deposits.clear();
+    pendingDeposits.clear();
+    stepTimes.clear();
+}
+
+size_t ClothWorld::getParticleCount() const {
+    size_t n = 0;
+    for (const auto& c : cloths) n += c->getParticleStore().size();
+    return n;
+}
+
+float ClothWorld::estimateStableTimeStep() const {
+    float dt = std::numeric_limits<float>::infinity();
+    for (const auto& c : cloths) dt = std::min(dt, c->estimateStableTimeStep());
+    return dt;
+}
+
+void ClothWorld::stepCloth(size_t i, float deltaTime, const ClothEnvironment& env) {
+    auto start = std::chrono::steady_clock::now();
+    Cloth& cloth = *cloths[i];
+
+    cloth.prepareForces();
+    if (water) applyWaterToCloth(*water, cloth, coupling);
+    cloth.applyGravity(env.gravity);
+    cloth.applyAirDrag(env.dragCoefficient, env.airVelocity);
+    if (env.windCarry != 0.0f) {
+        ParticleStore& ps = cloth.getParticleStore();
+        float kx = env.airVelocity.x * env.windCarry * deltaTime;
+        float kz = env.airVelocity.z * env.windCarry * deltaTime;
+        for (size_t p = 0; p < ps.size(); ++p) {
+            if (ps.invMass[p] == 0.0f) continue;
+            ps.vx[p] += kx;
+            ps.vz[p] += kz;
+        }
+    }
+    cloth.finalizeIntegration(deltaTime);
+    if (obstacle) cloth.handleMeshCollision(*obstacle, obstacleThickness);
+    if (water) collectClothDeposits(*water, cloth, coupling, deltaTime, deposits[i]);
+
+    stepTimes[i] = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+void ClothWorld::step(float deltaTime, const ClothEnvironment& env) {
+    auto start = std::chrono::steady_clock::now();
+
+    int threads = pool ? pool->size() : 1;
+    if (cloths.size() >= static_cast<size_t>(threads)) {
+        parallelFor(pool, 0, cloths.size(), 1, [&](size_t b, size_t e) {
+            for (size_t i = b; i < e; ++i) stepCloth(i, deltaTime, env);
+        });
+    } else {
+        for (size_t i = 0; i < cloths.size(); ++i) stepCloth(i, deltaTime, env);
+    }
+
+    if (water && deferDeposits) {
+        for (size_t i = 0; i < cloths.size(); ++i) {
+            pendingDeposits[i].insert(pendingDeposits[i].end(), deposits[i].begin(), deposits[i].end());
+        }
+    } else if (water) {
+        for (const auto& d : deposits) applyClothDeposits(*water, d);
+    }
+
+    lastStepTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+void ClothWorld::setDeferDeposits(bool defer) {
+    if (!defer) applyPendingDeposits();
+    deferDeposits = defer;
+}
+
+void ClothWorld::applyPendingDeposits() {
+    for (auto& d : pendingDeposits) {
+        if (water && !d.empty()) applyClothDeposits(*water, d);
+        d.clear();
+    }
+}
+
+size_t ClothWorld::getPendingDepositCount() const {
+    size_t n = 0;
+    for (const auto& d : pendingDeposits) n += d.size();
+    return n;
+}
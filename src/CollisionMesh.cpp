@@ -0,0 +1,315 @@
+#include "CollisionMesh.h"
+#include "Geometry.h"
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+static const int kBins = 16;
+static const int kLeafSize = 4;
+static const int kMaxDepth = 60;
+
+bool TriangleMesh::loadObj(const std::string& path) {
+    std::ifstream in(path);
+    if (!in) return false;
+    vertices.clear();
+    indices.clear();
+
+    std::string line;
+    std::vector<int> face;
+    while (std::getline(in, line)) {
+        std::istringstream ls(line);
+        std::string tag;
+        ls >> tag;
+        if (tag == "v") {
+            float x = 0, y = 0, z = 0;
+            ls >> x >> y >> z;
+            vertices.emplace_back(x, y, z);
+        } else if (tag == "f") {
+            face.clear();
+            std::string token;
+            while (ls >> token) {
+                // "v", "v/vt", "v//vn" or "v/vt/vn"; negative indices are relative.
+                int idx = std::atoi(token.c_str());
+                if (idx < 0) idx = static_cast<int>(vertices.size()) + idx;
+                else idx -= 1;
+                if (idx >= 0 && idx < static_cast<int>(vertices.size())) face.push_back(idx);
+            }
+            for (size_t k = 2; k < face.size(); ++k) {
+                indices.insert(indices.end(), { face[0], face[k - 1], face[k] });
+            }
+        }
+    }
+    return !indices.empty();
+}
+
+struct Bounds {
+    float bmin[3];
+    float bmax[3];
+
+    Bounds() {
+        for (int a = 0; a < 3; ++a) {
+            bmin[a] = std::numeric_limits<float>::max();
+            bmax[a] = -std::numeric_limits<float>::max();
+        }
+    }
+    void grow(const float* lo, const float* hi) {
+        for (int a = 0; a < 3; ++a) {
+            bmin[a] = std::min(bmin[a], lo[a]);
+            bmax[a] = std::max(bmax[a], hi[a]);
+        }
+    }
+    void grow(const Vec3& p) {
+        float v[3] = { p.x, p.y, p.z };
+        grow(v, v);
+    }
+    float area() const {
+        float d[3] = { bmax[0] - bmin[0], bmax[1] - bmin[1], bmax[2] - bmin[2] };
+        if (d[0] < 0.0f) return 0.0f;
+        return 2.0f * (d[0] * d[1] + d[1] * d[2] + d[2] * d[0]);
+    }
+};
+
+static inline float boxDistance2(const float* bmin, const float* bmax, const Vec3& p) {
+    float q[3] = { p.x, p.y, p.z };
+    float d2 = 0.0f;
+    for (int a = 0; a < 3; ++a) {
+        float d = std::max(std::max(bmin[a] - q[a], 0.0f), q[a] - bmax[a]);
+        d2 += d * d;
+    }
+    return d2;
+}
+
+CollisionMesh::CollisionMesh(const TriangleMesh& m) : mesh(m) {
+    build();
+    buildPseudonormals();
+}
+
+// Binned SAH build (Wald 2007) with an explicit stack, so deep trees over
+// millions of triangles do not recurse.
+void CollisionMesh::build() {
+    const int n = static_cast<int>(mesh.triangleCount());
+    nodes.clear();
+    triOrder.resize(n);
+    if (n == 0) return;
+
+    std::vector<Bounds> triBounds(n);
+    std::vector<Vec3> centroids(n);
+    for (int t = 0; t < n; ++t) {
+        triOrder[t] = t;
+        for (int k = 0; k < 3; ++k) triBounds[t].grow(mesh.vertices[mesh.indices[3 * t + k]]);
+        centroids[t] = (mesh.vertices[mesh.indices[3 * t]] + mesh.vertices[mesh.indices[3 * t + 1]] +
+                        mesh.vertices[mesh.indices[3 * t + 2]]) * (1.0f / 3.0f);
+    }
+
+    struct Task { int node, start, count, depth; };
+    std::vector<Task> stack;
+    nodes.reserve(2 * n / kLeafSize + 1);
+    nodes.push_back(Node());
+    stack.push_back({ 0, 0, n, 0 });
+
+    while (!stack.empty()) {
+        Task task = stack.back();
+        stack.pop_back();
+
+        Bounds box, cbox;
+        for (int i = task.start; i < task.start + task.count; ++i) {
+            int t = triOrder[i];
+            box.grow(triBounds[t].bmin, triBounds[t].bmax);
+            cbox.grow(centroids[t]);
+        }
+        Node& node = nodes[task.node];
+        std::copy(box.bmin, box.bmin + 3, node.bmin);
+        std::copy(box.bmax, box.bmax + 3, node.bmax);
+        node.start = task.start;
+        node.count = task.count;
+        if (task.count <= kLeafSize || task.depth >= kMaxDepth) continue;
+
+        int bestAxis = -1, bestSplit = 0;
+        float bestCost = task.count * box.area();
+        for (int axis = 0; axis < 3; ++axis) {
+            float lo = cbox.bmin[axis], extent = cbox.bmax[axis] - lo;
+            if (extent <= 0.0f) continue;
+            Bounds bins[kBins];
+            int counts[kBins] = { 0 };
+            float scale = kBins / extent;
+            for (int i = task.start; i < task.start + task.count; ++i) {
+                int t = triOrder[i];
+                float c = axis == 0 ? centroids[t].x : (axis == 1 ? centroids[t].y : centroids[t].z);
+                int b = std::min(kBins - 1, static_cast<int>((c - lo) * scale));
+                bins[b].grow(triBounds[t].bmin, triBounds[t].bmax);
+                ++counts[b];
+            }
+            float rightArea[kBins];
+            int rightCount[kBins];
+            Bounds acc;
+            int cnt = 0;
+            for (int b = kBins - 1; b > 0; --b) {
+                acc.grow(bins[b].bmin, bins[b].bmax);
+                cnt += counts[b];
+                rightArea[b] = acc.area();
+                rightCount[b] = cnt;
+            }
+            acc = Bounds();
+            cnt = 0;
+            for (int b = 0; b < kBins - 1; ++b) {
+                acc.grow(bins[b].bmin, bins[b].bmax);
+                cnt += counts[b];
+                if (cnt == 0 || rightCount[b + 1] == 0) continue;
+                float cost = cnt * acc.area() + rightCount[b + 1] * rightArea[b + 1];
+                if (cost < bestCost) {
+                    bestCost = cost;
+                    bestAxis = axis;
+                    bestSplit = b + 1;
+                }
+            }
+        }
+
+        int mid;
+        if (bestAxis >= 0) {
+            float lo = cbox.bmin[bestAxis];
+            float scale = kBins / (cbox.bmax[bestAxis] - lo);
+            auto first = triOrder.begin() + task.start;
+            auto it = std::partition(first, first + task.count, [&](int t) {
+                float c = bestAxis == 0 ? centroids[t].x : (bestAxis == 1 ? centroids[t].y : centroids[t].z);
+                return std::min(kBins - 1, static_cast<int>((c - lo) * scale)) < bestSplit;
+            });
+            mid = static_cast<int>(it - triOrder.begin());
+        } else if (task.count > 4 * kLeafSize) {
+            // No split beats a leaf (e.g. coincident centroids) but the leaf
+            // would be too large to scan; halve by index instead.
+            mid = task.start + task.count / 2;
+        } else {
+            continue;
+        }
+
+        int left = static_cast<int>(nodes.size());
+        nodes[task.node].start = left;
+        nodes[task.node].count = 0;
+        nodes.push_back(Node());
+        nodes.push_back(Node());
+        stack.push_back({ left, task.start, mid - task.start, task.depth + 1 });
+        stack.push_back({ left + 1, mid, task.start + task.count - mid, task.depth + 1 });
+    }
+}
+
+void CollisionMesh::buildPseudonormals() {
+    const size_t n = mesh.triangleCount();
+    faceNormals.assign(n, Vec3(0.0f));
+    vertexNormals.assign(mesh.vertices.size(), Vec3(0.0f));
+    edgeNormals.assign(3 * n, Vec3(0.0f));
+
+    std::vector<std::pair<uint64_t, int>> edges;
+    edges.reserve(3 * n);
+    for (size_t t = 0; t < n; ++t) {
+        const int* v = &mesh.indices[3 * t];
+        Vec3 p[3] = { mesh.vertices[v[0]], mesh.vertices[v[1]], mesh.vertices[v[2]] };
+        Vec3 fn = normalize((p[1] - p[0]).cross(p[2] - p[0]));
+        faceNormals[t] = fn;
+        for (int k = 0; k < 3; ++k) {
+            Vec3 e1 = normalize(p[(k + 1) % 3] - p[k]);
+            Vec3 e2 = normalize(p[(k + 2) % 3] - p[k]);
+            float angle = std::acos(std::max(-1.0f, std::min(1.0f, dot(e1, e2))));
+            vertexNormals[v[k]] += fn * angle;
+
+            uint32_t a = v[k], b = v[(k + 1) % 3];
+            uint64_t key = (uint64_t(std::min(a, b)) << 32) | std::max(a, b);
+            edges.emplace_back(key, static_cast<int>(3 * t + k));
+        }
+    }
+    for (auto& vn : vertexNormals) vn = normalize(vn);
+
+    std::sort(edges.begin(), edges.end());
+    for (size_t i = 0; i < edges.size();) {
+        size_t j = i;
+        Vec3 sum(0.0f);
+        while (j < edges.size() && edges[j].first == edges[i].first) sum += faceNormals[edges[j++].second / 3];
+        sum = normalize(sum);
+        for (size_t k = i; k < j; ++k) edgeNormals[edges[k].second] = sum;
+        i = j;
+    }
+}
+
+bool CollisionMesh::insideBounds(const Vec3& p) const {
+    return !nodes.empty() && boxDistance2(nodes[0].bmin, nodes[0].bmax, p) == 0.0f;
+}
+
+float CollisionMesh::boundsDistance(const Vec3& p) const {
+    if (nodes.empty()) return std::numeric_limits<float>::max();
+    return std::sqrt(boxDistance2(nodes[0].bmin, nodes[0].bmax, p));
+}
+
+bool CollisionMesh::query(const Vec3& p, float maxDistance2, MeshHit& hit) const {
+    if (nodes.empty()) return false;
+    float best = maxDistance2;
+    int bestTri = -1;
+    Vec3 bestBary;
+
+    int stack[2 * kMaxDepth + 4];
+    int top = 0;
+    stack[top++] = 0;
+    while (top > 0) {
+        const Node& node = nodes[stack[--top]];
+        if (boxDistance2(node.bmin, node.bmax, p) >= best) continue;
+        if (node.count > 0) {
+            for (int i = node.start; i < node.start + node.count; ++i) {
+                int t = triOrder[i];
+                const int* v = &mesh.indices[3 * t];
+                const Vec3& a = mesh.vertices[v[0]];
+                const Vec3& b = mesh.vertices[v[1]];
+                const Vec3& c = mesh.vertices[v[2]];
+                Vec3 w = closestBarycentric(p, a, b, c);
+                Vec3 d = p - (a * w.x + b * w.y + c * w.z);
+                float d2 = dot(d, d);
+                if (d2 < best) {
+                    best = d2;
+                    bestTri = t;
+                    bestBary = w;
+                }
+            }
+            continue;
+        }
+        // Visit the nearer child first so `best` shrinks quickly.
+        int l = node.start, r = node.start + 1;
+        float dl = boxDistance2(nodes[l].bmin, nodes[l].bmax, p);
+        float dr = boxDistance2(nodes[r].bmin, nodes[r].bmax, p);
+        if (dl < dr) { std::swap(l, r); std::swap(dl, dr); }
+        if (dl < best) stack[top++] = l;
+        if (dr < best) stack[top++] = r;
+    }
+    if (bestTri < 0) return false;
+
+    const int* v = &mesh.indices[3 * bestTri];
+    hit.triangle = bestTri;
+    hit.point = mesh.vertices[v[0]] * bestBary.x + mesh.vertices[v[1]] * bestBary.y + mesh.vertices[v[2]] * bestBary.z;
+
+    // Pick the pseudonormal of the feature the closest point lies on.
+    int zeros = (bestBary.x == 0.0f) + (bestBary.y == 0.0f) + (bestBary.z == 0.0f);
+    if (zeros == 2) {
+        int k = bestBary.x != 0.0f ? 0 : (bestBary.y != 0.0f ? 1 : 2);
+        hit.normal = vertexNormals[v[k]];
+    } else if (zeros == 1) {
+        int e = bestBary.z == 0.0f ? 0 : (bestBary.x == 0.0f ? 1 : 2);
+        hit.normal = edgeNormals[3 * bestTri + e];
+    } else {
+        hit.normal = faceNormals[bestTri];
+    }
+    float dist = std::sqrt(best);
+    hit.distance = dot(p - hit.point, hit.normal) < 0.0f ? -dist : dist;
+    return true;
+}
+
+bool CollisionMesh::closestPoint(const Vec3& p, float maxDistance, MeshHit& hit) const {
+    return query(p, maxDistance * maxDistance, hit);
+}
+
+MeshHit CollisionMesh::signedDistance(const Vec3& p) const {
+    MeshHit hit;
+    hit.point = p;
+    hit.normal = Vec3(0.0f, 1.0f, 0.0f);
+    hit.distance = std::numeric_limits<float>::max();
+    hit.triangle = -1;
+    query(p, std::numeric_limits<float>::max(), hit);
+    return hit;
+}
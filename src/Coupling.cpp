@@ -1,68 +1,167 @@
 #include "Coupling.h"
+#include "AdaptiveWaterGrid.h"
+#include "ThreadPool.h"
 #include <algorithm>
 
 static float clampf(float x, float a, float b) { return std::max(a, std::min(b, x)); }
 
+// Particles per coupling chunk; each chunk samples the water under its own
+// particles in one batch.
+static const size_t kCouplingGrain = 4096;
+
+// Chunks only touch their own particles' forces. Wake requests are noted
+// per particle and raised afterwards, since neighbouring particles share a
+// sleep tile.
 void applyWaterToCloth(const WaterGrid& water, Cloth& cloth, const CouplingParams& p) {
-    auto& particles = const_cast<std::vector<Particle>&>(cloth.getParticles());
-    for (auto& particle : particles) {
-        if (particle.fixed) continue;
-        float waterH = water.sampleHeight(particle.position.x, particle.position.z);
-        float depth = std::max(0.0f, waterH - particle.position.y);
-        if (depth > 0.0f) {
-            Vec3 pressureForce(0.0f, p.pressureCoeff * depth, 0.0f);
-            Vec3 waterVel = water.sampleVelocity(particle.position.x, particle.position.z);
-            Vec3 relVel = Vec3(particle.velocity.x - waterVel.x, 0.0f, particle.velocity.z - waterVel.z);
-            float scale = std::min(1.0f, depth / 0.25f);
-            Vec3 dragForce = -relVel * (p.dragCoeff * scale);
-            particle.force += pressureForce + dragForce;
+    ParticleStore& ps = cloth.getParticleStore();
+    const size_t n = ps.size();
+    thread_local std::vector<unsigned char> wakeRequests;
+    wakeRequests.assign(n, 0);
+    unsigned char* wakes = wakeRequests.data();
+    const float wakeSpeed = cloth.getWakeSpeed();
+    parallelFor(cloth.getThreadPool(), 0, n, kCouplingGrain, [&](size_t b, size_t e) {
+        const size_t m = e - b;
+        thread_local std::vector<float> samples;
+        samples.resize(3 * m);
+        float* waterH = samples.data();
+        float* waterU = waterH + m;
+        float* waterV = waterU + m;
+        water.sampleHeights(ps.px.data() + b, ps.pz.data() + b, waterH, m);
+        water.sampleVelocities(ps.px.data() + b, ps.pz.data() + b, waterU, waterV, m);
+
+        for (size_t i = b; i < e; ++i) {
+            // Sleeping particles read as fixed. They wake when water first
+            // reaches them, when their buoyancy has changed enough since
+            // they fell asleep to move them within a step, or when the water
+            // moves past them fast enough.
+            bool asleep = cloth.isAsleep(i);
+            if (ps.invMass[i] == 0.0f && !asleep) continue;
+            float depth = std::max(0.0f, waterH[i - b] - ps.py[i]);
+            Vec3 relVel = Vec3(ps.vx[i] - waterU[i - b], 0.0f, ps.vz[i] - waterV[i - b]);
+            if (asleep) {
+                float restingDepth = cloth.getRestingDepth(i);
+                float buoyancyChange = p.pressureCoeff * (depth - restingDepth);
+                bool flooded = restingDepth == 0.0f && cloth.getSleepingResponse(i, p.pressureCoeff * depth) > 0.0f;
+                if (flooded || cloth.getSleepingResponse(i, buoyancyChange) > wakeSpeed ||
+                    (depth > 0.0f && length(relVel) > wakeSpeed)) {
+                    wakes[i] = 1;
+                }
+                continue;
+            }
+            cloth.setRestingDepth(i, depth);
+            if (depth > 0.0f) {
+                float scale = std::min(1.0f, depth / 0.25f);
+                Vec3 dragForce = -relVel * (p.dragCoeff * scale);
+                ps.fx[i] += dragForce.x;
+                ps.fy[i] += p.pressureCoeff * depth + dragForce.y;
+                ps.fz[i] += dragForce.z;
+            }
         }
+    });
+    for (size_t i = 0; i < n; ++i) {
+        if (wakes[i]) cloth.wakeParticle(i);
     }
 }
 
 void applyClothToWater(WaterGrid& water, const Cloth& cloth, const CouplingParams& p, float dt) {
-    const auto& particles = cloth.getParticles();
-    const auto& H = water.getH();
-    const int nx = water.getNx();
-    const int nz = water.getNz();
+    std::vector<ClothDeposit> deposits;
+    collectClothDeposits(water, cloth, p, dt, deposits);
+    applyClothDeposits(water, deposits);
+}
+
+// The surface slope is the central difference of the bilinear surface
+// one cell either side of the particle. Chunks fill the particles' slots
+// of a scratch array, which is compacted in particle order afterwards.
+void collectClothDeposits(const WaterGrid& water, const Cloth& cloth, const CouplingParams& p, float dt,
+                          std::vector<ClothDeposit>& out) {
+    out.clear();
+    const ParticleStore& ps = cloth.getParticleStore();
+    const size_t n = ps.size();
     const float dx = water.getDx();
-    const Vec3 org = water.getOrigin();
 
-    for (const auto& particle : particles) {
-        float x = particle.position.x;
-        float z = particle.position.z;
-        float waterH = water.sampleHeight(x, z);
-        float depth = std::max(0.0f, waterH - particle.position.y);
+    thread_local std::vector<ClothDeposit> slots;
+    thread_local std::vector<unsigned char> used;
+    slots.resize(n);
+    used.resize(n);
+    ClothDeposit* slot = slots.data();
+    unsigned char* keep = used.data();
+    parallelFor(cloth.getThreadPool(), 0, n, kCouplingGrain, [&](size_t b, size_t e) {
+        const size_t m = e - b;
+        const float* px = ps.px.data() + b;
+        const float* pz = ps.pz.data() + b;
+        thread_local std::vector<float> samples;
+        samples.resize(6 * m);
+        float* waterH = samples.data();
+        float* shifted = waterH + m;
+        float* hL = shifted + m;
+        float* hR = hL + m;
+        float* hD = hR + m;
+        float* hU = hD + m;
+        water.sampleHeights(px, pz, waterH, m);
+        for (size_t j = 0; j < m; ++j) shifted[j] = px[j] - dx;
+        water.sampleHeights(shifted, pz, hL, m);
+        for (size_t j = 0; j < m; ++j) shifted[j] = px[j] + dx;
+        water.sampleHeights(shifted, pz, hR, m);
+        for (size_t j = 0; j < m; ++j) shifted[j] = pz[j] - dx;
+        water.sampleHeights(px, shifted, hD, m);
+        for (size_t j = 0; j < m; ++j) shifted[j] = pz[j] + dx;
+        water.sampleHeights(px, shifted, hU, m);
 
-        float fx = (x - org.x) / dx;
-        float fz = (z - org.z) / dx;
-        int i = std::max(1, std::min(nx - 2, (int)fx));
-        int k = std::max(1, std::min(nz - 2, (int)fz));
-        auto idx = [&](int ii, int kk){ return kk * nx + ii; };
-        float hL = H[idx(i - 1, k)], hR = H[idx(i + 1, k)];
-        float hD = H[idx(i, k - 1)], hU = H[idx(i, k + 1)];
-        float dhdx = (hR - hL) / (2.0f * dx);
-        float dhdz = (hU - hD) / (2.0f * dx);
+        for (size_t i = b; i < e; ++i) {
+            const size_t j = i - b;
+            float x = ps.px[i];
+            float z = ps.pz[i];
+            float depth = std::max(0.0f, waterH[j] - ps.py[i]);
+            float dhdx = (hR[j] - hL[j]) / (2.0f * dx);
+            float dhdz = (hU[j] - hD[j]) / (2.0f * dx);
 
-        float vx = particle.velocity.x;
-        float vz = particle.velocity.z;
-        float vy = particle.velocity.y;
-        float speedH = std::sqrt(vx * vx + vz * vz);
+            float vx = ps.vx[i];
+            float vz = ps.vz[i];
+            float vy = ps.vy[i];
+            float speedH = std::sqrt(vx * vx + vz * vz);
 
-        bool nearSurface = (waterH - particle.position.y) > -0.05f && (waterH - particle.position.y) < 0.20f;
-        if (depth > 0.0f || nearSurface || speedH > 0.05f) {
-            float du = -vx * p.depositionCoeff * dt * 0.6f;
-            float dv = -vz * p.depositionCoeff * dt * 0.6f;
+            bool nearSurface = (waterH[j] - ps.py[i]) > -0.05f && (waterH[j] - ps.py[i]) < 0.20f;
+            keep[i] = depth > 0.0f || nearSurface || speedH > 0.05f;
+            if (keep[i]) {
+                float du = -vx * p.depositionCoeff * dt * 0.6f;
+                float dv = -vz * p.depositionCoeff * dt * 0.6f;
 
-            float tangentialPush = -(vx * dhdx + vz * dhdz);
-            float contactLift = -vy * 0.25f;
-            float wake = speedH * 0.08f;
-            float dh = (tangentialPush + contactLift + wake) * p.depositionCoeff * dt;
-            dh = std::max(-0.02f, std::min(0.02f, dh));
+                float tangentialPush = -(vx * dhdx + vz * dhdz);
+                float contactLift = -vy * 0.25f;
+                float wake = speedH * 0.08f;
+                float dh = (tangentialPush + contactLift + wake) * p.depositionCoeff * dt;
+                dh = std::max(-0.02f, std::min(0.02f, dh));
 
-            float r = 0.28f;
-            water.addRadialImpulse(x, z, r, dh, 0.35f);
-            water.addImpulse(x, z, du, dv, 0.0f);
+                slot[i] = { x, z, dh, du, dv };
+            }
         }
+    });
+    for (size_t i = 0; i < n; ++i) {
+        if (keep[i]) out.push_back(slot[i]);
     }
 }
+
+// The radial part is binned and splatted by the grid; the point impulses
+// touch one cell each and go in directly.
+template <class Grid>
+static void applyDeposits(Grid& water, const std::vector<ClothDeposit>& deposits) {
+    const float r = 0.28f;
+    const size_t n = deposits.size();
+    thread_local std::vector<float> runs;
+    runs.resize(3 * n);
+    for (size_t i = 0; i < n; ++i) {
+        runs[i] = deposits[i].x;
+        runs[n + i] = deposits[i].z;
+        runs[2 * n + i] = deposits[i].dh;
+    }
+    water.addRadialImpulses(runs.data(), runs.data() + n, runs.data() + 2 * n, n, r, 0.35f);
+    for (const ClothDeposit& d : deposits) water.addImpulse(d.x, d.z, d.du, d.dv, 0.0f);
+}
+
+void applyClothDeposits(WaterGrid& water, const std::vector<ClothDeposit>& deposits) {
+    applyDeposits(water, deposits);
+}
+
+void applyClothDeposits(AdaptiveWaterGrid& water, const std::vector<ClothDeposit>& deposits) {
+    applyDeposits(water, deposits);
+}
@@ -0,0 +1,202 @@
+#include "ImplicitSolver.h"
+#include "ThreadPool.h"
+#include <cmath>
+#include <algorithm>
+
+static const size_t kGrain = 2048;
+
+static inline void mat3Identity(float* m, float s) {
+    m[0] = s; m[1] = 0; m[2] = 0;
+    m[3] = 0; m[4] = s; m[5] = 0;
+    m[6] = 0; m[7] = 0; m[8] = s;
+}
+
+static inline void mat3MulAdd(const float* m, const float* x, float* y, float s) {
+    y[0] += s * (m[0] * x[0] + m[1] * x[1] + m[2] * x[2]);
+    y[1] += s * (m[3] * x[0] + m[4] * x[1] + m[5] * x[2]);
+    y[2] += s * (m[6] * x[0] + m[7] * x[1] + m[8] * x[2]);
+}
+
+static inline void mat3Inverse(const float* m, float* out) {
+    float c00 = m[4] * m[8] - m[5] * m[7];
+    float c01 = m[5] * m[6] - m[3] * m[8];
+    float c02 = m[3] * m[7] - m[4] * m[6];
+    float det = m[0] * c00 + m[1] * c01 + m[2] * c02;
+    float invDet = (std::fabs(det) > 1e-20f) ? 1.0f / det : 0.0f;
+    out[0] = c00 * invDet;
+    out[1] = (m[2] * m[7] - m[1] * m[8]) * invDet;
+    out[2] = (m[1] * m[5] - m[2] * m[4]) * invDet;
+    out[3] = c01 * invDet;
+    out[4] = (m[0] * m[8] - m[2] * m[6]) * invDet;
+    out[5] = (m[2] * m[3] - m[0] * m[5]) * invDet;
+    out[6] = c02 * invDet;
+    out[7] = (m[1] * m[6] - m[0] * m[7]) * invDet;
+    out[8] = (m[0] * m[4] - m[1] * m[3]) * invDet;
+}
+
+void ImplicitSolver::resize(size_t particleCount, size_t springCount) {
+    n = particleCount;
+    fixed.assign(n, 0);
+    diag.assign(9 * n, 0.0f);
+    diagInv.assign(9 * n, 0.0f);
+    offDiag.assign(9 * springCount, 0.0f);
+    springKs.assign(9 * springCount, 0.0f);
+    for (auto* v : { &rhs, &dv, &r, &z, &p, &Ap }) v->assign(3 * n, 0.0f);
+}
+
+void ImplicitSolver::assemble(const ParticleStore& ps, const SpringStore& springs, float h, ThreadPool* pool) {
+    parallelFor(pool, 0, springs.size(), kGrain, [&](size_t b, size_t e) {
+        for (size_t s = b; s < e; ++s) {
+            int a = springs.p1[s], c = springs.p2[s];
+            float d[3] = { ps.px[c] - ps.px[a], ps.py[c] - ps.py[a], ps.pz[c] - ps.pz[a] };
+            float l = std::sqrt(d[0] * d[0] + d[1] * d[1] + d[2] * d[2]);
+            float* ks = &springKs[9 * s];
+            float* blk = &offDiag[9 * s];
+            if (l < 1e-8f) {
+                std::fill(ks, ks + 9, 0.0f);
+                std::fill(blk, blk + 9, 0.0f);
+                continue;
+            }
+            for (float& x : d) x /= l;
+            // Drop the transverse term for compressed springs so K stays
+            // negative semi-definite and the system stays SPD.
+            float ratio = std::max(0.0f, 1.0f - springs.rest[s] / l);
+            float k = springs.stiffness[s];
+            float kd = springs.damping[s];
+            for (int r0 = 0; r0 < 3; ++r0) {
+                for (int c0 = 0; c0 < 3; ++c0) {
+                    float ddt = d[r0] * d[c0];
+                    float kij = k * (ratio * (r0 == c0 ? 1.0f : 0.0f) + (1.0f - ratio) * ddt);
+                    ks[3 * r0 + c0] = kij;
+                    blk[3 * r0 + c0] = h * kd * ddt + h * h * kij;
+                }
+            }
+        }
+    });
+
+    parallelFor(pool, 0, n, kGrain, [&](size_t b, size_t e) {
+        for (size_t i = b; i < e; ++i) {
+            float* A = &diag[9 * i];
+            float* bi = &rhs[3 * i];
+            fixed[i] = ps.invMass[i] == 0.0f;
+            if (fixed[i]) {
+                mat3Identity(A, 1.0f);
+                mat3Identity(&diagInv[9 * i], 1.0f);
+                bi[0] = bi[1] = bi[2] = 0.0f;
+                continue;
+            }
+            mat3Identity(A, ps.mass[i]);
+            float kv[3] = { 0.0f, 0.0f, 0.0f };
+            for (int j = topo->vertexSpringOffsets[i]; j < topo->vertexSpringOffsets[i + 1]; ++j) {
+                int code = topo->vertexSprings[j];
+                size_t s = code >= 0 ? code : ~code;
+                int other = code >= 0 ? springs.p2[s] : springs.p1[s];
+                const float* blk = &offDiag[9 * s];
+                for (int m = 0; m < 9; ++m) A[m] += blk[m];
+                float rel[3] = { ps.vx[other] - ps.vx[i], ps.vy[other] - ps.vy[i], ps.vz[other] - ps.vz[i] };
+                mat3MulAdd(&springKs[9 * s], rel, kv, 1.0f);
+            }
+            mat3Inverse(A, &diagInv[9 * i]);
+            bi[0] = h * (ps.fx[i] + h * kv[0]);
+            bi[1] = h * (ps.fy[i] + h * kv[1]);
+            bi[2] = h * (ps.fz[i] + h * kv[2]);
+        }
+    });
+}
+
+// y = A x. Rows and columns of fixed particles reduce to the identity.
+void ImplicitSolver::multiply(const std::vector<float>& x, std::vector<float>& y, const SpringStore& springs, ThreadPool* pool) {
+    parallelFor(pool, 0, n, kGrain, [&](size_t b, size_t e) {
+        for (size_t i = b; i < e; ++i) {
+            float* yi = &y[3 * i];
+            yi[0] = yi[1] = yi[2] = 0.0f;
+            mat3MulAdd(&diag[9 * i], &x[3 * i], yi, 1.0f);
+            if (fixed[i]) continue;
+            for (int j = topo->vertexSpringOffsets[i]; j < topo->vertexSpringOffsets[i + 1]; ++j) {
+                int code = topo->vertexSprings[j];
+                size_t s = code >= 0 ? code : ~code;
+                int other = code >= 0 ? springs.p2[s] : springs.p1[s];
+                if (fixed[other]) continue;
+                mat3MulAdd(&offDiag[9 * s], &x[3 * other], yi, -1.0f);
+            }
+        }
+    });
+}
+
+// Per-chunk partial sums added in chunk order, so the result is independent
+// of how chunks were distributed over threads.
+double ImplicitSolver::dotProduct(const std::vector<float>& a, const std::vector<float>& b, ThreadPool* pool) {
+    size_t chunks = (n + kGrain - 1) / kGrain;
+    partials.assign(chunks, 0.0);
+    parallelFor(pool, 0, n, kGrain, [&](size_t cb, size_t ce) {
+        double sum = 0.0;
+        for (size_t i = 3 * cb; i < 3 * ce; ++i) sum += static_cast<double>(a[i]) * b[i];
+        partials[cb / kGrain] = sum;
+    });
+    double total = 0.0;
+    for (double s : partials) total += s;
+    return total;
+}
+
+int ImplicitSolver::step(ParticleStore& ps, const SpringStore& springs, const ClothTopology& topology,
+                         float deltaTime, float velocityDamping, ThreadPool* pool) {
+    if (ps.size() != n || offDiag.size() != 9 * springs.size()) resize(ps.size(), springs.size());
+    topo = &topology;
+    assemble(ps, springs, deltaTime, pool);
+
+    auto precondition = [&](size_t b, size_t e) {
+        for (size_t i = b; i < e; ++i) {
+            float* zi = &z[3 * i];
+            zi[0] = zi[1] = zi[2] = 0.0f;
+            mat3MulAdd(&diagInv[9 * i], &r[3 * i], zi, 1.0f);
+        }
+    };
+
+    std::fill(dv.begin(), dv.end(), 0.0f);
+    r = rhs;
+    parallelFor(pool, 0, n, kGrain, precondition);
+    p = z;
+    double rz = dotProduct(r, z, pool);
+    double r0 = std::sqrt(dotProduct(r, r, pool));
+    double target = tolerance * std::max(r0, 1e-12);
+
+    int it = 0;
+    double rnorm = r0;
+    while (it < maxIterations && rnorm > target) {
+        multiply(p, Ap, springs, pool);
+        double pAp = dotProduct(p, Ap, pool);
+        if (pAp <= 0.0) break;
+        float alpha = static_cast<float>(rz / pAp);
+        parallelFor(pool, 0, n, kGrain, [&](size_t b, size_t e) {
+            for (size_t i = 3 * b; i < 3 * e; ++i) {
+                dv[i] += alpha * p[i];
+                r[i] -= alpha * Ap[i];
+            }
+        });
+        ++it;
+        rnorm = std::sqrt(dotProduct(r, r, pool));
+        if (rnorm <= target) break;
+        parallelFor(pool, 0, n, kGrain, precondition);
+        double rzNew = dotProduct(r, z, pool);
+        float beta = static_cast<float>(rzNew / rz);
+        rz = rzNew;
+        parallelFor(pool, 0, n, kGrain, [&](size_t b, size_t e) {
+            for (size_t i = 3 * b; i < 3 * e; ++i) p[i] = z[i] + beta * p[i];
+        });
+    }
+    lastIterations = it;
+    lastResidual = static_cast<float>(r0 > 0.0 ? rnorm / r0 : 0.0);
+
+    parallelFor(pool, 0, n, kGrain, [&](size_t b, size_t e) {
+        for (size_t i = b; i < e; ++i) {
+            if (ps.invMass[i] == 0.0f) continue;
+            ps.vx[i] = (ps.vx[i] + dv[3 * i + 0]) * velocityDamping;
+            ps.vy[i] = (ps.vy[i] + dv[3 * i + 1]) * velocityDamping;
+            ps.vz[i] = (ps.vz[i] + dv[3 * i + 2]) * velocityDamping;
+            ps.px[i] += ps.vx[i] * deltaTime;
+            ps.py[i] += ps.vy[i] * deltaTime;
+            ps.pz[i] += ps.vz[i] * deltaTime;
+        }
+    });
+    return it;
+}
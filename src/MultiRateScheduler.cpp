@@ -0,0 +1,31 @@
+#include "MultiRateScheduler.h"
+#include "ClothWorld.h"
+#include "TimeStepController.h"
+#include "Water.h"
+
+// Cloth step c starts at c * nw / nc water steps into the frame, so it
+// belongs to water step floor(c * nw / nc) and sits the fractional part of
+// the way through it. Integer arithmetic keeps the assignment exact.
+void MultiRateScheduler::advance(ClothWorld& world, const StepPlan& plan, const ClothEnvironment& env) {
+    WaterGrid* water = world.getWater();
+    const long long nc = plan.clothSubsteps, nw = water ? plan.waterSubsteps : 0;
+    lastClothSteps = static_cast<int>(nc);
+    lastWaterSteps = static_cast<int>(nw);
+    if (!water) {
+        for (long long c = 0; c < nc; ++c) world.step(plan.clothStep, env);
+        return;
+    }
+
+    world.setDeferDeposits(true);
+    water->setKeepPreviousState(interpolateWater);
+    long long c = 0;
+    for (long long w = 0; w < nw; ++w) {
+        world.applyPendingDeposits();
+        water->step(plan.waterStep, 1);
+        for (; c < nc && c * nw < (w + 1) * nc; ++c) {
+            water->setSampleBlend(interpolateWater ? static_cast<float>(c * nw - w * nc) / nc : 1.0f);
+            world.step(plan.clothStep, env);
+        }
+    }
+    water->setSampleBlend(1.0f);
+}
@@ -0,0 +1,245 @@
+#include "PagedWaterDomain.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+// Neighbour directions; 7 - d is the opposite of d.
+static const int kDirX[8] = { -1, 0, 1, -1, 1, -1, 0, 1 };
+static const int kDirZ[8] = { -1, -1, -1, 0, 0, 1, 1, 1 };
+
+// Cell blocks of a page grid facing direction d: the halo beyond that side
+// or corner, and the page's own cells just inside it, which are what the
+// neighbour there copies into its halo.
+struct PageBlock {
+    int i, k, w, d;
+};
+
+static PageBlock haloBlock(int d, int P, int H) {
+    return PageBlock{ kDirX[d] < 0 ? 0 : (kDirX[d] == 0 ? H : H + P), kDirZ[d] < 0 ? 0 : (kDirZ[d] == 0 ? H : H + P),
+                      kDirX[d] == 0 ? P : H, kDirZ[d] == 0 ? P : H };
+}
+
+static PageBlock edgeBlock(int d, int P, int H) {
+    return PageBlock{ kDirX[d] > 0 ? P : H, kDirZ[d] > 0 ? P : H, kDirX[d] == 0 ? P : H, kDirZ[d] == 0 ? P : H };
+}
+
+PagedWaterDomain::PagedWaterDomain(int pageCells, int haloCells, float dx, const Vec3& origin, float baseLevel)
+    : pageCells(std::max(kMinHaloCells, pageCells)),
+      haloCells(std::clamp(haloCells, kMinHaloCells, std::max(kMinHaloCells, pageCells))), dx(dx),
+      origin(origin), baseLevel(baseLevel), restDepth(0.6f), quietThreshold(1e-4f), maxFreePages(16),
+      pool(&ThreadPool::shared()), windowed(false), windowX(0), windowZ(0), windowRadius(0) {}
+
+// The page owning the cell whose node is nearest the point, as WaterGrid
+// bins it.
+void PagedWaterDomain::pageAt(float x, float z, int& px, int& pz) const {
+    px = static_cast<int>(std::floor(((x - origin.x) / dx + 0.5f) / pageCells));
+    pz = static_cast<int>(std::floor(((z - origin.z) / dx + 0.5f) / pageCells));
+}
+
+bool PagedWaterDomain::inWindow(int px, int pz) const {
+    return !windowed || (std::abs(px - windowX) <= windowRadius && std::abs(pz - windowZ) <= windowRadius);
+}
+
+const WaterGrid* PagedWaterDomain::findPage(int px, int pz) const {
+    auto it = table.find(key(px, pz));
+    return it == table.end() ? nullptr : pages[it->second].grid.get();
+}
+
+WaterGrid* PagedWaterDomain::findPage(int px, int pz) {
+    auto it = table.find(key(px, pz));
+    return it == table.end() ? nullptr : pages[it->second].grid.get();
+}
+
+WaterGrid* PagedWaterDomain::acquirePage(int px, int pz) {
+    if (WaterGrid* grid = findPage(px, pz)) return grid;
+    const Vec3 corner(origin.x + (px * pageCells - haloCells) * dx, origin.y,
+                      origin.z + (pz * pageCells - haloCells) * dx);
+    std::unique_ptr<WaterGrid> grid;
+    if (!freePages.empty()) {
+        grid = std::move(freePages.back());
+        freePages.pop_back();
+        grid->setOrigin(corner);
+    } else {
+        const int cells = pageCells + 2 * haloCells;
+        grid = std::make_unique<WaterGrid>(cells, cells, dx, corner, baseLevel);
+        grid->setRestDepth(restDepth);
+        grid->setThreadPool(pool);
+        if (pageSetup) pageSetup(*grid);
+    }
+    // Whatever the neighbours let run into their halos on this side belongs
+    // to the new page; edges come last so they win over the corners.
+    static const int kSeedOrder[8] = { 0, 2, 5, 7, 1, 3, 4, 6 };
+    for (int d : kSeedOrder) {
+        const WaterGrid* from = findPage(px + kDirX[d], pz + kDirZ[d]);
+        if (!from) continue;
+        const PageBlock src = haloBlock(7 - d, pageCells, haloCells);
+        const PageBlock dst = edgeBlock(d, pageCells, haloCells);
+        grid->copyCells(*from, src.i, src.k, dst.i, dst.k, dst.w, dst.d);
+    }
+    table[key(px, pz)] = pages.size();
+    pages.push_back(Page{ px, pz, std::move(grid) });
+    return pages.back().grid.get();
+}
+
+// Swaps the last page into slot i.
+void PagedWaterDomain::releasePage(size_t i) {
+    table.erase(key(pages[i].px, pages[i].pz));
+    if (freePages.size() < maxFreePages) {
+        pages[i].grid->reset();
+        freePages.push_back(std::move(pages[i].grid));
+    }
+    if (i + 1 != pages.size()) {
+        pages[i] = std::move(pages.back());
+        table[key(pages[i].px, pages[i].pz)] = i;
+    }
+    pages.pop_back();
+}
+
+void PagedWaterDomain::setWindow(const Vec3& center, int radiusPages) {
+    windowed = radiusPages >= 0;
+    windowRadius = radiusPages;
+    pageAt(center.x, center.z, windowX, windowZ);
+    for (size_t i = pages.size(); i-- > 0;) {
+        if (!inWindow(pages[i].px, pages[i].pz)) releasePage(i);
+    }
+}
+
+void PagedWaterDomain::setRestDepth(float depth) {
+    restDepth = depth;
+    for (auto& page : pages) page.grid->setRestDepth(depth);
+    for (auto& grid : freePages) grid->setRestDepth(depth);
+}
+
+void PagedWaterDomain::setThreadPool(ThreadPool* p) {
+    pool = p;
+    for (auto& page : pages) page.grid->setThreadPool(p);
+    for (auto& grid : freePages) grid->setThreadPool(p);
+}
+
+float PagedWaterDomain::sampleHeight(float x, float z) const {
+    int px, pz;
+    pageAt(x, z, px, pz);
+    const WaterGrid* grid = findPage(px, pz);
+    return grid ? grid->sampleHeight(x, z) : baseLevel;
+}
+
+Vec3 PagedWaterDomain::sampleVelocity(float x, float z) const {
+    int px, pz;
+    pageAt(x, z, px, pz);
+    const WaterGrid* grid = findPage(px, pz);
+    return grid ? grid->sampleVelocity(x, z) : Vec3(0.0f);
+}
+
+void PagedWaterDomain::addImpulse(float x, float z, float du, float dv, float dh) {
+    int px, pz;
+    pageAt(x, z, px, pz);
+    if (!inWindow(px, pz)) return;
+    acquirePage(px, pz)->addImpulse(x, z, du, dv, dh);
+}
+
+// Pages whose own cells the circle overlaps get the impulse; the copies that
+// land in their halos are replaced at the next exchange. All pages exist
+// before any is touched, so a new page is not seeded with a neighbour's copy.
+void PagedWaterDomain::addRadialImpulse(float x, float z, float radius, float dh, float momentumScale) {
+    const float reach = std::max(radius, dx);
+    int px0, pz0, px1, pz1;
+    pageAt(x - reach, z - reach, px0, pz0);
+    pageAt(x + reach, z + reach, px1, pz1);
+    for (int pz = pz0; pz <= pz1; ++pz) {
+        for (int px = px0; px <= px1; ++px) {
+            if (inWindow(px, pz)) acquirePage(px, pz);
+        }
+    }
+    for (int pz = pz0; pz <= pz1; ++pz) {
+        for (int px = px0; px <= px1; ++px) {
+            if (WaterGrid* grid = findPage(px, pz)) grid->addRadialImpulse(x, z, radius, dh, momentumScale);
+        }
+    }
+}
+
+// Fills each page's halo from the own cells of its neighbours. Halos and
+// own cells are disjoint, so pages can be filled in parallel. A halo with
+// no neighbour behind it keeps evolving with the page until one is created
+// there and takes its contents over.
+void PagedWaterDomain::exchangeHalos() {
+    parallelFor(pool, 0, pages.size(), 1, [&](size_t b, size_t e) {
+        for (size_t p = b; p < e; ++p) {
+            for (int d = 0; d < 8; ++d) {
+                const WaterGrid* src = findPage(pages[p].px + kDirX[d], pages[p].pz + kDirZ[d]);
+                if (!src) continue;
+                const PageBlock from = edgeBlock(7 - d, pageCells, haloCells);
+                const PageBlock to = haloBlock(d, pageCells, haloCells);
+                pages[p].grid->copyCells(*src, from.i, from.k, to.i, to.k, to.w, to.d);
+            }
+        }
+    });
+}
+
+// Measures every page, then frees quiet pages that no neighbour is feeding
+// and creates the missing neighbours whose side of a halo is disturbed.
+void PagedWaterDomain::updatePages() {
+    const int P = pageCells, H = haloCells;
+    quiet.assign(pages.size(), 0);
+    edges.assign(pages.size() * 8, 0);
+    parallelFor(pool, 0, pages.size(), 1, [&](size_t b, size_t e) {
+        for (size_t p = b; p < e; ++p) {
+            const WaterGrid& grid = *pages[p].grid;
+            quiet[p] = grid.maxDeviation(H, H, P, P) <= quietThreshold;
+            if (quiet[p]) continue;
+            for (int d = 0; d < 8; ++d) {
+                const PageBlock halo = haloBlock(d, P, H);
+                edges[p * 8 + d] = grid.maxDeviation(halo.i, halo.k, halo.w, halo.d) > quietThreshold;
+            }
+        }
+    });
+
+    std::vector<size_t> released;
+    std::vector<std::pair<int, int>> wanted;
+    for (size_t p = 0; p < pages.size(); ++p) {
+        const int px = pages[p].px, pz = pages[p].pz;
+        bool fed = false;
+        for (int d = 0; d < 8; ++d) {
+            auto it = table.find(key(px + kDirX[d], pz + kDirZ[d]));
+            if (it != table.end()) {
+                fed = fed || edges[it->second * 8 + (7 - d)];
+            } else if (edges[p * 8 + d] && inWindow(px + kDirX[d], pz + kDirZ[d])) {
+                wanted.emplace_back(px + kDirX[d], pz + kDirZ[d]);
+            }
+        }
+        if (!inWindow(px, pz) || (quiet[p] && !fed)) released.push_back(p);
+    }
+    for (size_t r = released.size(); r-- > 0;) releasePage(released[r]);
+    for (const auto& w : wanted) acquirePage(w.first, w.second);
+}
+
+float PagedWaterDomain::estimateStableTimeStep() const {
+    float stable = std::numeric_limits<float>::infinity();
+    for (const auto& page : pages) stable = std::min(stable, page.grid->estimateStableTimeStep());
+    return stable;
+}
+
+void PagedWaterDomain::step(float dt) {
+    float stable = estimateStableTimeStep();
+    step(dt, std::isfinite(stable) ? std::max(1, (int)std::ceil(dt / stable)) : 1);
+}
+
+// As in ClothWorld: with at least as many pages as threads each page is one
+// task, otherwise pages step one after another and parallelise internally.
+void PagedWaterDomain::step(float dt, int substeps) {
+    int iters = std::max(1, substeps);
+    float hdt = dt / iters;
+    const int threads = pool ? pool->size() : 1;
+    for (int it = 0; it < iters; ++it) {
+        updatePages();
+        if (pages.empty()) return;
+        exchangeHalos();
+        if (pages.size() >= static_cast<size_t>(threads)) {
+            parallelFor(pool, 0, pages.size(), 1, [&](size_t b, size_t e) {
+                for (size_t p = b; p < e; ++p) pages[p].grid->step(hdt, 1);
+            });
+        } else {
+            for (auto& page : pages) page.grid->step(hdt, 1);
+        }
+    }
+}
@@ -0,0 +1,205 @@
+#include "SelfCollision.h"
+#include "ThreadPool.h"
+#include "Geometry.h"
+#include <cmath>
+#include <algorithm>
+
+static const size_t kGrain = 2048;
+
+static inline int cellOf(float x, float invCell) { return static_cast<int>(std::floor(x * invCell)); }
+
+static inline uint64_t packCell(int x, int y, int z) {
+    const uint64_t m = 0x1FFFFF;
+    return (uint64_t(x) & m) | ((uint64_t(y) & m) << 21) | ((uint64_t(z) & m) << 42);
+}
+
+static inline uint32_t hashCell(int x, int y, int z, size_t tableSize) {
+    uint32_t h = uint32_t(x) * 73856093u ^ uint32_t(y) * 19349663u ^ uint32_t(z) * 83492791u;
+    return h & uint32_t(tableSize - 1);
+}
+
+void SelfCollision::buildHash(const ParticleStore& ps, const std::vector<int>& triangles, float cellSize, ThreadPool* pool) {
+    const size_t numTris = triangles.size() / 3;
+    size_t wanted = 16;
+    while (wanted < 2 * numTris) wanted <<= 1;
+    if (wanted != tableSize) {
+        tableSize = wanted;
+        bucketCounts.reset(new std::atomic<int>[tableSize]);
+        bucketStart.assign(tableSize + 1, 0);
+    }
+    triBucket.resize(numTris);
+    triCell.resize(numTris);
+    sortedTris.resize(numTris);
+    sortedCells.resize(numTris);
+    triCentroid.resize(3 * numTris);
+    sortedCentroid.resize(3 * numTris);
+    const float invCell = 1.0f / cellSize;
+
+    parallelFor(pool, 0, tableSize, 8 * kGrain, [&](size_t b, size_t e) {
+        for (size_t i = b; i < e; ++i) bucketCounts[i].store(0, std::memory_order_relaxed);
+    });
+
+    // Count pass.
+    parallelFor(pool, 0, numTris, kGrain, [&](size_t b, size_t e) {
+        for (size_t t = b; t < e; ++t) {
+            int a = triangles[3 * t], c1 = triangles[3 * t + 1], c2 = triangles[3 * t + 2];
+            float cx = (ps.px[a] + ps.px[c1] + ps.px[c2]) * (1.0f / 3.0f);
+            float cy = (ps.py[a] + ps.py[c1] + ps.py[c2]) * (1.0f / 3.0f);
+            float cz = (ps.pz[a] + ps.pz[c1] + ps.pz[c2]) * (1.0f / 3.0f);
+            int ix = cellOf(cx, invCell), iy = cellOf(cy, invCell), iz = cellOf(cz, invCell);
+            triCell[t] = packCell(ix, iy, iz);
+            triCentroid[3 * t] = cx; triCentroid[3 * t + 1] = cy; triCentroid[3 * t + 2] = cz;
+            triBucket[t] = hashCell(ix, iy, iz, tableSize);
+            bucketCounts[triBucket[t]].fetch_add(1, std::memory_order_relaxed);
+        }
+    });
+
+    bucketStart[0] = 0;
+    for (size_t i = 0; i < tableSize; ++i) {
+        bucketStart[i + 1] = bucketStart[i] + bucketCounts[i].load(std::memory_order_relaxed);
+    }
+    parallelFor(pool, 0, tableSize, 8 * kGrain, [&](size_t b, size_t e) {
+        for (size_t i = b; i < e; ++i) bucketCounts[i].store(bucketStart[i], std::memory_order_relaxed);
+    });
+
+    // Scatter pass; slots inside a bucket are claimed in arbitrary order...
+    parallelFor(pool, 0, numTris, kGrain, [&](size_t b, size_t e) {
+        for (size_t t = b; t < e; ++t) {
+            int slot = bucketCounts[triBucket[t]].fetch_add(1, std::memory_order_relaxed);
+            sortedTris[slot] = static_cast<int>(t);
+        }
+    });
+
+    // ...so each (small) bucket is sorted to keep the result deterministic.
+    parallelFor(pool, 0, tableSize, 8 * kGrain, [&](size_t b, size_t e) {
+        for (size_t i = b; i < e; ++i) {
+            auto first = sortedTris.begin() + bucketStart[i];
+            auto last = sortedTris.begin() + bucketStart[i + 1];
+            if (last - first > 1) std::sort(first, last);
+            for (int k = bucketStart[i]; k < bucketStart[i + 1]; ++k) {
+                int t = sortedTris[k];
+                sortedCells[k] = triCell[t];
+                sortedCentroid[3 * k] = triCentroid[3 * t];
+                sortedCentroid[3 * k + 1] = triCentroid[3 * t + 1];
+                sortedCentroid[3 * k + 2] = triCentroid[3 * t + 2];
+            }
+        }
+    });
+}
+
+void SelfCollision::resolve(ParticleStore& ps, const std::vector<int>& triangles, int gridWidth, float deltaTime, ThreadPool* pool) {
+    const size_t numTris = triangles.size() / 3;
+    const size_t n = ps.size();
+    lastContacts = 0;
+    if (numTris == 0 || n == 0 || thickness <= 0.0f) return;
+
+    // The query radius has to reach any triangle whose closest point is within
+    // `thickness`, i.e. the largest centroid-to-vertex distance plus thickness.
+    size_t chunks = (numTris + kGrain - 1) / kGrain;
+    partialRadius.assign(chunks, 0.0f);
+    parallelFor(pool, 0, numTris, kGrain, [&](size_t b, size_t e) {
+        float r2 = 0.0f;
+        for (size_t t = b; t < e; ++t) {
+            const int* v = &triangles[3 * t];
+            Vec3 c = (ps.position(v[0]) + ps.position(v[1]) + ps.position(v[2])) * (1.0f / 3.0f);
+            for (int k = 0; k < 3; ++k) {
+                Vec3 d = ps.position(v[k]) - c;
+                r2 = std::max(r2, dot(d, d));
+            }
+        }
+        partialRadius[b / kGrain] = r2;
+    });
+    float triRadius2 = 0.0f;
+    for (float r2 : partialRadius) triRadius2 = std::max(triRadius2, r2);
+    const float cellSize = std::max(1e-4f, std::sqrt(triRadius2) + thickness);
+    const float invCell = 1.0f / cellSize;
+
+    buildHash(ps, triangles, cellSize, pool);
+
+    for (auto* a : { &dpx, &dpy, &dpz, &dvx, &dvy, &dvz }) a->assign(n, 0.0f);
+    hits.assign(n, 0);
+    const float thick2 = thickness * thickness;
+    const float reach2 = cellSize * cellSize;
+
+    parallelFor(pool, 0, n, kGrain, [&](size_t b, size_t e) {
+        for (size_t i = b; i < e; ++i) {
+            if (ps.invMass[i] == 0.0f) continue;
+            Vec3 p = ps.position(i);
+            Vec3 vp = ps.velocity(i);
+            Vec3 prev = p - vp * deltaTime;
+            int gx = gridWidth > 0 ? static_cast<int>(i) % gridWidth : 0;
+            int gy = gridWidth > 0 ? static_cast<int>(i) / gridWidth : 0;
+            int cx = cellOf(p.x, invCell), cy = cellOf(p.y, invCell), cz = cellOf(p.z, invCell);
+            Vec3 dp(0.0f), dv(0.0f);
+            int count = 0;
+
+            for (int oz = -1; oz <= 1; ++oz) {
+                for (int oy = -1; oy <= 1; ++oy) {
+                    for (int ox = -1; ox <= 1; ++ox) {
+                        uint64_t key = packCell(cx + ox, cy + oy, cz + oz);
+                        uint32_t bucket = hashCell(cx + ox, cy + oy, cz + oz, tableSize);
+                        for (int k = bucketStart[bucket]; k < bucketStart[bucket + 1]; ++k) {
+                            if (sortedCells[k] != key) continue;
+                            float ex = p.x - sortedCentroid[3 * k];
+                            float ey = p.y - sortedCentroid[3 * k + 1];
+                            float ez = p.z - sortedCentroid[3 * k + 2];
+                            if (ex * ex + ey * ey + ez * ez > reach2) continue;
+                            const int* v = &triangles[3 * sortedTris[k]];
+
+                            // Skip the triangles touching the particle's 1-ring.
+                            bool neighbour = false;
+                            for (int m = 0; m < 3 && !neighbour; ++m) {
+                                if (v[m] == static_cast<int>(i)) neighbour = true;
+                                else if (gridWidth > 0) {
+                                    int vx = v[m] % gridWidth, vy = v[m] / gridWidth;
+                                    neighbour = std::abs(vx - gx) <= 1 && std::abs(vy - gy) <= 1;
+                                }
+                            }
+                            if (neighbour) continue;
+
+                            Vec3 a = ps.position(v[0]), bb = ps.position(v[1]), c = ps.position(v[2]);
+                            Vec3 w = closestBarycentric(p, a, bb, c);
+                            Vec3 q = a * w.x + bb * w.y + c * w.z;
+                            Vec3 d = p - q;
+                            if (dot(d, d) >= thick2) continue;
+
+                            Vec3 nrm = (bb - a).cross(c - a);
+                            float nl = nrm.length();
+                            if (nl < 1e-12f) continue;
+                            nrm = nrm / nl;
+                            // Push back out on the side the particle came from.
+                            if (dot(prev - a, nrm) < 0.0f) nrm = -nrm;
+
+                            float planeDist = dot(p - a, nrm);
+                            if (planeDist < thickness) dp += nrm * ((thickness - planeDist) * 0.5f);
+
+                            Vec3 vt = ps.velocity(v[0]) * w.x + ps.velocity(v[1]) * w.y + ps.velocity(v[2]) * w.z;
+                            Vec3 rel = vp - vt;
+                            float vn = dot(rel, nrm);
+                            if (vn < 0.0f) {
+                                Vec3 tangential = rel - nrm * vn;
+                                dv += (nrm * (-vn) - tangential * friction) * 0.5f;
+                            }
+                            ++count;
+                        }
+                    }
+                }
+            }
+
+            if (count > 0) {
+                float inv = 1.0f / count;
+                dpx[i] = dp.x * inv; dpy[i] = dp.y * inv; dpz[i] = dp.z * inv;
+                dvx[i] = dv.x * inv; dvy[i] = dv.y * inv; dvz[i] = dv.z * inv;
+                hits[i] = count;
+            }
+        }
+    });
+
+    parallelFor(pool, 0, n, kGrain, [&](size_t b, size_t e) {
+        for (size_t i = b; i < e; ++i) {
+            ps.px[i] += dpx[i]; ps.py[i] += dpy[i]; ps.pz[i] += dpz[i];
+            ps.vx[i] += dvx[i]; ps.vy[i] += dvy[i]; ps.vz[i] += dvz[i];
+        }
+    });
+    for (size_t i = 0; i < n; ++i) lastContacts += hits[i];
+}
@@ -0,0 +1,248 @@
+#include "SpectralOcean.h"
+#include "Water.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <cmath>
+#include <random>
+
+static const float kGravity = 9.81f;
+static const float kPi = 3.14159265358979f;
+
+// Brings the Phillips spectrum, which has no physical scale of its own, to
+// about the fully developed significant height for the wind at amplitude 1.
+static const float kPhillipsScale = 2.5e-3f;
+
+// Columns per task in the column pass; a multiple of the SIMD width.
+static const int kColumnBlock = 32;
+
+SpectralOcean::SpectralOcean(int size, float patchSize)
+    : n(2), patchSize(patchSize), spectrum(Spectrum::Phillips), wind(6.0f, 0.0f, 2.0f), amplitude(1.0f),
+      fetch(50000.0f), peakEnhancement(3.3f), depth(1000.0f), seed(1337u), dirty(true),
+      pool(&ThreadPool::shared()) {
+    while (n < size) n *= 2;
+    const size_t cells = static_cast<size_t>(n) * n;
+    for (auto* a : { &h0Re, &h0Im, &omega, &speed, &aRe, &aIm, &bRe, &bIm, &height, &velX, &velY, &velZ }) {
+        a->assign(cells, 0.0f);
+    }
+    int bits = 0;
+    while ((1 << bits) < n) ++bits;
+    bitReverse.resize(n);
+    for (int i = 0; i < n; ++i) {
+        int r = 0;
+        for (int b = 0; b < bits; ++b) r |= ((i >> b) & 1) << (bits - 1 - b);
+        bitReverse[i] = r;
+    }
+    // Stage with butterfly span len uses e^{+2 pi i j / len}, j < len / 2,
+    // stored from offset len / 2 - 1.
+    for (int len = 2; len <= n; len *= 2) {
+        for (int j = 0; j < len / 2; ++j) {
+            const double a = 2.0 * 3.14159265358979323846 * j / len;
+            twiddleRe.push_back(static_cast<float>(std::cos(a)));
+            twiddleIm.push_back(static_cast<float>(std::sin(a)));
+        }
+    }
+}
+
+// Variance density over the wavevector, in m^2 per (rad/m)^2 before the
+// amplitude scale.
+float SpectralOcean::spectrumAt(float kx, float kz) const {
+    const float k = std::sqrt(kx * kx + kz * kz);
+    const float windSpeed = std::sqrt(wind.x * wind.x + wind.z * wind.z);
+    if (k < 1e-6f || windSpeed < 1e-4f) return 0.0f;
+    const float cosTheta = (kx * wind.x + kz * wind.z) / (k * windSpeed);
+    if (spectrum == Spectrum::Phillips) {
+        const float L = windSpeed * windSpeed / kGravity;
+        const float l = L * 1e-3f;
+        // Waves running against the wind are mostly suppressed.
+        const float align = cosTheta * cosTheta * (cosTheta < 0.0f ? 0.07f : 1.0f);
+        return kPhillipsScale * std::exp(-1.0f / (k * L * k * L)) / (k * k * k * k) * align * std::exp(-k * k * l * l);
+    }
+    if (cosTheta <= 0.0f) return 0.0f;
+    const float w = std::sqrt(kGravity * k);
+    const float alpha = 0.076f * std::pow(windSpeed * windSpeed / (fetch * kGravity), 0.22f);
+    const float wp = 22.0f * std::pow(kGravity * kGravity / (windSpeed * fetch), 1.0f / 3.0f);
+    const float sigma = w <= wp ? 0.07f : 0.09f;
+    const float r = std::exp(-(w - wp) * (w - wp) / (2.0f * sigma * sigma * wp * wp));
+    const float sw = alpha * kGravity * kGravity / std::pow(w, 5.0f) * std::exp(-1.25f * std::pow(wp / w, 4.0f)) *
+                     std::pow(peakEnhancement, r);
+    // S(k) = S(w) dw/dk, spread over direction by (2/pi) cos^2 and over the
+    // circle of radius k.
+    const float sk = sw * kGravity / (2.0f * w);
+    return sk * (2.0f / kPi) * cosTheta * cosTheta / k;
+}
+
+void SpectralOcean::buildSpectrum() {
+    std::mt19937 rng(seed);
+    std::normal_distribution<float> gauss(0.0f, 1.0f);
+    const float dk = 2.0f * kPi / patchSize;
+    for (int k = 0; k < n; ++k) {
+        for (int i = 0; i < n; ++i) {
+            const size_t id = static_cast<size_t>(k) * n + i;
+            const float kx = dk * (i < n / 2 ? i : i - n);
+            const float kz = dk * (k < n / 2 ? k : k - n);
+            const float kl = std::sqrt(kx * kx + kz * kz);
+            const float xr = gauss(rng), xi = gauss(rng);
+            // The Nyquist row and column have no conjugate partner.
+            const bool nyquist = i == n / 2 || k == n / 2;
+            const float a = nyquist ? 0.0f : std::sqrt(amplitude * spectrumAt(kx, kz) * dk * dk * 0.5f);
+            h0Re[id] = xr * a;
+            h0Im[id] = xi * a;
+            const float t = std::tanh(std::min(kl * depth, 20.0f));
+            omega[id] = std::sqrt(kGravity * kl * t);
+            speed[id] = kl > 0.0f ? omega[id] / t : 0.0f;
+        }
+    }
+    dirty = false;
+}
+
+// Unnormalised inverse transform, x_j = sum_m X_m e^{+2 pi i j m / n}, first
+// along rows and then along columns.
+void SpectralOcean::inverseFft(std::vector<float>& re, std::vector<float>& im) {
+    const int N = n;
+    parallelFor(pool, 0, N, std::max(1, 4096 / N), [&](size_t rb, size_t rend) {
+        for (size_t row = rb; row < rend; ++row) {
+            float* __restrict xr = &re[row * N];
+            float* __restrict xi = &im[row * N];
+            for (int i = 0; i < N; ++i) {
+                const int j = bitReverse[i];
+                if (j > i) {
+                    std::swap(xr[i], xr[j]);
+                    std::swap(xi[i], xi[j]);
+                }
+            }
+            for (int half = 1; half < N; half *= 2) {
+                const float* __restrict wr = &twiddleRe[half - 1];
+                const float* __restrict wi = &twiddleIm[half - 1];
+                for (int s = 0; s < N; s += 2 * half) {
+                    float* __restrict ar = xr + s;
+                    float* __restrict ai = xi + s;
+                    float* __restrict br = xr + s + half;
+                    float* __restrict bi = xi + s + half;
+                    for (int j = 0; j < half; ++j) {
+                        const float tr = wr[j] * br[j] - wi[j] * bi[j];
+                        const float ti = wr[j] * bi[j] + wi[j] * br[j];
+                        br[j] = ar[j] - tr;
+                        bi[j] = ai[j] - ti;
+                        ar[j] += tr;
+                        ai[j] += ti;
+                    }
+                }
+            }
+        }
+    });
+    // Columns: the same butterflies with whole row segments as elements.
+    parallelFor(pool, 0, N, kColumnBlock, [&](size_t cb, size_t ce) {
+        const int c0 = static_cast<int>(cb), w = static_cast<int>(ce - cb);
+        for (int i = 0; i < N; ++i) {
+            const int j = bitReverse[i];
+            if (j > i) {
+                std::swap_ranges(&re[i * N + c0], &re[i * N + c0] + w, &re[j * N + c0]);
+                std::swap_ranges(&im[i * N + c0], &im[i * N + c0] + w, &im[j * N + c0]);
+            }
+        }
+        for (int half = 1; half < N; half *= 2) {
+            for (int s = 0; s < N; s += 2 * half) {
+                for (int j = 0; j < half; ++j) {
+                    const float wr = twiddleRe[half - 1 + j], wi = twiddleIm[half - 1 + j];
+                    float* __restrict ar = &re[(s + j) * N + c0];
+                    float* __restrict ai = &im[(s + j) * N + c0];
+                    float* __restrict br = &re[(s + j + half) * N + c0];
+                    float* __restrict bi = &im[(s + j + half) * N + c0];
+                    for (int c = 0; c < w; ++c) {
+                        const float tr = wr * br[c] - wi * bi[c];
+                        const float ti = wr * bi[c] + wi * br[c];
+                        br[c] = ar[c] - tr;
+                        bi[c] = ai[c] - ti;
+                        ar[c] += tr;
+                        ai[c] += ti;
+                    }
+                }
+            }
+        }
+    });
+}
+
+// With A = h0(k) e^{i w t} and B = conj(h0(-k)) e^{-i w t}, the height is
+// A + B, A being a wave that runs along -k and B one along +k. The surface
+// orbital velocity is speed * khat * (B - A) and the vertical velocity
+// -i w (B - A). Height + i u and v + i w pack into two complex fields whose
+// inverse transforms come out as real + i real.
+void SpectralOcean::update(float t) {
+    if (dirty) buildSpectrum();
+    const int N = n;
+    const float dk = 2.0f * kPi / patchSize;
+    parallelFor(pool, 0, N, std::max(1, 4096 / N), [&](size_t kb, size_t ke) {
+        for (int k = (int)kb; k < (int)ke; ++k) {
+            const int nk = (N - k) & (N - 1);
+            const float kz = dk * (k < N / 2 ? k : k - N);
+            for (int i = 0; i < N; ++i) {
+                const size_t id = static_cast<size_t>(k) * N + i;
+                const size_t nid = static_cast<size_t>(nk) * N + ((N - i) & (N - 1));
+                const float kx = dk * (i < N / 2 ? i : i - N);
+                const float kl = std::sqrt(kx * kx + kz * kz);
+                const float c = std::cos(omega[id] * t), s = std::sin(omega[id] * t);
+                const float Ar = h0Re[id] * c - h0Im[id] * s, Ai = h0Re[id] * s + h0Im[id] * c;
+                const float Br = h0Re[nid] * c - h0Im[nid] * s, Bi = -h0Im[nid] * c - h0Re[nid] * s;
+                const float Hr = Ar + Br, Hi = Ai + Bi;
+                const float Dr = Br - Ar, Di = Bi - Ai;
+                const float sx = kl > 0.0f ? speed[id] * kx / kl : 0.0f;
+                const float sz = kl > 0.0f ? speed[id] * kz / kl : 0.0f;
+                const float Wr = omega[id] * Di, Wi = -omega[id] * Dr;
+                aRe[id] = Hr - sx * Di;
+                aIm[id] = Hi + sx * Dr;
+                bRe[id] = sz * Dr - Wi;
+                bIm[id] = sz * Di + Wr;
+            }
+        }
+    });
+    inverseFft(aRe, aIm);
+    inverseFft(bRe, bIm);
+    height.swap(aRe);
+    velX.swap(aIm);
+    velZ.swap(bRe);
+    velY.swap(bIm);
+}
+
+float SpectralOcean::sampleHeight(float x, float z) const {
+    const float fx = x / patchSize * n, fz = z / patchSize * n;
+    const float x0 = std::floor(fx), z0 = std::floor(fz);
+    const float tx = fx - x0, tz = fz - z0;
+    const int i0 = static_cast<int>(x0) & (n - 1), k0 = static_cast<int>(z0) & (n - 1);
+    const int i1 = (i0 + 1) & (n - 1), k1 = (k0 + 1) & (n - 1);
+    auto at = [&](int i, int k) { return height[static_cast<size_t>(k) * n + i]; };
+    return (1 - tz) * ((1 - tx) * at(i0, k0) + tx * at(i1, k0)) + tz * ((1 - tx) * at(i0, k1) + tx * at(i1, k1));
+}
+
+Vec3 SpectralOcean::sampleVelocity(float x, float z) const {
+    const float fx = x / patchSize * n, fz = z / patchSize * n;
+    const float x0 = std::floor(fx), z0 = std::floor(fz);
+    const float tx = fx - x0, tz = fz - z0;
+    const int i0 = static_cast<int>(x0) & (n - 1), k0 = static_cast<int>(z0) & (n - 1);
+    const int i1 = (i0 + 1) & (n - 1), k1 = (k0 + 1) & (n - 1);
+    auto lerp = [&](const std::vector<float>& f) {
+        auto at = [&](int i, int k) { return f[static_cast<size_t>(k) * n + i]; };
+        return (1 - tz) * ((1 - tx) * at(i0, k0) + tx * at(i1, k0)) + tz * ((1 - tx) * at(i0, k1) + tx * at(i1, k1));
+    };
+    return Vec3(lerp(velX), lerp(velY), lerp(velZ));
+}
+
+void SpectralOcean::driveBoundary(WaterGrid& grid, int width, float dt, float timeScale) const {
+    const float blend = 1.0f - std::exp(-dt / std::max(timeScale, 1e-4f));
+    const float base = grid.getBaseLevel();
+    grid.relaxBorder(width, blend, [&](float x, float z, float& h, float& u, float& v) {
+        h = base + sampleHeight(x, z);
+        const Vec3 vel = sampleVelocity(x, z);
+        u = vel.x;
+        v = vel.z;
+    });
+}
+
+float SpectralOcean::getSignificantWaveHeight() const {
+    double sum = 0.0, sum2 = 0.0;
+    for (float h : height) {
+        sum += h;
+        sum2 += static_cast<double>(h) * h;
+    }
+    const double mean = sum / height.size();
+    return 4.0f * static_cast<float>(std::sqrt(std::max(0.0, sum2 / height.size() - mean * mean)));
+}
@@ -0,0 +1,83 @@
+#include "ThreadPool.h"
+#include <algorithm>
+
+static thread_local int parallelDepth = 0;
+
+ThreadPool::ThreadPool(int threads) {
+    if (threads <= 0) threads = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+    for (int i = 1; i < threads; ++i) {
+        workers.emplace_back([this] { workerLoop(); });
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (auto& t : workers) t.join();
+}
+
+ThreadPool& ThreadPool::shared() {
+    static ThreadPool pool;
+    return pool;
+}
+
+void ThreadPool::runChunks() {
+    ++parallelDepth;
+    for (;;) {
+        size_t b = job.next.fetch_add(job.grain);
+        if (b >= job.end) break;
+        (*job.fn)(b, std::min(job.end, b + job.grain));
+    }
+    --parallelDepth;
+}
+
+void ThreadPool::workerLoop() {
+    unsigned long long seen = 0;
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [&] { return stopping || (generation != seen && job.fn); });
+            if (stopping) return;
+            seen = generation;
+            ++inFlight;
+        }
+        runChunks();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            --inFlight;
+        }
+        done.notify_one();
+    }
+}
+
+void ThreadPool::parallelFor(size_t begin, size_t end, size_t grain, const std::function<void(size_t, size_t)>& fn) {
+    if (begin >= end) return;
+    grain = std::max<size_t>(1, grain);
+    if (workers.empty() || parallelDepth > 0 || end - begin <= grain) {
+        ++parallelDepth;
+        for (size_t b = begin; b < end; b += grain) fn(b, std::min(end, b + grain));
+        --parallelDepth;
+        return;
+    }
+
+    std::lock_guard<std::mutex> submit(submitMutex);
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        job.fn = &fn;
+        job.begin = begin;
+        job.end = end;
+        job.grain = grain;
+        job.next.store(begin);
+        ++generation;
+    }
+    wake.notify_all();
+    runChunks();
+
+    // Workers that have not picked the job up yet see fn == nullptr and skip it.
+    std::unique_lock<std::mutex> lock(mutex);
+    done.wait(lock, [&] { return inFlight == 0; });
+    job.fn = nullptr;
+}
@@ -0,0 +1,28 @@
+#include "TimeStepController.h"
+#include "ClothWorld.h"
+#include "Water.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+int TimeStepController::substepsFor(float frameTime, float stableStep) const {
+    float limit = std::min(maxStep, safety * stableStep);
+    if (frameTime <= 0.0f || limit <= 0.0f) return 1;
+    int n = static_cast<int>(std::ceil(frameTime / limit));
+    return std::max(1, std::min(maxSubsteps, n));
+}
+
+const StepPlan& TimeStepController::plan(float frameTime, const ClothWorld& world, const WaterGrid* water) {
+    last.frameTime = std::max(0.0f, std::min(frameTime, maxFrameTime));
+
+    float clothStable = world.estimateStableTimeStep();
+    last.clothSubsteps = substepsFor(last.frameTime, clothStable);
+    last.clothStep = last.frameTime / last.clothSubsteps;
+    last.clothMargin = last.clothStep > 0.0f ? clothStable / last.clothStep : std::numeric_limits<float>::infinity();
+
+    float waterStable = water ? water->estimateStableTimeStep() : std::numeric_limits<float>::infinity();
+    last.waterSubsteps = substepsFor(last.frameTime, waterStable);
+    last.waterStep = last.frameTime / last.waterSubsteps;
+    last.waterMargin = last.waterStep > 0.0f ? waterStable / last.waterStep : std::numeric_limits<float>::infinity();
+    return last;
+}
@@ -1,42 +1,170 @@
 #include "Water.h"
+#include "ThreadPool.h"
 #include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+#if defined(__AVX2__) || defined(__F16C__)
+#include <immintrin.h>
+#endif
+#if defined(__AVX2__)
+#define WATER_SIMD_AVX2 1
+#endif
+
+// Damping and smoothing below were tuned per substep at this length; they
+// are rescaled so the result does not depend on how dt is subdivided.
+static const float kReferenceStep = 0.006f;
+
+// One row of the diffuse Jacobi update. Multiplying by the reciprocal of
+// the diagonal keeps the sweep from being bound by division throughput.
+static void jacobiRow(const float* __restrict src, float* __restrict dst, int count, int stride, float a) {
+    const float inv = 1.0f / (1.0f + 4.0f * a);
+    for (int i = 0; i < count; ++i) {
+        dst[i] = (src[i] + a * (src[i + 1] + src[i - 1] + src[i + stride] + src[i - stride])) * inv;
+    }
+}
+
+// IEEE half conversions, rounding to nearest even. Without F16C they are
+// done on the bits; overflow goes to infinity, tiny values to subnormals.
+static inline uint16_t floatToHalf(float f) {
+#if defined(__F16C__)
+    return _cvtss_sh(f, _MM_FROUND_TO_NEAREST_INT);
+#else
+    uint32_t x;
+    std::memcpy(&x, &f, 4);
+    const uint16_t sign = static_cast<uint16_t>((x >> 16) & 0x8000);
+    x &= 0x7fffffff;
+    if (x > 0x7f800000) return sign | 0x7e00;
+    if (x >= 0x47800000) return sign | 0x7c00;
+    if (x < 0x38800000) {
+        if (x < 0x33000000) return sign;
+        const int shift = 126 - static_cast<int>(x >> 23);
+        const uint32_t m = (x & 0x7fffff) | 0x800000;
+        uint32_t h = m >> shift;
+        const uint32_t rem = m & ((1u << shift) - 1), halfway = 1u << (shift - 1);
+        if (rem > halfway || (rem == halfway && (h & 1))) ++h;
+        return sign | static_cast<uint16_t>(h);
+    }
+    uint32_t h = (x - 0x38000000) >> 13;
+    const uint32_t rem = x & 0x1fff;
+    if (rem > 0x1000 || (rem == 0x1000 && (h & 1))) ++h;
+    return sign | static_cast<uint16_t>(h);
+#endif
+}
+
+static inline float halfToFloat(uint16_t h) {
+#if defined(__F16C__)
+    return _cvtsh_ss(h);
+#else
+    const uint32_t sign = static_cast<uint32_t>(h & 0x8000) << 16;
+    const uint32_t e = (h >> 10) & 0x1f, m = h & 0x3ff;
+    if (e == 0) {
+        const float f = std::ldexp(static_cast<float>(m), -24);
+        return sign ? -f : f;
+    }
+    const uint32_t x = sign | (e == 31 ? 0x7f800000 | (m << 13) : ((e + 112) << 23) | (m << 13));
+    float f;
+    std::memcpy(&f, &x, 4);
+    return f;
+#endif
+}
+
+float WaterGrid::FieldCodec::decode(uint16_t s) const {
+    return half ? halfToFloat(s) + offset : offset + scale * static_cast<float>(static_cast<int16_t>(s));
+}
+
+uint16_t WaterGrid::FieldCodec::encode(float f) const {
+    if (half) return floatToHalf(f - offset);
+    const float x = std::min(32767.0f, std::max(-32768.0f, (f - offset) * inv));
+    return static_cast<uint16_t>(static_cast<int16_t>(std::nearbyint(x)));
+}
+
+// The vector paths round exactly as the scalar ones do.
+void WaterGrid::FieldCodec::decodeRow(const uint16_t* s, float* f, int n) const {
+    int i = 0;
+#if defined(WATER_SIMD_AVX2)
+    const __m256 vOffset = _mm256_set1_ps(offset), vScale = _mm256_set1_ps(scale);
+#if defined(__F16C__)
+    for (; half && i + 8 <= n; i += 8) {
+        __m256 x = _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i)));
+        _mm256_storeu_ps(f + i, _mm256_add_ps(x, vOffset));
+    }
+#endif
+    for (; !half && i + 8 <= n; i += 8) {
+        __m256 x = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i))));
+        _mm256_storeu_ps(f + i, _mm256_add_ps(vOffset, _mm256_mul_ps(vScale, x)));
+    }
+#endif
+    for (; i < n; ++i) f[i] = decode(s[i]);
+}
+
+void WaterGrid::FieldCodec::encodeRow(const float* f, uint16_t* s, int n) const {
+    int i = 0;
+#if defined(WATER_SIMD_AVX2)
+    const __m256 vOffset = _mm256_set1_ps(offset), vInv = _mm256_set1_ps(inv);
+#if defined(__F16C__)
+    for (; half && i + 8 <= n; i += 8) {
+        __m128i x = _mm256_cvtps_ph(_mm256_sub_ps(_mm256_loadu_ps(f + i), vOffset), _MM_FROUND_TO_NEAREST_INT);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(s + i), x);
+    }
+#endif
+    for (; !half && i + 8 <= n; i += 8) {
+        __m256 x = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(f + i), vOffset), vInv);
+        x = _mm256_min_ps(_mm256_set1_ps(32767.0f), _mm256_max_ps(_mm256_set1_ps(-32768.0f), x));
+        __m256i w = _mm256_cvtps_epi32(x);
+        w = _mm256_permute4x64_epi64(_mm256_packs_epi32(w, w), 0x08);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(s + i), _mm256_castsi256_si128(w));
+    }
+#endif
+    for (; i < n; ++i) s[i] = encode(f[i]);
+}
 
 WaterGrid::WaterGrid(int nx, int nz, float dx, const Vec3& origin, float baseLevel)
-    : nx(nx), nz(nz), dx(dx), origin(origin), baseLevel(baseLevel),
+    : nx(nx), nz(nz), dx(dx), origin(origin), baseLevel(baseLevel), bedLevel(baseLevel - 0.6f), cflNumber(0.5f),
       h(nx * nz, baseLevel), u(nx * nz, 0.0f), v(nx * nz, 0.0f), q(nx * nz, 0.0f),
       hTmp(nx * nz, baseLevel), uTmp(nx * nz, 0.0f), vTmp(nx * nz, 0.0f), qTmp(nx * nz, 0.0f),
-      gravity(9.81f), viscosity(0.05f), waveDamping(0.998f) {}
+      gravity(9.81f), viscosity(0.05f), waveDamping(0.998f), pool(&ThreadPool::shared()),
+      fusedStep(false), diffusionSolver(DiffusionSolver::Jacobi), diffusionTolerance(1e-4f),
+      maxDiffusionCycles(8), lastDiffusionIterations(0), advectionScheme(AdvectionScheme::Nearest),
+      waveSolver(WaveSolver::Explicit), waveTolerance(1e-4f), maxWaveCycles(8), lastWaveIterations(0),
+      fieldStorage(FieldStorage::Float32), codecs{}, packed(false), hViewStale(true), splatRadius(-1.0f), splatCells(0),
+      keepPrevious(false), previousValid(false), sampleBlend(1.0f), activeTracking(false), activityThreshold(1e-4f),
+      activeFraction(1.0f),
+      tilesX((nx + kActiveTile - 1) / kActiveTile), tilesZ((nz + kActiveTile - 1) / kActiveTile) {}
+
+void WaterGrid::nearestNode(float x, float z, int& i, int& k) const {
+    i = std::clamp((int)std::floor((x - origin.x) / dx + 0.5f), 0, nx - 1);
+    k = std::clamp((int)std::floor((z - origin.z) / dx + 0.5f), 0, nz - 1);
+}
 
 float WaterGrid::sampleHeight(float x, float z) const {
-    float fx = (x - origin.x) / dx;
-    float fz = (z - origin.z) / dx;
-    int i = std::clamp((int)fx, 0, nx - 1);
-    int k = std::clamp((int)fz, 0, nz - 1);
-    return h[idx(i, k)];
+    int i, k;
+    nearestNode(x, z, i, k);
+    return cell(kHeight, idx(i, k));
 }
 
 Vec3 WaterGrid::sampleVelocity(float x, float z) const {
-    float fx = (x - origin.x) / dx;
-    float fz = (z - origin.z) / dx;
-    int i = std::clamp((int)fx, 0, nx - 1);
-    int k = std::clamp((int)fz, 0, nz - 1);
-    return Vec3(u[idx(i, k)], 0.0f, v[idx(i, k)]);
+    int i, k;
+    nearestNode(x, z, i, k);
+    return Vec3(cell(kVelocityX, idx(i, k)), 0.0f, cell(kVelocityZ, idx(i, k)));
 }
 
 void WaterGrid::addImpulse(float x, float z, float du, float dv, float dh) {
-    float fx = (x - origin.x) / dx;
-    float fz = (z - origin.z) / dx;
-    int i = std::clamp((int)fx, 0, nx - 1);
-    int k = std::clamp((int)fz, 0, nz - 1);
+    int i, k;
+    nearestNode(x, z, i, k);
     int id = idx(i, k);
-    u[id] += du;
-    v[id] += dv;
-    h[id] += dh;
+    setCell(kVelocityX, id, cell(kVelocityX, id) + du);
+    setCell(kVelocityZ, id, cell(kVelocityZ, id) + dv);
+    setCell(kHeight, id, cell(kHeight, id) + dh);
+    if (packed) hViewStale = true;
+    if (activeTracking) wakeTile(i, k);
 }
 
 void WaterGrid::addRadialImpulse(float x, float z, float radius, float dh, float momentumScale) {
-    int iCenter = std::clamp((int)((x - origin.x) / dx), 0, nx - 1);
-    int kCenter = std::clamp((int)((z - origin.z) / dx), 0, nz - 1);
+    int iCenter, kCenter;
+    nearestNode(x, z, iCenter, kCenter);
     int rCells = std::max(1, (int)(radius / dx));
     for (int dk = -rCells; dk <= rCells; ++dk) {
         for (int di = -rCells; di <= rCells; ++di) {
@@ -51,17 +179,172 @@ void WaterGrid::addRadialImpulse(float x, float z, float radius, float dh, float
                 float w = std::exp(-(dist * dist) / (2.0f * sigma * sigma));
                 float dhLocal = std::max(-0.004f, std::min(0.004f, dh)) * w;
                 int id = idx(i, k);
-                q[id] += dhLocal;
+                setCell(kSource, id, cell(kSource, id) + dhLocal);
                 float dirx = (dist > 1e-5f) ? (dxw / dist) : 0.0f;
                 float dirz = (dist > 1e-5f) ? (dzw / dist) : 0.0f;
-                u[id] += dirx * momentumScale * w * (dhLocal / std::max(radius, 1e-3f));
-                v[id] += dirz * momentumScale * w * (dhLocal / std::max(radius, 1e-3f));
-                float dev = h[id] - baseLevel;
-                if (dev > 0.20f) h[id] = baseLevel + 0.20f;
-                if (dev < -0.20f) h[id] = baseLevel - 0.20f;
+                setCell(kVelocityX, id, cell(kVelocityX, id) + dirx * momentumScale * w * (dhLocal / std::max(radius, 1e-3f)));
+                setCell(kVelocityZ, id, cell(kVelocityZ, id) + dirz * momentumScale * w * (dhLocal / std::max(radius, 1e-3f)));
+                float dev = cell(kHeight, id) - baseLevel;
+                if (dev > 0.20f) setCell(kHeight, id, baseLevel + 0.20f);
+                if (dev < -0.20f) setCell(kHeight, id, baseLevel - 0.20f);
+                if (activeTracking) wakeTile(i, k);
             }
         }
     }
+    if (packed) hViewStale = true;
+}
+
+// The weights of addRadialImpulse depend only on the cell offset from the
+// centre cell, so they are computed once per radius.
+void WaterGrid::buildSplatTable(float radius) {
+    const int R = std::max(1, (int)(radius / dx)), W = 2 * R + 1;
+    splatRadius = radius;
+    splatCells = R;
+    splatWeight.assign(W * W, 0.0f);
+    splatPushX.assign(W * W, 0.0f);
+    splatPushZ.assign(W * W, 0.0f);
+    splatExtent.assign(W, -1);
+    const float sigma = radius * 0.5f;
+    for (int dk = -R; dk <= R; ++dk) {
+        for (int di = -R; di <= R; ++di) {
+            float dxw = di * dx;
+            float dzw = dk * dx;
+            float dist = std::sqrt(dxw * dxw + dzw * dzw);
+            if (dist > radius) continue;
+            float w = std::exp(-(dist * dist) / (2.0f * sigma * sigma));
+            float dirx = (dist > 1e-5f) ? (dxw / dist) : 0.0f;
+            float dirz = (dist > 1e-5f) ? (dzw / dist) : 0.0f;
+            const int t = (dk + R) * W + (di + R);
+            splatWeight[t] = w;
+            splatPushX[t] = dirx * w * w / std::max(radius, 1e-3f);
+            splatPushZ[t] = dirz * w * w / std::max(radius, 1e-3f);
+            splatExtent[dk + R] = std::max(splatExtent[dk + R], std::abs(di));
+        }
+    }
+}
+
+// One window row of a binned splat: dh is the bin's summed clamped height,
+// push that times the momentum scale.
+static void splatRow(float* __restrict q, float* __restrict u, float* __restrict v, float* __restrict h,
+                     const float* w, const float* px, const float* pz, int n, float dh, float push, float base) {
+    for (int i = 0; i < n; ++i) {
+        q[i] += dh * w[i];
+        u[i] += push * px[i];
+        v[i] += push * pz[i];
+        float dev = h[i] - base;
+        h[i] = dev > 0.20f ? base + 0.20f : (dev < -0.20f ? base - 0.20f : h[i]);
+    }
+}
+
+// Impulses per binning chunk. Chunks are fixed, so the bins and the order
+// their sums are formed in do not depend on the thread count.
+static const size_t kSplatChunk = 8192;
+
+// Every term of addRadialImpulse is linear in the clamped dh, and the
+// height clamp is idempotent, so impulses sharing a centre cell add up
+// before the splat:
+//   - each chunk of impulses is binned on its own into a sparse list of
+//     (cell, summed dh), sorted by cell, in impulse order within a cell,
+//   - the lists are merged pairwise in a fixed tree, adding equal cells,
+//   - row bands splat the bins whose window reaches them, in cell order,
+//     writing only their own rows.
+// With tracking, bands are whole tile rows so no two bands wake one tile.
+void WaterGrid::addRadialImpulses(const float* xs, const float* zs, const float* dhs, size_t n, float radius,
+                                  float momentumScale) {
+    if (n == 0) return;
+    if (radius != splatRadius) buildSplatTable(radius);
+    const size_t chunks = (n + kSplatChunk - 1) / kSplatChunk;
+    if (splatLists.size() < chunks) splatLists.resize(chunks);
+    parallelFor(pool, 0, chunks, 1, [&](size_t cb, size_t ce) {
+        thread_local std::vector<uint64_t> keys;
+        for (size_t c = cb; c < ce; ++c) {
+            const size_t p0 = c * kSplatChunk, p1 = std::min(n, p0 + kSplatChunk);
+            keys.resize(p1 - p0);
+            for (size_t p = p0; p < p1; ++p) {
+                int i, k;
+                nearestNode(xs[p], zs[p], i, k);
+                keys[p - p0] = (static_cast<uint64_t>(idx(i, k)) << 32) | p;
+            }
+            std::sort(keys.begin(), keys.end());
+            std::vector<SplatBin>& bins = splatLists[c];
+            bins.clear();
+            for (uint64_t key : keys) {
+                const int cellId = static_cast<int>(key >> 32);
+                const float dh = std::max(-0.004f, std::min(0.004f, dhs[key & 0xffffffffu]));
+                if (!bins.empty() && bins.back().cell == cellId) bins.back().dh += dh;
+                else bins.push_back({ cellId, dh });
+            }
+        }
+    });
+    for (size_t stride = 1; stride < chunks; stride *= 2) {
+        parallelFor(pool, 0, (chunks + 2 * stride - 1) / (2 * stride), 1, [&](size_t pb, size_t pe) {
+            thread_local std::vector<SplatBin> merged;
+            for (size_t pair = pb; pair < pe; ++pair) {
+                const size_t a = 2 * stride * pair, b = a + stride;
+                if (b >= chunks) continue;
+                const std::vector<SplatBin>& la = splatLists[a];
+                const std::vector<SplatBin>& lb = splatLists[b];
+                merged.clear();
+                size_t ia = 0, ib = 0;
+                while (ia < la.size() || ib < lb.size()) {
+                    if (ib == lb.size() || (ia < la.size() && la[ia].cell < lb[ib].cell)) {
+                        merged.push_back(la[ia++]);
+                    } else if (ia == la.size() || lb[ib].cell < la[ia].cell) {
+                        merged.push_back(lb[ib++]);
+                    } else {
+                        merged.push_back({ la[ia].cell, la[ia].dh + lb[ib].dh });
+                        ++ia;
+                        ++ib;
+                    }
+                }
+                splatLists[a].swap(merged);
+            }
+        });
+    }
+
+    const std::vector<SplatBin>& bins = splatLists[0];
+    const int R = splatCells, W = 2 * R + 1;
+    size_t band = rowGrain();
+    if (activeTracking) band = (band + kActiveTile - 1) / kActiveTile * kActiveTile;
+    parallelFor(pool, 0, nz, band, [&](size_t kb0, size_t ke0) {
+        const int kb = std::max(1, (int)kb0), ke = std::min(nz - 1, (int)ke0);
+        float wide[4][64];
+        auto first = std::lower_bound(bins.begin(), bins.end(), (kb - R) * nx,
+                                      [](const SplatBin& bin, int cellId) { return bin.cell < cellId; });
+        for (auto it = first; it != bins.end() && it->cell < (ke + R) * nx; ++it) {
+            const int ic = it->cell % nx, kc = it->cell / nx;
+            const float dh = it->dh;
+            for (int k = std::max(kb, kc - R); k < std::min(ke, kc + R + 1); ++k) {
+                const int dk = k - kc, e = splatExtent[dk + R];
+                if (e < 0) continue;
+                const int i0 = std::max(1, ic - e), i1 = std::min(nx - 1, ic + e + 1);
+                if (i0 >= i1) continue;
+                const int t = (dk + R) * W + (i0 - ic + R), id = idx(i0, k);
+                if (packed) {
+                    for (int c0 = 0; c0 < i1 - i0; c0 += 64) {
+                        const int m = std::min(64, i1 - i0 - c0);
+                        codecs[kSource].decodeRow(&q16[id + c0], wide[0], m);
+                        codecs[kVelocityX].decodeRow(&u16[id + c0], wide[1], m);
+                        codecs[kVelocityZ].decodeRow(&v16[id + c0], wide[2], m);
+                        codecs[kHeight].decodeRow(&h16[id + c0], wide[3], m);
+                        splatRow(wide[0], wide[1], wide[2], wide[3], &splatWeight[t + c0], &splatPushX[t + c0],
+                                 &splatPushZ[t + c0], m, dh, dh * momentumScale, baseLevel);
+                        codecs[kSource].encodeRow(wide[0], &q16[id + c0], m);
+                        codecs[kVelocityX].encodeRow(wide[1], &u16[id + c0], m);
+                        codecs[kVelocityZ].encodeRow(wide[2], &v16[id + c0], m);
+                        codecs[kHeight].encodeRow(wide[3], &h16[id + c0], m);
+                    }
+                } else {
+                    splatRow(&q[id], &u[id], &v[id], &h[id], &splatWeight[t], &splatPushX[t], &splatPushZ[t],
+                             i1 - i0, dh, dh * momentumScale, baseLevel);
+                }
+                if (activeTracking) {
+                    for (int i = i0; i < i1; ++i) wakeTile(i, k);
+                }
+            }
+        }
+    });
+    if (packed) hViewStale = true;
 }
 
 void WaterGrid::applyBoundary() {
@@ -75,94 +358,1378 @@ void WaterGrid::applyBoundary() {
     }
 }
 
+// Rows per parallel chunk: roughly 16K cells, whatever the grid width.
+static size_t rowsPerChunk(int width) {
+    return std::max<size_t>(1, 16384 / std::max(1, width));
+}
+
+size_t WaterGrid::rowGrain() const {
+    return rowsPerChunk(nx);
+}
+
+// Column ranges of a row that lie in tiles being stepped: per tile row, a CSR
+// list of [begin, end) tile columns. Without offsets every row is one range.
+struct RowSpans {
+    const int* offsets = nullptr;
+    const int* ranges = nullptr;
+
+    template <class F>
+    void forEach(int k, int iBegin, int iEnd, F&& fn) const {
+        if (!offsets) {
+            fn(iBegin, iEnd);
+            return;
+        }
+        const int t = k / WaterGrid::kActiveTile;
+        for (int s = offsets[t]; s < offsets[t + 1]; ++s) {
+            int i0 = std::max(iBegin, ranges[2 * s] * WaterGrid::kActiveTile);
+            int i1 = std::min(iEnd, ranges[2 * s + 1] * WaterGrid::kActiveTile);
+            if (i0 < i1) fn(i0, i1);
+        }
+    }
+};
+
+static RowSpans spansOf(bool tracking, const std::vector<int>& offsets, const std::vector<int>& ranges) {
+    RowSpans spans;
+    if (tracking) {
+        spans.offsets = offsets.data();
+        spans.ranges = ranges.data();
+    }
+    return spans;
+}
+
+// Every phase below writes each cell from values the phase does not modify,
+// so splitting it into row bands gives exactly the serial result.
 void WaterGrid::diffuse(float dt) {
+    assert(!packed);
     float a = viscosity * dt / (dx * dx);
+    const RowSpans spans = spansOf(activeTracking, tileSpanOffsets, tileSpans);
     for (int it = 0; it < 10; ++it) {
-        for (int k = 1; k < nz - 1; ++k) {
-            for (int i = 1; i < nx - 1; ++i) {
-                int id = idx(i, k);
-                uTmp[id] = (u[id] + a * (u[idx(i + 1, k)] + u[idx(i - 1, k)] + u[idx(i, k + 1)] + u[idx(i, k - 1)])) / (1.0f + 4.0f * a);
-                vTmp[id] = (v[id] + a * (v[idx(i + 1, k)] + v[idx(i - 1, k)] + v[idx(i, k + 1)] + v[idx(i, k - 1)])) / (1.0f + 4.0f * a);
+        parallelFor(pool, 1, nz - 1, rowGrain(), [&](size_t kb, size_t ke) {
+            for (int k = (int)kb; k < (int)ke; ++k) {
+                spans.forEach(k, 1, nx - 1, [&](int i0, int i1) {
+                    jacobiRow(&u[idx(i0, k)], &uTmp[idx(i0, k)], i1 - i0, nx, a);
+                    jacobiRow(&v[idx(i0, k)], &vTmp[idx(i0, k)], i1 - i0, nx, a);
+                });
             }
-        }
+        });
         std::swap(u, uTmp);
         std::swap(v, vTmp);
     }
+    lastDiffusionIterations = 10;
+}
+
+// Multigrid pieces for (1 + 4a) x - a (sum of the 4 neighbours) = b on an
+// nx-by-nz array whose outer ring is a fixed boundary. A red cell only reads
+// black neighbours and vice versa, so each colour splits into row bands.
+static void smoothRedBlack(float* x, const float* b, int nx, int nz, float a, int sweeps,
+                           const RowSpans& spans, ThreadPool* pool) {
+    const float inv = 1.0f / (1.0f + 4.0f * a);
+    for (int s = 0; s < sweeps; ++s) {
+        for (int color = 0; color < 2; ++color) {
+            parallelFor(pool, 1, nz - 1, rowsPerChunk(nx), [&](size_t kb, size_t ke) {
+                for (int k = (int)kb; k < (int)ke; ++k) {
+                    spans.forEach(k, 1, nx - 1, [&](int i0, int i1) {
+                        for (int i = i0 + ((i0 + k + color) & 1); i < i1; i += 2) {
+                            int id = k * nx + i;
+                            x[id] = (b[id] + a * (x[id - 1] + x[id + 1] + x[id - nx] + x[id + nx])) * inv;
+                        }
+                    });
+                }
+            });
+        }
+    }
+}
+
+// r = b - A x on the interior; returns max |r|.
+static float computeResidual(const float* x, const float* b, float* r, int nx, int nz, float a,
+                             const RowSpans& spans, std::vector<float>& partials, ThreadPool* pool) {
+    const size_t grain = rowsPerChunk(nx);
+    partials.assign((nz + grain - 1) / grain, 0.0f);
+    parallelFor(pool, 1, nz - 1, grain, [&](size_t kb, size_t ke) {
+        float maxR = 0.0f;
+        for (int k = (int)kb; k < (int)ke; ++k) {
+            spans.forEach(k, 1, nx - 1, [&](int i0, int i1) {
+                for (int i = i0; i < i1; ++i) {
+                    int id = k * nx + i;
+                    r[id] = b[id] - (1.0f + 4.0f * a) * x[id] + a * (x[id - 1] + x[id + 1] + x[id - nx] + x[id + nx]);
+                    maxR = std::max(maxR, std::fabs(r[id]));
+                }
+            });
+        }
+        partials[(kb - 1) / grain] = maxR;
+    });
+    return *std::max_element(partials.begin(), partials.end());
+}
+
+// Coarse interior cell I covers fine interior cells 2I-1 and 2I in each
+// direction. Fine cells past the interior are border cells holding zero.
+static void restrictResidual(const float* r, int fnx, float* b, int cnx, int cnz, ThreadPool* pool) {
+    parallelFor(pool, 1, cnz - 1, rowsPerChunk(cnx), [&](size_t kb, size_t ke) {
+        for (int k = (int)kb; k < (int)ke; ++k) {
+            for (int i = 1; i < cnx - 1; ++i) {
+                const float* f = r + (2 * k - 1) * fnx + (2 * i - 1);
+                b[k * cnx + i] = 0.25f * (f[0] + f[1] + f[fnx] + f[fnx + 1]);
+            }
+        }
+    });
+}
+
+// Bilinear interpolation between coarse cell centres; the coarse border is
+// zero, matching the homogeneous boundary of the correction. Each fine row
+// first blends its two nearest coarse rows (3:1), then each coarse cell
+// feeds the two fine cells it covers. Fine cell i lies in coarse cell
+// (i + 1) / 2, and its second neighbour is on the side i is closer to.
+static void prolongAdd(const float* xc, int cnx, float* x, int fnx, int fnz, const RowSpans& spans, ThreadPool* pool) {
+    parallelFor(pool, 1, fnz - 1, rowsPerChunk(fnx), [&](size_t kb, size_t ke) {
+        thread_local std::vector<float> blend;
+        blend.resize(cnx);
+        for (int k = (int)kb; k < (int)ke; ++k) {
+            const int kc = (k + 1) / 2, kn = (k & 1) ? kc - 1 : kc + 1;
+            const float* near = xc + kc * cnx;
+            const float* far = xc + kn * cnx;
+            float* row = x + k * fnx;
+            spans.forEach(k, 1, fnx - 1, [&](int i0, int i1) {
+                for (int ic = i0 / 2; ic <= std::min(cnx - 1, i1 / 2 + 1); ++ic) {
+                    blend[ic] = 0.75f * near[ic] + 0.25f * far[ic];
+                }
+                int i = i0;
+                if (!(i & 1)) {
+                    row[i] += 0.75f * blend[i / 2] + 0.25f * blend[i / 2 + 1];
+                    ++i;
+                }
+                for (; i + 1 < i1; i += 2) {
+                    const int ic = (i + 1) / 2;
+                    row[i] += 0.75f * blend[ic] + 0.25f * blend[ic - 1];
+                    row[i + 1] += 0.75f * blend[ic] + 0.25f * blend[ic + 1];
+                }
+                if (i < i1) row[i] += 0.75f * blend[(i + 1) / 2] + 0.25f * blend[(i - 1) / 2];
+            });
+        }
+    });
+}
+
+// The coarse operator is the same equation rediscretised: a scales with
+// 1/dx^2, so it drops by 4 per level.
+void WaterGrid::vCycle(size_t level, float* x, const float* b, float a) {
+    MultigridLevel& L = levels[level];
+    const RowSpans spans = spansOf(activeTracking && level == 0, tileSpanOffsets, tileSpans);
+    if (level + 1 == levels.size()) {
+        smoothRedBlack(x, b, L.nx, L.nz, a, 16, spans, pool);
+        return;
+    }
+    MultigridLevel& C = levels[level + 1];
+    smoothRedBlack(x, b, L.nx, L.nz, a, 2, spans, pool);
+    computeResidual(x, b, L.r.data(), L.nx, L.nz, a, spans, partials, pool);
+    restrictResidual(L.r.data(), L.nx, C.b.data(), C.nx, C.nz, pool);
+    std::fill(C.x.begin(), C.x.end(), 0.0f);
+    vCycle(level + 1, C.x.data(), C.b.data(), 0.25f * a);
+    prolongAdd(C.x.data(), C.nx, x, L.nx, L.nz, spans, pool);
+    smoothRedBlack(x, b, L.nx, L.nz, a, 2, spans, pool);
+}
+
+int WaterGrid::solveMultigrid(float* x, const float* b, float a, float tolerance, int maxCycles) {
+    const size_t grain = rowGrain();
+    const RowSpans spans = spansOf(activeTracking, tileSpanOffsets, tileSpans);
+    partials.assign((nz + grain - 1) / grain, 0.0f);
+    parallelFor(pool, 1, nz - 1, grain, [&](size_t kb, size_t ke) {
+        float maxB = 0.0f;
+        for (int k = (int)kb; k < (int)ke; ++k) {
+            spans.forEach(k, 1, nx - 1, [&](int i0, int i1) {
+                for (int i = i0; i < i1; ++i) maxB = std::max(maxB, std::fabs(b[idx(i, k)]));
+            });
+        }
+        partials[(kb - 1) / grain] = maxB;
+    });
+    const float limit = tolerance * *std::max_element(partials.begin(), partials.end());
+
+    MultigridLevel& top = levels.front();
+    float residual = computeResidual(x, b, top.r.data(), nx, nz, a, spans, partials, pool);
+    int cycles = 0;
+    while (cycles < maxCycles && residual > limit) {
+        vCycle(0, x, b, a);
+        const float previous = residual;
+        residual = computeResidual(x, b, top.r.data(), nx, nz, a, spans, partials, pool);
+        ++cycles;
+        // With a large a the float residual bottoms out above the tolerance;
+        // stop once a cycle no longer halves it.
+        if (residual > 0.5f * previous) break;
+    }
+    return cycles;
+}
+
+void WaterGrid::buildMultigridLevels() {
+    if (!levels.empty() && levels.front().nx == nx && levels.front().nz == nz) return;
+    levels.clear();
+    levels.push_back({ nx, nz, {}, {}, std::vector<float>(nx * nz, 0.0f) });
+    int ix = nx - 2, iz = nz - 2;
+    while (std::min(ix, iz) > 4) {
+        ix = (ix + 1) / 2;
+        iz = (iz + 1) / 2;
+        const size_t cells = static_cast<size_t>(ix + 2) * (iz + 2);
+        levels.push_back({ ix + 2, iz + 2, std::vector<float>(cells, 0.0f), std::vector<float>(cells, 0.0f),
+                           std::vector<float>(cells, 0.0f) });
+    }
+}
+
+// u and v are solved in place with their old values as the right-hand side
+// (held in uTmp/vTmp) and as the initial guess. Border cells stay fixed.
+void WaterGrid::diffuseMultigrid(float dt) {
+    buildMultigridLevels();
+    const float a = viscosity * dt / (dx * dx);
+    const RowSpans spans = spansOf(activeTracking, tileSpanOffsets, tileSpans);
+    parallelFor(pool, 0, nz, rowGrain(), [&](size_t kb, size_t ke) {
+        for (int k = (int)kb; k < (int)ke; ++k) {
+            spans.forEach(k, 0, nx, [&](int i0, int i1) {
+                std::copy(&u[idx(i0, k)], &u[idx(i1, k)], &uTmp[idx(i0, k)]);
+                std::copy(&v[idx(i0, k)], &v[idx(i1, k)], &vTmp[idx(i0, k)]);
+            });
+        }
+    });
+    const int cu = solveMultigrid(u.data(), uTmp.data(), a, diffusionTolerance, maxDiffusionCycles);
+    const int cv = solveMultigrid(v.data(), vTmp.data(), a, diffusionTolerance, maxDiffusionCycles);
+    lastDiffusionIterations = std::max(cu, cv);
 }
 
 void WaterGrid::advect(float dt) {
-    for (int k = 1; k < nz - 1; ++k) {
-        for (int i = 1; i < nx - 1; ++i) {
-            int id = idx(i, k);
-            float x = i - u[id] * dt / dx;
-            float z = k - v[id] * dt / dx;
-            x = std::clamp(x, 1.0f, (float)nx - 2);
-            z = std::clamp(z, 1.0f, (float)nz - 2);
-            int i0 = (int)x, k0 = (int)z;
-            uTmp[id] = u[idx(i0, k0)];
-            vTmp[id] = v[idx(i0, k0)];
-            hTmp[id] = h[idx(i0, k0)];
+    if (packed) {
+        advectPacked(dt);
+        return;
+    }
+    if (advectionScheme != AdvectionScheme::Nearest) {
+        advectSemiLagrangian(dt);
+        return;
+    }
+    const RowSpans spans = spansOf(activeTracking, tileSpanOffsets, tileSpans);
+    parallelFor(pool, 1, nz - 1, rowGrain(), [&](size_t kb, size_t ke) {
+        for (int k = (int)kb; k < (int)ke; ++k) {
+            spans.forEach(k, 1, nx - 1, [&](int ib, int ie) {
+                for (int i = ib; i < ie; ++i) {
+                    int id = idx(i, k);
+                    float x = i - u[id] * dt / dx;
+                    float z = k - v[id] * dt / dx;
+                    x = std::clamp(x, 1.0f, (float)nx - 2);
+                    z = std::clamp(z, 1.0f, (float)nz - 2);
+                    int i0 = (int)x, k0 = (int)z;
+                    uTmp[id] = u[idx(i0, k0)];
+                    vTmp[id] = v[idx(i0, k0)];
+                    hTmp[id] = h[idx(i0, k0)];
+                }
+            });
+        }
+    });
+    std::swap(u, uTmp);
+    std::swap(v, vTmp);
+    std::swap(h, hTmp);
+}
+
+// Semi-Lagrangian sampling. A trace point is clamped to the interior, so
+// its (i0, k0) corner is at most (nx-2, nz-2) and all four corners are
+// inside the array. The point is i0 + fx, k0 + fz.
+struct BilinearPoint {
+    int id;
+    float fx, fz;
+};
+
+static inline BilinearPoint bilinearPoint(float x, float z, int nx, int nz) {
+    x = std::min(std::max(x, 1.0f), (float)nx - 2);
+    z = std::min(std::max(z, 1.0f), (float)nz - 2);
+    int i0 = (int)x, k0 = (int)z;
+    return { k0 * nx + i0, x - i0, z - k0 };
+}
+
+static inline float bilinear(const float* f, const BilinearPoint& p, int nx) {
+    const float* c = f + p.id;
+    float a = c[0] + p.fx * (c[1] - c[0]);
+    float b = c[nx] + p.fx * (c[nx + 1] - c[nx]);
+    return a + p.fz * (b - a);
+}
+
+// MacCormack: fwd holds the semi-Lagrangian result, back is fwd traced
+// forward again, so old - back estimates the error of one trace. Half of it
+// is added back, clamped to the corners the backward trace read from old so
+// the correction cannot create new extrema (Selle et al. 2008).
+static inline float macCormack(const float* old, const float* fwd, int id, float back,
+                               const BilinearPoint& p, int nx) {
+    const float* c = old + p.id;
+    float lo = std::min(std::min(c[0], c[1]), std::min(c[nx], c[nx + 1]));
+    float hi = std::max(std::max(c[0], c[1]), std::max(c[nx], c[nx + 1]));
+    return std::min(std::max(fwd[id] + 0.5f * (old[id] - back), lo), hi);
+}
+
+#if defined(WATER_SIMD_AVX2)
+struct BilinearPoint8 {
+    __m256i id;
+    __m256 fx, fz;
+};
+
+static inline BilinearPoint8 bilinearPoint8(__m256 x, __m256 z, int nx, int nz) {
+    x = _mm256_min_ps(_mm256_max_ps(x, _mm256_set1_ps(1.0f)), _mm256_set1_ps((float)nx - 2));
+    z = _mm256_min_ps(_mm256_max_ps(z, _mm256_set1_ps(1.0f)), _mm256_set1_ps((float)nz - 2));
+    __m256 x0 = _mm256_floor_ps(x), z0 = _mm256_floor_ps(z);
+    __m256i id = _mm256_add_epi32(_mm256_mullo_epi32(_mm256_cvttps_epi32(z0), _mm256_set1_epi32(nx)),
+                                  _mm256_cvttps_epi32(x0));
+    return { id, _mm256_sub_ps(x, x0), _mm256_sub_ps(z, z0) };
+}
+
+struct Corners8 {
+    __m256 c00, c10, c01, c11;
+};
+
+static inline Corners8 corners8(const float* f, const BilinearPoint8& p, int nx) {
+    return { _mm256_i32gather_ps(f, p.id, 4), _mm256_i32gather_ps(f + 1, p.id, 4),
+             _mm256_i32gather_ps(f + nx, p.id, 4), _mm256_i32gather_ps(f + nx + 1, p.id, 4) };
+}
+
+static inline __m256 bilinear8(const Corners8& c, const BilinearPoint8& p) {
+    __m256 a = _mm256_add_ps(c.c00, _mm256_mul_ps(p.fx, _mm256_sub_ps(c.c10, c.c00)));
+    __m256 b = _mm256_add_ps(c.c01, _mm256_mul_ps(p.fx, _mm256_sub_ps(c.c11, c.c01)));
+    return _mm256_add_ps(a, _mm256_mul_ps(p.fz, _mm256_sub_ps(b, a)));
+}
+
+// Eight 16-bit cells in the low halves of 32-bit lanes. The arrays carry a
+// padding element, so the high half of the last cell's lane is in bounds.
+static inline __m256i gather16(const uint16_t* f, __m256i id) {
+    return _mm256_i32gather_epi32(reinterpret_cast<const int*>(f), id, 2);
+}
+
+// Widens gathered lanes as FieldCodec::decode does; half lanes need F16C.
+static inline __m256 widenLanes(__m256i lanes, bool half, float offset, float scale) {
+#if defined(__F16C__)
+    if (half) {
+        __m256i m = _mm256_and_si256(lanes, _mm256_set1_epi32(0xffff));
+        m = _mm256_permute4x64_epi64(_mm256_packus_epi32(m, m), 0x08);
+        return _mm256_add_ps(_mm256_cvtph_ps(_mm256_castsi256_si128(m)), _mm256_set1_ps(offset));
+    }
+#endif
+    (void)half;
+    __m256 x = _mm256_cvtepi32_ps(_mm256_srai_epi32(_mm256_slli_epi32(lanes, 16), 16));
+    return _mm256_add_ps(_mm256_set1_ps(offset), _mm256_mul_ps(_mm256_set1_ps(scale), x));
+}
+#endif
+
+// Cells [i0, i1) of row k: dst = src sampled at (i, k) - scale * (u, v).
+static void semiLagrangianRow(const float* u, const float* v, const float* const* src, float* const* dst,
+                              int k, int i0, int i1, int nx, int nz, float scale) {
+    const int row = k * nx;
+    int i = i0;
+#if defined(WATER_SIMD_AVX2)
+    const __m256 vScale = _mm256_set1_ps(scale);
+    const __m256 vk = _mm256_set1_ps((float)k);
+    const __m256 lane = _mm256_setr_ps(0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f);
+    for (; i + 8 <= i1; i += 8) {
+        __m256 x = _mm256_sub_ps(_mm256_add_ps(_mm256_set1_ps((float)i), lane),
+                                 _mm256_mul_ps(_mm256_loadu_ps(u + row + i), vScale));
+        __m256 z = _mm256_sub_ps(vk, _mm256_mul_ps(_mm256_loadu_ps(v + row + i), vScale));
+        BilinearPoint8 p = bilinearPoint8(x, z, nx, nz);
+        for (int f = 0; f < 3; ++f) _mm256_storeu_ps(dst[f] + row + i, bilinear8(corners8(src[f], p, nx), p));
+    }
+#endif
+    for (; i < i1; ++i) {
+        int id = row + i;
+        BilinearPoint p = bilinearPoint(i - u[id] * scale, k - v[id] * scale, nx, nz);
+        for (int f = 0; f < 3; ++f) dst[f][id] = bilinear(src[f], p, nx);
+    }
+}
+
+// Cells [i0, i1) of row k: the limited MacCormack correction of fwd into out.
+static void macCormackRow(const float* u, const float* v, const float* const* old, const float* const* fwd,
+                          float* const* out, int k, int i0, int i1, int nx, int nz, float scale) {
+    const int row = k * nx;
+    int i = i0;
+#if defined(WATER_SIMD_AVX2)
+    const __m256 vScale = _mm256_set1_ps(scale);
+    const __m256 vk = _mm256_set1_ps((float)k);
+    const __m256 lane = _mm256_setr_ps(0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f);
+    const __m256 half = _mm256_set1_ps(0.5f);
+    for (; i + 8 <= i1; i += 8) {
+        __m256 x = _mm256_add_ps(_mm256_set1_ps((float)i), lane);
+        __m256 du = _mm256_mul_ps(_mm256_loadu_ps(u + row + i), vScale);
+        __m256 dv = _mm256_mul_ps(_mm256_loadu_ps(v + row + i), vScale);
+        BilinearPoint8 pb = bilinearPoint8(_mm256_sub_ps(x, du), _mm256_sub_ps(vk, dv), nx, nz);
+        BilinearPoint8 pf = bilinearPoint8(_mm256_add_ps(x, du), _mm256_add_ps(vk, dv), nx, nz);
+        for (int f = 0; f < 3; ++f) {
+            __m256 back = bilinear8(corners8(fwd[f], pf, nx), pf);
+            Corners8 c = corners8(old[f], pb, nx);
+            __m256 lo = _mm256_min_ps(_mm256_min_ps(c.c00, c.c10), _mm256_min_ps(c.c01, c.c11));
+            __m256 hi = _mm256_max_ps(_mm256_max_ps(c.c00, c.c10), _mm256_max_ps(c.c01, c.c11));
+            __m256 r = _mm256_add_ps(_mm256_loadu_ps(fwd[f] + row + i),
+                                     _mm256_mul_ps(half, _mm256_sub_ps(_mm256_loadu_ps(old[f] + row + i), back)));
+            _mm256_storeu_ps(out[f] + row + i, _mm256_min_ps(_mm256_max_ps(r, lo), hi));
         }
     }
+#endif
+    for (; i < i1; ++i) {
+        int id = row + i;
+        BilinearPoint pb = bilinearPoint(i - u[id] * scale, k - v[id] * scale, nx, nz);
+        BilinearPoint pf = bilinearPoint(i + u[id] * scale, k + v[id] * scale, nx, nz);
+        for (int f = 0; f < 3; ++f) out[f][id] = macCormack(old[f], fwd[f], id, bilinear(fwd[f], pf, nx), pb, nx);
+    }
+}
+
+// Bilinear pass into the Tmp arrays; MacCormack then corrects it into the
+// Back arrays, whose border takes the Tmp border so every scheme leaves the
+// same boundary behind.
+void WaterGrid::advectSemiLagrangian(float dt) {
+    const float scale = dt / dx;
+    const float* old[3] = { u.data(), v.data(), h.data() };
+    float* fwd[3] = { uTmp.data(), vTmp.data(), hTmp.data() };
+    const RowSpans spans = spansOf(activeTracking, tileSpanOffsets, tileSpans);
+    parallelFor(pool, 1, nz - 1, rowGrain(), [&](size_t kb, size_t ke) {
+        for (int k = (int)kb; k < (int)ke; ++k) {
+            spans.forEach(k, 1, nx - 1, [&](int i0, int i1) {
+                semiLagrangianRow(u.data(), v.data(), old, fwd, k, i0, i1, nx, nz, scale);
+            });
+        }
+    });
+
+    if (advectionScheme == AdvectionScheme::MacCormack) {
+        if (hBack.empty()) {
+            uBack.assign(h.size(), 0.0f);
+            vBack.assign(h.size(), 0.0f);
+            hBack.assign(h.size(), baseLevel);
+        }
+        float* out[3] = { uBack.data(), vBack.data(), hBack.data() };
+        parallelFor(pool, 0, nz, rowGrain(), [&](size_t kb, size_t ke) {
+            for (int k = (int)kb; k < (int)ke; ++k) {
+                for (int f = 0; f < 3; ++f) {
+                    if (k == 0 || k == nz - 1) {
+                        std::copy(fwd[f] + k * nx, fwd[f] + (k + 1) * nx, out[f] + k * nx);
+                    } else {
+                        out[f][k * nx] = fwd[f][k * nx];
+                        out[f][k * nx + nx - 1] = fwd[f][k * nx + nx - 1];
+                    }
+                }
+                if (k == 0 || k == nz - 1) continue;
+                spans.forEach(k, 1, nx - 1, [&](int i0, int i1) {
+                    macCormackRow(u.data(), v.data(), old, fwd, out, k, i0, i1, nx, nz, scale);
+                });
+            }
+        });
+        std::swap(uTmp, uBack);
+        std::swap(vTmp, vBack);
+        std::swap(hTmp, hBack);
+    }
     std::swap(u, uTmp);
     std::swap(v, vTmp);
     std::swap(h, hTmp);
 }
 
+// advect on the 16-bit fields. Nearest copies the stored bits and adds no
+// rounding; Bilinear interpolates widened corners and narrows the result.
+void WaterGrid::advectPacked(float dt) {
+    const float scale = dt / dx;
+    const uint16_t* src[3] = { u16.data(), v16.data(), h16.data() };
+    uint16_t* dst[3] = { u16Tmp.data(), v16Tmp.data(), h16Tmp.data() };
+    const FieldCodec* codec[3] = { &codecs[kVelocityX], &codecs[kVelocityZ], &codecs[kHeight] };
+    parallelFor(pool, 1, nz - 1, rowGrain(), [&](size_t kb, size_t ke) {
+        thread_local std::vector<float> rows;
+        rows.resize(5 * static_cast<size_t>(nx));
+        float* ur = rows.data();
+        float* vr = ur + nx;
+        float* out[3] = { vr + nx, vr + 2 * nx, vr + 3 * nx };
+        for (int k = (int)kb; k < (int)ke; ++k) {
+            codecs[kVelocityX].decodeRow(&u16[idx(0, k)], ur, nx);
+            codecs[kVelocityZ].decodeRow(&v16[idx(0, k)], vr, nx);
+            if (advectionScheme == AdvectionScheme::Nearest) {
+                for (int i = 1; i < nx - 1; ++i) {
+                    float x = i - ur[i] * dt / dx;
+                    float z = k - vr[i] * dt / dx;
+                    x = std::clamp(x, 1.0f, (float)nx - 2);
+                    z = std::clamp(z, 1.0f, (float)nz - 2);
+                    const int from = idx((int)x, (int)z);
+                    for (int f = 0; f < 3; ++f) dst[f][idx(i, k)] = src[f][from];
+                }
+                continue;
+            }
+            int i = 1;
+#if defined(WATER_SIMD_AVX2)
+#if defined(__F16C__)
+            const bool lanes = true;
+#else
+            const bool lanes = !codecs[kHeight].half;
+#endif
+            const __m256 vScale = _mm256_set1_ps(scale);
+            const __m256 vk = _mm256_set1_ps((float)k);
+            const __m256 lane = _mm256_setr_ps(0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f);
+            for (; lanes && i + 8 <= nx - 1; i += 8) {
+                __m256 x = _mm256_sub_ps(_mm256_add_ps(_mm256_set1_ps((float)i), lane),
+                                         _mm256_mul_ps(_mm256_loadu_ps(ur + i), vScale));
+                __m256 z = _mm256_sub_ps(vk, _mm256_mul_ps(_mm256_loadu_ps(vr + i), vScale));
+                BilinearPoint8 p = bilinearPoint8(x, z, nx, nz);
+                for (int f = 0; f < 3; ++f) {
+                    const FieldCodec& c = *codec[f];
+                    Corners8 cs = { widenLanes(gather16(src[f], p.id), c.half, c.offset, c.scale),
+                                    widenLanes(gather16(src[f] + 1, p.id), c.half, c.offset, c.scale),
+                                    widenLanes(gather16(src[f] + nx, p.id), c.half, c.offset, c.scale),
+                                    widenLanes(gather16(src[f] + nx + 1, p.id), c.half, c.offset, c.scale) };
+                    _mm256_storeu_ps(out[f] + i, bilinear8(cs, p));
+                }
+            }
+#endif
+            for (; i < nx - 1; ++i) {
+                BilinearPoint p = bilinearPoint(i - ur[i] * scale, k - vr[i] * scale, nx, nz);
+                for (int f = 0; f < 3; ++f) {
+                    const uint16_t* c = src[f] + p.id;
+                    const FieldCodec& d = *codec[f];
+                    float a = d.decode(c[0]) + p.fx * (d.decode(c[1]) - d.decode(c[0]));
+                    float b = d.decode(c[nx]) + p.fx * (d.decode(c[nx + 1]) - d.decode(c[nx]));
+                    out[f][i] = a + p.fz * (b - a);
+                }
+            }
+            for (int f = 0; f < 3; ++f) codec[f]->encodeRow(out[f] + 1, dst[f] + idx(1, k), nx - 2);
+        }
+    });
+    std::swap(u16, u16Tmp);
+    std::swap(v16, v16Tmp);
+    std::swap(h16, h16Tmp);
+}
+
+void WaterGrid::sampleHeights(const float* xs, const float* zs, float* out, size_t n) const {
+    const Field fields[] = { kHeight };
+    sampleBlended(xs, zs, n, fields, &out, 1);
+}
+
+void WaterGrid::sampleVelocities(const float* xs, const float* zs, float* us, float* vs, size_t n) const {
+    const Field fields[] = { kVelocityX, kVelocityZ };
+    float* out[] = { us, vs };
+    sampleBlended(xs, zs, n, fields, out, 2);
+}
+
+// Bilinear weights do not depend on the values, so blending the samples of
+// the two states is sampling the blended state.
+void WaterGrid::sampleBlended(const float* xs, const float* zs, size_t n, const Field* fields, float* const* out,
+                              int count) const {
+    sampleBilinear(xs, zs, n, fields, out, count, false);
+    if (!previousValid || sampleBlend >= 1.0f) return;
+    thread_local std::vector<float> saved;
+    saved.resize(count * n);
+    assert(count <= 3);
+    float* to[3] = {};
+    for (int f = 0; f < count; ++f) to[f] = saved.data() + f * n;
+    sampleBilinear(xs, zs, n, fields, to, count, true);
+    const float a = sampleBlend;
+    for (int f = 0; f < count; ++f) {
+        for (size_t p = 0; p < n; ++p) out[f][p] = to[f][p] + a * (out[f][p] - to[f][p]);
+    }
+}
+
+void WaterGrid::setKeepPreviousState(bool keep) {
+    keepPrevious = keep;
+    if (keep) return;
+    previousValid = false;
+    for (auto* a : { &prevH, &prevU, &prevV }) std::vector<float>().swap(*a);
+}
+
+void WaterGrid::savePreviousState() {
+    const Field fields[] = { kHeight, kVelocityX, kVelocityZ };
+    const std::vector<float>* wide[] = { &h, &u, &v };
+    const std::vector<uint16_t>* narrow[] = { &h16, &u16, &v16 };
+    std::vector<float>* to[] = { &prevH, &prevU, &prevV };
+    for (int f = 0; f < 3; ++f) {
+        to[f]->resize(static_cast<size_t>(nx) * nz);
+        parallelFor(pool, 0, nz, rowGrain(), [&](size_t kb, size_t ke) {
+            float* dst = to[f]->data() + kb * nx;
+            const int m = (int)(ke - kb) * nx;
+            if (packed) codecs[fields[f]].decodeRow(narrow[f]->data() + kb * nx, dst, m);
+            else std::copy(wide[f]->data() + kb * nx, wide[f]->data() + kb * nx + m, dst);
+        });
+    }
+    previousValid = true;
+}
+
+// The lower corner (i0, k0) stops at (nx-2, nz-2), so all four corners are
+// in the grid and the weights reach 1 at the far edge.
+void WaterGrid::sampleBilinear(const float* xs, const float* zs, size_t n, const Field* fields, float* const* out,
+                               int count, bool previous) const {
+    const std::vector<float>* wide[] = { previous ? &prevH : &h, previous ? &prevU : &u, previous ? &prevV : &v, &q };
+    const std::vector<uint16_t>* narrow[] = { &h16, &u16, &v16, &q16 };
+    const bool narrowFields = packed && !previous;
+    const int i0Max = std::max(0, nx - 2), k0Max = std::max(0, nz - 2);
+    const int cx = std::min(1, nx - 1), cz = std::min(1, nz - 1) * nx;
+    size_t p = 0;
+#if defined(WATER_SIMD_AVX2)
+#if defined(__F16C__)
+    const bool lanes = true;
+#else
+    const bool lanes = !narrowFields || !codecs[kHeight].half;
+#endif
+    const __m256 ox = _mm256_set1_ps(origin.x), oz = _mm256_set1_ps(origin.z), vdx = _mm256_set1_ps(dx);
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 xMax = _mm256_set1_ps((float)(nx - 1)), zMax = _mm256_set1_ps((float)(nz - 1));
+    for (; lanes && p + 8 <= n; p += 8) {
+        __m256 x = _mm256_div_ps(_mm256_sub_ps(_mm256_loadu_ps(xs + p), ox), vdx);
+        __m256 z = _mm256_div_ps(_mm256_sub_ps(_mm256_loadu_ps(zs + p), oz), vdx);
+        x = _mm256_min_ps(_mm256_max_ps(x, zero), xMax);
+        z = _mm256_min_ps(_mm256_max_ps(z, zero), zMax);
+        __m256i i0 = _mm256_min_epi32(_mm256_cvttps_epi32(x), _mm256_set1_epi32(i0Max));
+        __m256i k0 = _mm256_min_epi32(_mm256_cvttps_epi32(z), _mm256_set1_epi32(k0Max));
+        BilinearPoint8 b = { _mm256_add_epi32(_mm256_mullo_epi32(k0, _mm256_set1_epi32(nx)), i0),
+                             _mm256_sub_ps(x, _mm256_cvtepi32_ps(i0)), _mm256_sub_ps(z, _mm256_cvtepi32_ps(k0)) };
+        for (int f = 0; f < count; ++f) {
+            Corners8 c;
+            if (narrowFields) {
+                const uint16_t* a = narrow[fields[f]]->data();
+                const FieldCodec& d = codecs[fields[f]];
+                c = { widenLanes(gather16(a, b.id), d.half, d.offset, d.scale),
+                      widenLanes(gather16(a + cx, b.id), d.half, d.offset, d.scale),
+                      widenLanes(gather16(a + cz, b.id), d.half, d.offset, d.scale),
+                      widenLanes(gather16(a + cz + cx, b.id), d.half, d.offset, d.scale) };
+            } else {
+                const float* a = wide[fields[f]]->data();
+                c = { _mm256_i32gather_ps(a, b.id, 4), _mm256_i32gather_ps(a + cx, b.id, 4),
+                      _mm256_i32gather_ps(a + cz, b.id, 4), _mm256_i32gather_ps(a + cz + cx, b.id, 4) };
+            }
+            _mm256_storeu_ps(out[f] + p, bilinear8(c, b));
+        }
+    }
+#endif
+    for (; p < n; ++p) {
+        float x = std::min(std::max((xs[p] - origin.x) / dx, 0.0f), (float)(nx - 1));
+        float z = std::min(std::max((zs[p] - origin.z) / dx, 0.0f), (float)(nz - 1));
+        int i0 = std::min((int)x, i0Max), k0 = std::min((int)z, k0Max);
+        const int id = idx(i0, k0);
+        const float tx = x - i0, tz = z - k0;
+        for (int f = 0; f < count; ++f) {
+            float c[4];
+            const int at[4] = { id, id + cx, id + cz, id + cz + cx };
+            for (int j = 0; j < 4; ++j) {
+                c[j] = narrowFields ? codecs[fields[f]].decode((*narrow[fields[f]])[at[j]]) : (*wide[fields[f]])[at[j]];
+            }
+            float a = c[0] + tx * (c[1] - c[0]);
+            float b = c[2] + tx * (c[3] - c[2]);
+            out[f][p] = a + tz * (b - a);
+        }
+    }
+}
+
 void WaterGrid::project(float dt) {
-    for (int k = 1; k < nz - 1; ++k) {
-        for (int i = 1; i < nx - 1; ++i) {
-            int id = idx(i, k);
-            float dhdx = (h[idx(i + 1, k)] - h[idx(i - 1, k)]) / (2.0f * dx);
-            float dhdz = (h[idx(i, k + 1)] - h[idx(i, k - 1)]) / (2.0f * dx);
-            u[id] += -gravity * dhdx * dt;
-            v[id] += -gravity * dhdz * dt;
+    const RowSpans spans = spansOf(activeTracking, tileSpanOffsets, tileSpans);
+    parallelFor(pool, 1, nz - 1, rowGrain(), [&](size_t kb, size_t ke) {
+        for (int k = (int)kb; k < (int)ke; ++k) {
+            spans.forEach(k, 1, nx - 1, [&](int i0, int i1) {
+                for (int i = i0; i < i1; ++i) {
+                    int id = idx(i, k);
+                    float dhdx = (h[idx(i + 1, k)] - h[idx(i - 1, k)]) / (2.0f * dx);
+                    float dhdz = (h[idx(i, k + 1)] - h[idx(i, k - 1)]) / (2.0f * dx);
+                    u[id] += -gravity * dhdx * dt;
+                    v[id] += -gravity * dhdz * dt;
+                }
+            });
         }
+    });
+}
+
+// Semi-implicit gravity waves (Casulli 1990), linearised about the rest
+// depth H. The free surface eta = h - baseLevel solves
+//   eta' - g H dt^2 lap(eta') = eta - dt H div(u)
+// with the diffusion multigrid, a = g H dt^2 / dx^2, and the velocity then
+// takes the gradient of eta'. The solve is for the change d = eta' - eta,
+// whose right-hand side -dt H div(u) + a lap(h) is zero wherever the water
+// is at rest. Border cells keep their height, as in every other phase. No
+// term is bounded by the wave speed, so the step is only limited by the flow.
+void WaterGrid::solveWaves(float dt) {
+    buildMultigridLevels();
+    MultigridLevel& top = levels.front();
+    if (top.x.empty()) {
+        top.x.assign(h.size(), 0.0f);
+        top.b.assign(h.size(), 0.0f);
     }
+    const float depth = std::max(0.0f, baseLevel - bedLevel);
+    const float a = gravity * depth * dt * dt / (dx * dx);
+    const float divScale = dt * depth / (2.0f * dx);
+    const float gradScale = gravity * dt / (2.0f * dx);
+    const RowSpans spans = spansOf(activeTracking, tileSpanOffsets, tileSpans);
+    float* d = top.x.data();
+    float* rhs = top.b.data();
+
+    parallelFor(pool, 1, nz - 1, rowGrain(), [&](size_t kb, size_t ke) {
+        for (int k = (int)kb; k < (int)ke; ++k) {
+            spans.forEach(k, 1, nx - 1, [&](int i0, int i1) {
+                for (int id = idx(i0, k); id < idx(i1, k); ++id) {
+                    float div = u[id + 1] - u[id - 1] + v[id + nx] - v[id - nx];
+                    float lap = h[id - 1] + h[id + 1] + h[id - nx] + h[id + nx] - 4.0f * h[id];
+                    rhs[id] = a * lap - divScale * div;
+                    d[id] = 0.0f;
+                }
+            });
+        }
+    });
+    lastWaveIterations = solveMultigrid(d, rhs, a, waveTolerance, maxWaveCycles);
+
+    parallelFor(pool, 1, nz - 1, rowGrain(), [&](size_t kb, size_t ke) {
+        for (int k = (int)kb; k < (int)ke; ++k) {
+            spans.forEach(k, 1, nx - 1, [&](int i0, int i1) {
+                for (int id = idx(i0, k); id < idx(i1, k); ++id) h[id] += d[id];
+            });
+        }
+    });
+    parallelFor(pool, 1, nz - 1, rowGrain(), [&](size_t kb, size_t ke) {
+        for (int k = (int)kb; k < (int)ke; ++k) {
+            spans.forEach(k, 1, nx - 1, [&](int i0, int i1) {
+                for (int id = idx(i0, k); id < idx(i1, k); ++id) {
+                    u[id] -= gradScale * (h[id + 1] - h[id - 1]);
+                    v[id] -= gradScale * (h[id + nx] - h[id - nx]);
+                }
+            });
+        }
+    });
+}
+
+// Source injection, height damping and the velocity clamp are all pointwise,
+// so they share one pass. The clamp used to follow applyBoundary, which only
+// zeroes boundary velocities, so the order change does not alter results.
+void WaterGrid::applySources(float dt) {
+    const float damp = std::pow(waveDamping, dt / kReferenceStep);
+    const float maxSpeed = 1.8f;
+    const RowSpans spans = spansOf(activeTracking, tileSpanOffsets, tileSpans);
+    parallelFor(pool, 0, nz, rowGrain(), [&](size_t kb, size_t ke) {
+        for (int k = (int)kb; k < (int)ke; ++k) {
+            spans.forEach(k, 0, nx, [&](int i0, int i1) {
+                for (int id = idx(i0, k); id < idx(i1, k); ++id) {
+                    h[id] += q[id] * 0.9f;
+                    q[id] = 0.0f;
+                    h[id] = baseLevel + (h[id] - baseLevel) * damp;
+                    if (u[id] > maxSpeed) u[id] = maxSpeed; else if (u[id] < -maxSpeed) u[id] = -maxSpeed;
+                    if (v[id] > maxSpeed) v[id] = maxSpeed; else if (v[id] < -maxSpeed) v[id] = -maxSpeed;
+                }
+            });
+        }
+    });
 }
 
-void WaterGrid::addHeightDamping(float dt) {
-    float damp = 0.998f;
-    for (int id = 0; id < nx * nz; ++id) {
-        h[id] = baseLevel + (h[id] - baseLevel) * damp;
+void WaterGrid::smoothHeights(float alpha) {
+    const RowSpans spans = spansOf(activeTracking, tileSpanOffsets, tileSpans);
+    parallelFor(pool, 1, nz - 1, rowGrain(), [&](size_t kb, size_t ke) {
+        for (int k = (int)kb; k < (int)ke; ++k) {
+            spans.forEach(k, 1, nx - 1, [&](int i0, int i1) {
+                for (int i = i0; i < i1; ++i) {
+                    int id = k * nx + i;
+                    float lap = h[id - 1] + h[id + 1] + h[id - nx] + h[id + nx] - 4.0f * h[id];
+                    hTmp[id] = h[id] + alpha * lap;
+                }
+            });
+        }
+    });
+    parallelFor(pool, 1, nz - 1, rowGrain(), [&](size_t kb, size_t ke) {
+        for (int k = (int)kb; k < (int)ke; ++k) {
+            spans.forEach(k, 1, nx - 1, [&](int i0, int i1) {
+                for (int i = i0; i < i1; ++i) {
+                    int id = k * nx + i;
+                    h[id] = hTmp[id];
+                }
+            });
+        }
+    });
+}
+
+// Each tile runs kDiffuseBlock Jacobi sweeps over itself plus a halo that
+// wide. The updated region shrinks by one cell per sweep on every side cut by
+// the halo, so the last sweep covers exactly the tile. The first sweep reads
+// u and v directly and the last writes uTmp and vTmp, so only the sweeps in
+// between touch the tile-local buffers. Sides on the grid border stay fixed,
+// as in diffuse(); the local buffers take those cells from u and v.
+void WaterGrid::diffuseTiled(float dt) {
+    const float a = viscosity * dt / (dx * dx);
+    const int tilesX = (nx + kTileX - 1) / kTileX;
+    const int tilesZ = (nz + kTileZ - 1) / kTileZ;
+
+    for (int done = 0; done < 10; done += kDiffuseBlock) {
+        const int depth = std::min(static_cast<int>(kDiffuseBlock), 10 - done);
+        parallelFor(pool, 0, static_cast<size_t>(tilesX) * tilesZ, 1, [&](size_t tb, size_t te) {
+            thread_local std::vector<float> buf;
+            for (size_t t = tb; t < te; ++t) {
+                const int x0 = static_cast<int>(t % tilesX) * kTileX, x1 = std::min(nx, x0 + kTileX);
+                const int z0 = static_cast<int>(t / tilesX) * kTileZ, z1 = std::min(nz, z0 + kTileZ);
+                const int rx0 = std::max(0, x0 - depth), rx1 = std::min(nx, x1 + depth);
+                const int rz0 = std::max(0, z0 - depth), rz1 = std::min(nz, z1 + depth);
+                const int w = rx1 - rx0, n = w * (rz1 - rz0);
+                buf.resize(4 * static_cast<size_t>(n));
+                float* local[2][2] = { { buf.data(), buf.data() + n }, { buf.data() + 2 * n, buf.data() + 3 * n } };
+
+                // Packed fields are widened into the first buffer and
+                // every sweep runs tile-local; the second buffer needs the
+                // fixed boundary cells as well.
+                if (packed) {
+                    for (int k = rz0; k < rz1; ++k) {
+                        const int l = (k - rz0) * w;
+                        codecs[kVelocityX].decodeRow(&u16[idx(rx0, k)], local[0][0] + l, w);
+                        codecs[kVelocityZ].decodeRow(&v16[idx(rx0, k)], local[0][1] + l, w);
+                    }
+                    if (depth > 1) std::copy(local[0][0], local[0][0] + 2 * n, local[1][0]);
+                } else if (depth > 1) {
+                    auto copyFixed = [&](int i, int k) {
+                        const int l = (k - rz0) * w + (i - rx0);
+                        for (int b = 0; b < 2; ++b) {
+                            local[b][0][l] = u[idx(i, k)];
+                            local[b][1][l] = v[idx(i, k)];
+                        }
+                    };
+                    for (int i = rx0; i < rx1; ++i) {
+                        if (rz0 == 0) copyFixed(i, 0);
+                        if (rz1 == nz) copyFixed(i, nz - 1);
+                    }
+                    for (int k = rz0; k < rz1; ++k) {
+                        if (rx0 == 0) copyFixed(0, k);
+                        if (rx1 == nx) copyFixed(nx - 1, k);
+                    }
+                }
+
+                for (int it = 1; it <= depth; ++it) {
+                    const int lx = rx0 == 0 ? 1 : rx0 + it, hx = rx1 == nx ? nx - 1 : rx1 - it;
+                    const int lz = rz0 == 0 ? 1 : rz0 + it, hz = rz1 == nz ? nz - 1 : rz1 - it;
+                    float* const* src = local[(it - 1) & 1];
+                    float* const* dst = local[it & 1];
+                    const bool first = it == 1 && !packed, last = it == depth && !packed;
+                    for (int k = lz; k < hz; ++k) {
+                        const int l = (k - rz0) * w + (lx - rx0);
+                        const float* su = first ? &u[idx(lx, k)] : src[0] + l;
+                        const float* sv = first ? &v[idx(lx, k)] : src[1] + l;
+                        float* du = last ? &uTmp[idx(lx, k)] : dst[0] + l;
+                        float* dv = last ? &vTmp[idx(lx, k)] : dst[1] + l;
+                        const int stride = first ? nx : w;
+                        jacobiRow(su, du, hx - lx, stride, a);
+                        jacobiRow(sv, dv, hx - lx, stride, a);
+                        if (packed && it == depth) {
+                            codecs[kVelocityX].encodeRow(du, &u16Tmp[idx(lx, k)], hx - lx);
+                            codecs[kVelocityZ].encodeRow(dv, &v16Tmp[idx(lx, k)], hx - lx);
+                        }
+                    }
+                }
+            }
+        });
+        if (packed) {
+            std::swap(u16, u16Tmp);
+            std::swap(v16, v16Tmp);
+        } else {
+            std::swap(u, uTmp);
+            std::swap(v, vTmp);
+        }
     }
+    lastDiffusionIterations = 10;
 }
 
-static void smoothHeights(std::vector<float>& h, std::vector<float>& tmp, int nx, int nz, float alpha) {
-    for (int k = 1; k < nz - 1; ++k) {
-        for (int i = 1; i < nx - 1; ++i) {
-            int id = k * nx + i;
-            float lap = h[id - 1] + h[id + 1] + h[id - nx] + h[id + nx] - 4.0f * h[id];
-            tmp[id] = h[id] + alpha * lap;
+// project, applySources, applyBoundary and smoothHeights in one pass. The
+// post-source height is pointwise in h and q, so each band recomputes it for
+// the row above and below into scratch instead of waiting on its neighbours.
+// Neighbours still read h and q, so the new h and the cleared q go to hTmp
+// and qTmp and are swapped in at the end. Packed fields are widened a band
+// at a time into the same scratch and narrowed row by row.
+void WaterGrid::finishSubstepFused(float dt, float smoothing) {
+    const float damp = std::pow(waveDamping, dt / kReferenceStep);
+    const float maxSpeed = 1.8f;
+
+    parallelFor(pool, 0, nz, rowGrain(), [&](size_t kb, size_t ke) {
+        thread_local std::vector<float> rows;
+        thread_local std::vector<float> wide;
+        const int r0 = std::max(0, (int)kb - 1), r1 = std::min(nz, (int)ke + 1);
+        const size_t band = static_cast<size_t>(r1 - r0) * nx;
+        rows.resize(band);
+        if (packed) {
+            wide.resize(2 * band + 3 * static_cast<size_t>(nx));
+            codecs[kHeight].decodeRow(&h16[idx(0, r0)], wide.data(), static_cast<int>(band));
+            codecs[kSource].decodeRow(&q16[idx(0, r0)], wide.data() + band, static_cast<int>(band));
+        }
+        for (int k = r0; k < r1; ++k) {
+            const float* hr = packed ? &wide[(k - r0) * nx] : &h[idx(0, k)];
+            const float* qr = packed ? &wide[band + (k - r0) * nx] : &q[idx(0, k)];
+            float* c = &rows[(k - r0) * nx];
+            for (int i = 0; i < nx; ++i) {
+                float hs = hr[i] + qr[i] * 0.9f;
+                c[i] = baseLevel + (hs - baseLevel) * damp;
+            }
+            if (k == 0 || k == nz - 1) {
+                for (int i = 0; i < nx; ++i) c[i] = std::max(c[i], baseLevel);
+            } else {
+                c[0] = std::max(c[0], baseLevel);
+                c[nx - 1] = std::max(c[nx - 1], baseLevel);
+            }
         }
+
+        for (int k = (int)kb; k < (int)ke; ++k) {
+            float* ur = packed ? &wide[2 * band] : &u[idx(0, k)];
+            float* vr = packed ? ur + nx : &v[idx(0, k)];
+            float* out = packed ? ur + 2 * nx : &hTmp[idx(0, k)];
+            const float* c = &rows[(k - r0) * nx];
+            if (packed) {
+                // Zero encodes as zero bits in either format.
+                std::fill(&q16Tmp[idx(0, k)], &q16Tmp[idx(0, k)] + nx, uint16_t(0));
+            } else {
+                std::fill(&qTmp[idx(0, k)], &qTmp[idx(0, k)] + nx, 0.0f);
+            }
+            if (k == 0 || k == nz - 1) {
+                std::fill(ur, ur + nx, 0.0f);
+                std::fill(vr, vr + nx, 0.0f);
+                std::copy(c, c + nx, out);
+            } else {
+                if (packed) {
+                    codecs[kVelocityX].decodeRow(&u16[idx(0, k)], ur, nx);
+                    codecs[kVelocityZ].decodeRow(&v16[idx(0, k)], vr, nx);
+                }
+                const float* hr = packed ? &wide[(k - r0) * nx] : &h[idx(0, k)];
+                for (int i = 1; i < nx - 1; ++i) {
+                    float dhdx = (hr[i + 1] - hr[i - 1]) / (2.0f * dx);
+                    float dhdz = (hr[i + nx] - hr[i - nx]) / (2.0f * dx);
+                    ur[i] = std::min(maxSpeed, std::max(-maxSpeed, ur[i] + -gravity * dhdx * dt));
+                    vr[i] = std::min(maxSpeed, std::max(-maxSpeed, vr[i] + -gravity * dhdz * dt));
+                    float lap = c[i - 1] + c[i + 1] + c[i - nx] + c[i + nx] - 4.0f * c[i];
+                    out[i] = c[i] + smoothing * lap;
+                }
+                ur[0] = vr[0] = ur[nx - 1] = vr[nx - 1] = 0.0f;
+                out[0] = c[0];
+                out[nx - 1] = c[nx - 1];
+            }
+            if (packed) {
+                codecs[kVelocityX].encodeRow(ur, &u16[idx(0, k)], nx);
+                codecs[kVelocityZ].encodeRow(vr, &v16[idx(0, k)], nx);
+                codecs[kHeight].encodeRow(out, &h16Tmp[idx(0, k)], nx);
+            }
+        }
+    });
+    if (packed) {
+        std::swap(h16, h16Tmp);
+        std::swap(q16, q16Tmp);
+    } else {
+        std::swap(h, hTmp);
+        std::swap(q, qTmp);
+    }
+}
+
+// Switching format goes through fp32, so the state survives it. The fp32
+// arrays are released while the fields are packed.
+void WaterGrid::setFieldStorage(FieldStorage s, float heightRange, float speedRange) {
+    if (packed) unpackFields();
+    fieldStorage = s;
+    const float ranges[4] = { heightRange, speedRange, speedRange, heightRange };
+    for (int f = 0; f < 4; ++f) {
+        const float scale = ranges[f] / 32767.0f;
+        codecs[f] = { s == FieldStorage::Half, f == kHeight ? baseLevel : 0.0f, scale, 1.0f / scale };
+    }
+    if (s == FieldStorage::Float32) {
+        for (auto* a : { &h16, &u16, &v16, &q16, &h16Tmp, &u16Tmp, &v16Tmp, &q16Tmp }) std::vector<uint16_t>().swap(*a);
+        std::vector<float>().swap(hView);
+        return;
+    }
+    packFields();
+    releaseWideFields();
+}
+
+void WaterGrid::releaseWideFields() {
+    for (auto* a : { &h, &u, &v, &q, &hTmp, &uTmp, &vTmp, &qTmp }) std::vector<float>().swap(*a);
+}
+
+bool WaterGrid::packedStep() const {
+    return fusedStep && !activeTracking && diffusionSolver == DiffusionSolver::Jacobi &&
+           waveSolver == WaveSolver::Explicit && advectionScheme != AdvectionScheme::MacCormack;
+}
+
+// Tmp fields are converted too: the fused step carries boundary cells over
+// through them.
+void WaterGrid::packFields() {
+    const std::vector<float>* from[] = { &h, &u, &v, &q, &hTmp, &uTmp, &vTmp, &qTmp };
+    std::vector<uint16_t>* to[] = { &h16, &u16, &v16, &q16, &h16Tmp, &u16Tmp, &v16Tmp, &q16Tmp };
+    for (int f = 0; f < 8; ++f) {
+        to[f]->resize(static_cast<size_t>(nx) * nz + 1);
+        parallelFor(pool, 0, nz, rowGrain(), [&](size_t kb, size_t ke) {
+            codecs[f % 4].encodeRow(from[f]->data() + kb * nx, to[f]->data() + kb * nx, (int)(ke - kb) * nx);
+        });
     }
-    for (int k = 1; k < nz - 1; ++k) {
-        for (int i = 1; i < nx - 1; ++i) {
-            int id = k * nx + i;
-            h[id] = tmp[id];
+    packed = true;
+    hViewStale = true;
+}
+
+void WaterGrid::unpackFields() {
+    const std::vector<uint16_t>* from[] = { &h16, &u16, &v16, &q16, &h16Tmp, &u16Tmp, &v16Tmp, &q16Tmp };
+    std::vector<float>* to[] = { &h, &u, &v, &q, &hTmp, &uTmp, &vTmp, &qTmp };
+    for (int f = 0; f < 8; ++f) {
+        to[f]->resize(static_cast<size_t>(nx) * nz);
+        parallelFor(pool, 0, nz, rowGrain(), [&](size_t kb, size_t ke) {
+            codecs[f % 4].decodeRow(from[f]->data() + kb * nx, to[f]->data() + kb * nx, (int)(ke - kb) * nx);
+        });
+    }
+    packed = false;
+}
+
+float WaterGrid::cell(Field f, int id) const {
+    if (packed) {
+        const std::vector<uint16_t>* fields[] = { &h16, &u16, &v16, &q16 };
+        return codecs[f].decode((*fields[f])[id]);
+    }
+    const std::vector<float>* fields[] = { &h, &u, &v, &q };
+    return (*fields[f])[id];
+}
+
+// Callers mark the height view stale once they are done.
+void WaterGrid::setCell(Field f, int id, float value) {
+    if (packed) {
+        std::vector<uint16_t>* fields[] = { &h16, &u16, &v16, &q16 };
+        (*fields[f])[id] = codecs[f].encode(value);
+        return;
+    }
+    std::vector<float>* fields[] = { &h, &u, &v, &q };
+    (*fields[f])[id] = value;
+}
+
+const std::vector<float>& WaterGrid::getH() const {
+    if (!packed) return h;
+    if (hViewStale.exchange(false)) {
+        hView.resize(static_cast<size_t>(nx) * nz);
+        codecs[kHeight].decodeRow(h16.data(), hView.data(), nx * nz);
+    }
+    return hView;
+}
+
+// Starts with every tile active so the first update finds the real extent.
+void WaterGrid::setActiveTracking(bool enabled) {
+    if (enabled == activeTracking) return;
+    activeTracking = enabled;
+    if (!enabled) return;
+    const size_t tiles = static_cast<size_t>(tilesX) * tilesZ;
+    tileWoken.assign(tiles, 1);
+    tileActive.assign(tiles, 1);
+    tileStepped.assign(tiles, 1);
+    steppedTiles.resize(tiles);
+    for (size_t t = 0; t < tiles; ++t) steppedTiles[t] = static_cast<int>(t);
+    tileSpanOffsets.resize(tilesZ + 1);
+    tileSpans.clear();
+    for (int tz = 0; tz <= tilesZ; ++tz) tileSpanOffsets[tz] = tz;
+    for (int tz = 0; tz < tilesZ; ++tz) {
+        tileSpans.push_back(0);
+        tileSpans.push_back(tilesX);
+    }
+    activeFraction = 1.0f;
+}
+
+// Puts every array a phase may read back to rest over tile t, including the
+// Tmp buffers the phases swap with.
+void WaterGrid::resetTile(int t) {
+    const int x0 = (t % tilesX) * kActiveTile, x1 = std::min(nx, x0 + kActiveTile);
+    const int z0 = (t / tilesX) * kActiveTile, z1 = std::min(nz, z0 + kActiveTile);
+    resetCells(x0, z0, x1 - x0, z1 - z0);
+}
+
+void WaterGrid::resetCells(int i, int k, int w, int d) {
+    if (packed) {
+        // Rest encodes as zero bits in either format.
+        for (auto* a : { &h16, &u16, &v16, &q16, &h16Tmp, &u16Tmp, &v16Tmp, &q16Tmp }) {
+            for (int kk = k; kk < k + d; ++kk) std::fill(&(*a)[idx(i, kk)], &(*a)[idx(i, kk)] + w, uint16_t(0));
+        }
+        hViewStale = true;
+    }
+    std::vector<float>* zeroed[] = { &u, &v, &q, &uTmp, &vTmp, &qTmp, &uBack, &vBack };
+    std::vector<float>* level[] = { &h, &hTmp, &hBack };
+    for (int kk = k; kk < k + d; ++kk) {
+        for (auto* a : zeroed) {
+            if (!a->empty()) std::fill(&(*a)[idx(i, kk)], &(*a)[idx(i, kk)] + w, 0.0f);
+        }
+        for (auto* a : level) {
+            if (!a->empty()) std::fill(&(*a)[idx(i, kk)], &(*a)[idx(i, kk)] + w, baseLevel);
+        }
+        if (!levels.empty()) {
+            for (auto* a : { &levels[0].x, &levels[0].b, &levels[0].r }) {
+                if (!a->empty()) std::fill(&(*a)[idx(i, kk)], &(*a)[idx(i, kk)] + w, 0.0f);
+            }
+        }
+    }
+}
+
+void WaterGrid::reset() {
+    resetCells(0, 0, nx, nz);
+    for (size_t l = 1; l < levels.size(); ++l) {
+        std::fill(levels[l].x.begin(), levels[l].x.end(), 0.0f);
+        std::fill(levels[l].b.begin(), levels[l].b.end(), 0.0f);
+        std::fill(levels[l].r.begin(), levels[l].r.end(), 0.0f);
+    }
+    lastDiffusionIterations = 0;
+    lastWaveIterations = 0;
+    if (activeTracking) {
+        activeTracking = false;
+        setActiveTracking(true);
+    }
+}
+
+// Grids holding the same format copy bits; otherwise cells are converted.
+void WaterGrid::copyCells(const WaterGrid& src, int si, int sk, int di, int dk, int w, int d) {
+    const bool sameBits = packed == src.packed && (!packed || (fieldStorage == src.fieldStorage &&
+                          codecs[kVelocityX].scale == src.codecs[kVelocityX].scale &&
+                          codecs[kHeight].scale == src.codecs[kHeight].scale && baseLevel == src.baseLevel));
+    for (int k = 0; k < d; ++k) {
+        const int s = src.idx(si, sk + k), o = idx(di, dk + k);
+        if (sameBits && packed) {
+            std::copy(&src.h16[s], &src.h16[s] + w, &h16[o]);
+            std::copy(&src.u16[s], &src.u16[s] + w, &u16[o]);
+            std::copy(&src.v16[s], &src.v16[s] + w, &v16[o]);
+            std::copy(&src.q16[s], &src.q16[s] + w, &q16[o]);
+        } else if (sameBits) {
+            std::copy(&src.h[s], &src.h[s] + w, &h[o]);
+            std::copy(&src.u[s], &src.u[s] + w, &u[o]);
+            std::copy(&src.v[s], &src.v[s] + w, &v[o]);
+            std::copy(&src.q[s], &src.q[s] + w, &q[o]);
+        } else {
+            for (int x = 0; x < w; ++x) {
+                for (Field f : { kHeight, kVelocityX, kVelocityZ, kSource }) setCell(f, o + x, src.cell(f, s + x));
+            }
+        }
+    }
+    if (packed) hViewStale = true;
+    if (activeTracking) wakeDisturbed(di, dk, w, d);
+}
+
+// Wakes the tiles of a block that were written from outside and now deviate
+// from rest, as an impulse landing there would.
+void WaterGrid::wakeDisturbed(int i, int k, int w, int d) {
+    for (int tz = k / kActiveTile; tz <= (k + d - 1) / kActiveTile; ++tz) {
+        for (int tx = i / kActiveTile; tx <= (i + w - 1) / kActiveTile; ++tx) {
+            const int x0 = std::max(i, tx * kActiveTile), x1 = std::min(i + w, (tx + 1) * kActiveTile);
+            const int z0 = std::max(k, tz * kActiveTile), z1 = std::min(k + d, (tz + 1) * kActiveTile);
+            if (maxDeviation(x0, z0, x1 - x0, z1 - z0) > activityThreshold) tileWoken[tz * tilesX + tx] = 1;
+        }
+    }
+}
+
+float WaterGrid::maxDeviation(int i, int k, int w, int d) const {
+    float dev = 0.0f;
+    for (int kk = k; kk < k + d; ++kk) {
+        for (int id = idx(i, kk); id < idx(i + w, kk); ++id) {
+            dev = std::max(dev, std::max(std::fabs(cell(kHeight, id) - baseLevel), std::fabs(cell(kSource, id))));
+            dev = std::max(dev, std::max(std::fabs(cell(kVelocityX, id)), std::fabs(cell(kVelocityZ, id))));
+        }
+    }
+    return dev;
+}
+
+static inline float minmod(float a, float b) {
+    return a * b <= 0.0f ? 0.0f : (std::fabs(a) < std::fabs(b) ? a : b);
+}
+
+// Floor division for cells left of or below the coarse origin.
+static inline int coarseCell(int fine, int ratio) {
+    return fine >= 0 ? fine / ratio : -((-fine + ratio - 1) / ratio);
+}
+
+// Fine cells from the coarse grid's first cell corner to this grid's, along
+// one axis; a cell reaches half a cell either side of its node.
+static inline int cornerOffset(float origin, float dx, float coarseOrigin, float coarseDx) {
+    return (int)std::lround(((origin - 0.5f * dx) - (coarseOrigin - 0.5f * coarseDx)) / dx);
+}
+
+void WaterGrid::prolongFrom(const WaterGrid& coarse, int i, int k, int w, int d) {
+    const int ratio = std::max(1, (int)std::lround(coarse.dx / dx));
+    const int oi = cornerOffset(origin.x, dx, coarse.origin.x, coarse.dx);
+    const int ok = cornerOffset(origin.z, dx, coarse.origin.z, coarse.dx);
+    const Field fields[] = { kHeight, kVelocityX, kVelocityZ };
+    const int cnx = coarse.nx, cnz = coarse.nz;
+    for (int kk = k; kk < k + d; ++kk) {
+        const int gk = ok + kk;
+        const int kc = coarseCell(gk, ratio);
+        const float fz = (gk - kc * ratio + 0.5f) / ratio - 0.5f;
+        const int K = std::clamp(kc, 0, cnz - 1);
+        const int Kd = std::max(0, K - 1), Ku = std::min(cnz - 1, K + 1);
+        for (int ii = i; ii < i + w; ++ii) {
+            const int gi = oi + ii;
+            const int ic = coarseCell(gi, ratio);
+            const float fx = (gi - ic * ratio + 0.5f) / ratio - 0.5f;
+            const int I = std::clamp(ic, 0, cnx - 1);
+            const int Il = std::max(0, I - 1), Ir = std::min(cnx - 1, I + 1);
+            for (Field f : fields) {
+                const float mid = coarse.cell(f, K * cnx + I);
+                const float sx = minmod(coarse.cell(f, K * cnx + Ir) - mid, mid - coarse.cell(f, K * cnx + Il));
+                const float sz = minmod(coarse.cell(f, Ku * cnx + I) - mid, mid - coarse.cell(f, Kd * cnx + I));
+                setCell(f, idx(ii, kk), mid + sx * fx + sz * fz);
+            }
+            setCell(kSource, idx(ii, kk), 0.0f);
+        }
+    }
+    if (packed) hViewStale = true;
+    if (activeTracking) wakeDisturbed(i, k, w, d);
+}
+
+void WaterGrid::relaxBorder(int width, float blend, const BorderTarget& target) {
+    width = std::min(width, std::min(nx, nz) / 2);
+    if (width <= 0) return;
+    for (int k = 0; k < nz; ++k) {
+        const int dk = std::min(k, nz - 1 - k);
+        for (int i = 0; i < nx; ++i) {
+            const int d = std::min(dk, std::min(i, nx - 1 - i));
+            if (d >= width) {
+                i = nx - 1 - width;  // skip to the right-hand band
+                continue;
+            }
+            const float f = 1.0f - static_cast<float>(d) / width;
+            const float w = blend * f * f;
+            float th, tu, tv;
+            target(origin.x + (i + 0.5f) * dx, origin.z + (k + 0.5f) * dx, th, tu, tv);
+            const int id = idx(i, k);
+            const float ch = cell(kHeight, id), cu = cell(kVelocityX, id), cv = cell(kVelocityZ, id);
+            setCell(kHeight, id, ch + w * (th - ch));
+            setCell(kVelocityX, id, cu + w * (tu - cu));
+            setCell(kVelocityZ, id, cv + w * (tv - cv));
+        }
+    }
+    if (packed) hViewStale = true;
+    if (activeTracking) {
+        wakeDisturbed(0, 0, nx, width);
+        wakeDisturbed(0, nz - width, nx, width);
+        wakeDisturbed(0, width, width, nz - 2 * width);
+        wakeDisturbed(nx - width, width, width, nz - 2 * width);
+    }
+}
+
+void WaterGrid::restrictTo(WaterGrid& coarse, int i, int k, int w, int d) const {
+    const int ratio = std::max(1, (int)std::lround(coarse.dx / dx));
+    const int oi = cornerOffset(origin.x, dx, coarse.origin.x, coarse.dx);
+    const int ok = cornerOffset(origin.z, dx, coarse.origin.z, coarse.dx);
+    const float inv = 1.0f / (ratio * ratio);
+    const int I0 = coarseCell(oi + i, ratio), K0 = coarseCell(ok + k, ratio);
+    for (int K = K0; K < K0 + d / ratio; ++K) {
+        if (K < 0 || K >= coarse.nz) continue;
+        for (int I = I0; I < I0 + w / ratio; ++I) {
+            if (I < 0 || I >= coarse.nx) continue;
+            float sh = 0.0f, su = 0.0f, sv = 0.0f;
+            for (int kk = K * ratio - ok; kk < (K + 1) * ratio - ok; ++kk) {
+                for (int id = idx(I * ratio - oi, kk); id < idx((I + 1) * ratio - oi, kk); ++id) {
+                    sh += cell(kHeight, id);
+                    su += cell(kVelocityX, id);
+                    sv += cell(kVelocityZ, id);
+                }
+            }
+            const int c = K * coarse.nx + I;
+            coarse.setCell(kHeight, c, sh * inv);
+            coarse.setCell(kVelocityX, c, su * inv);
+            coarse.setCell(kVelocityZ, c, sv * inv);
         }
     }
+    if (coarse.packed) coarse.hViewStale = true;
+    if (coarse.activeTracking) {
+        const int ci = std::clamp(I0, 0, coarse.nx - 1), ck = std::clamp(K0, 0, coarse.nz - 1);
+        const int cw = std::min(coarse.nx, I0 + w / ratio) - ci, cd = std::min(coarse.nz, K0 + d / ratio) - ck;
+        if (cw > 0 && cd > 0) coarse.wakeDisturbed(ci, ck, cw, cd);
+    }
+}
+
+// Only stepped tiles can have moved away from rest, so only they are
+// measured; other tiles are active only if an impulse woke them.
+void WaterGrid::updateActiveTiles() {
+    parallelFor(pool, 0, steppedTiles.size(), 4, [&](size_t b, size_t e) {
+        for (size_t s = b; s < e; ++s) {
+            const int t = steppedTiles[s];
+            const int x0 = (t % tilesX) * kActiveTile, x1 = std::min(nx, x0 + kActiveTile);
+            const int z0 = (t / tilesX) * kActiveTile, z1 = std::min(nz, z0 + kActiveTile);
+            tileActive[t] = maxDeviation(x0, z0, x1 - x0, z1 - z0) > activityThreshold;
+        }
+    });
+    for (size_t t = 0; t < tileWoken.size(); ++t) {
+        if (tileWoken[t]) tileActive[t] = 1;
+        tileWoken[t] = 0;
+    }
+
+    steppedTiles.clear();
+    tileSpans.clear();
+    for (int tz = 0; tz < tilesZ; ++tz) {
+        tileSpanOffsets[tz] = static_cast<int>(tileSpans.size() / 2);
+        for (int tx = 0; tx < tilesX; ++tx) {
+            const int t = tz * tilesX + tx;
+            bool stepped = false;
+            for (int oz = std::max(0, tz - 1); oz <= std::min(tilesZ - 1, tz + 1) && !stepped; ++oz) {
+                for (int ox = std::max(0, tx - 1); ox <= std::min(tilesX - 1, tx + 1); ++ox) {
+                    if (tileActive[oz * tilesX + ox]) {
+                        stepped = true;
+                        break;
+                    }
+                }
+            }
+            if (tileStepped[t] && !stepped) resetTile(t);
+            tileStepped[t] = stepped;
+            if (!stepped) continue;
+            steppedTiles.push_back(t);
+            if (tileSpans.size() / 2 > static_cast<size_t>(tileSpanOffsets[tz]) && tileSpans.back() == tx) {
+                tileSpans.back() = tx + 1;
+            } else {
+                tileSpans.push_back(tx);
+                tileSpans.push_back(tx + 1);
+            }
+        }
+    }
+    tileSpanOffsets[tilesZ] = static_cast<int>(tileSpans.size() / 2);
+    activeFraction = static_cast<float>(steppedTiles.size()) / (tilesX * tilesZ);
+}
+
+float WaterGrid::estimateStableTimeStep() const {
+    size_t grain = rowGrain();
+    size_t chunks = (nz + grain - 1) / grain;
+    // Cells outside the stepped tiles are at rest at baseLevel.
+    const float floorH = activeTracking ? baseLevel : bedLevel;
+    const RowSpans spans = spansOf(activeTracking, tileSpanOffsets, tileSpans);
+    std::vector<float> partialH(chunks, floorH), partialSpeed(chunks, 0.0f);
+    parallelFor(pool, 0, nz, grain, [&](size_t kb, size_t ke) {
+        thread_local std::vector<float> wide;
+        float maxH = floorH, maxSpeed = 0.0f;
+        for (int k = (int)kb; k < (int)ke; ++k) {
+            spans.forEach(k, 0, nx, [&](int i0, int i1) {
+                const float *hr, *ur, *vr;
+                if (packed) {
+                    wide.resize(3 * static_cast<size_t>(nx));
+                    hr = wide.data();
+                    ur = hr + nx;
+                    vr = ur + nx;
+                    codecs[kHeight].decodeRow(&h16[idx(i0, k)], wide.data(), i1 - i0);
+                    codecs[kVelocityX].decodeRow(&u16[idx(i0, k)], wide.data() + nx, i1 - i0);
+                    codecs[kVelocityZ].decodeRow(&v16[idx(i0, k)], wide.data() + 2 * nx, i1 - i0);
+                } else {
+                    hr = &h[idx(i0, k)];
+                    ur = &u[idx(i0, k)];
+                    vr = &v[idx(i0, k)];
+                }
+                for (int i = 0; i < i1 - i0; ++i) {
+                    maxH = std::max(maxH, hr[i]);
+                    maxSpeed = std::max(maxSpeed, std::max(std::fabs(ur[i]), std::fabs(vr[i])));
+                }
+            });
+        }
+        partialH[kb / grain] = maxH;
+        partialSpeed[kb / grain] = maxSpeed;
+    });
+    float maxH = *std::max_element(partialH.begin(), partialH.end());
+    float maxSpeed = *std::max_element(partialSpeed.begin(), partialSpeed.end());
+    float waveSpeed = waveSolver == WaveSolver::Explicit ? std::sqrt(gravity * std::max(0.0f, maxH - bedLevel)) : 0.0f;
+    float speed = maxSpeed + waveSpeed;
+    return speed > 0.0f ? cflNumber * dx / speed : std::numeric_limits<float>::infinity();
 }
 
 void WaterGrid::step(float dt) {
-    float maxDt = 0.006f;
-    int iters = std::max(1, (int)std::ceil(dt / maxDt));
+    float stable = estimateStableTimeStep();
+    step(dt, std::max(1, (int)std::ceil(dt / stable)));
+}
+
+// Configurations without a 16-bit path step a widened copy of the fields,
+// which is freed again once they are narrowed.
+void WaterGrid::step(float dt, int substeps) {
+    if (packed && !packedStep()) {
+        unpackFields();
+        step(dt, substeps);
+        packFields();
+        releaseWideFields();
+        return;
+    }
+    if (keepPrevious) savePreviousState();
+    int iters = std::max(1, substeps);
     float hdt = dt / iters;
+    float smoothing = std::min(0.2f, 0.02f * hdt / kReferenceStep);
+    const bool fused = fusedStep && !activeTracking;
     for (int it = 0; it < iters; ++it) {
-        diffuse(hdt);
+        if (activeTracking) updateActiveTiles();
+        if (diffusionSolver == DiffusionSolver::Multigrid) diffuseMultigrid(hdt);
+        else if (fused) diffuseTiled(hdt);
+        else diffuse(hdt);
         advect(hdt);
-        project(hdt);
-        for (int id = 0; id < nx * nz; ++id) {
-            h[id] += q[id] * 0.9f;
-            q[id] = 0.0f;
+        if (fused && waveSolver == WaveSolver::Explicit) {
+            finishSubstepFused(hdt, smoothing);
+            continue;
         }
-        addHeightDamping(hdt);
+        if (waveSolver == WaveSolver::SemiImplicit) solveWaves(hdt);
+        else project(hdt);
+        applySources(hdt);
         applyBoundary();
-        float maxSpeed = 1.8f;
-        for (int id = 0; id < nx * nz; ++id) {
-            if (u[id] > maxSpeed) u[id] = maxSpeed; else if (u[id] < -maxSpeed) u[id] = -maxSpeed;
-            if (v[id] > maxSpeed) v[id] = maxSpeed; else if (v[id] < -maxSpeed) v[id] = -maxSpeed;
-        }
-        smoothHeights(h, hTmp, nx, nz, 0.02f);
+        smoothHeights(smoothing);
     }
+    if (packed) hViewStale = true;
 }
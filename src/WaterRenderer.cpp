@@ -1,4 +1,6 @@
 #include "WaterRenderer.h"
+#include "SpectralOcean.h"
+#include <algorithm>
 #include <cmath>
 #include <cstring>
 
@@ -71,7 +73,8 @@ static const char* kErr = "Shader compile/link error";
 
 WaterRenderer::WaterRenderer(int nx, int nz, float dx, const Vec3& origin, float baseLevel, float bottomLevel)
     : nx(nx), nz(nz), dx(dx), origin(origin), baseLevel(baseLevel), bottomLevel(bottomLevel),
-      vao(0), vbo(0), nbo(0), ibo(0), program(0) {
+      vao(0), vbo(0), nbo(0), ibo(0), program(0),
+      farCells(0), farExtent(0.0f), farVao(0), farVbo(0), farNbo(0), farIbo(0) {
     buildMesh();
     GLuint vs = compile(GL_VERTEX_SHADER, kWaterVS);
     GLuint fs = compile(GL_FRAGMENT_SHADER, kWaterFS);
@@ -88,6 +91,10 @@ WaterRenderer::WaterRenderer(int nx, int nz, float dx, const Vec3& origin, float
 }
 
 WaterRenderer::~WaterRenderer(){
+    if(farIbo) glDeleteBuffers(1,&farIbo);
+    if(farNbo) glDeleteBuffers(1,&farNbo);
+    if(farVbo) glDeleteBuffers(1,&farVbo);
+    if(farVao) glDeleteVertexArrays(1,&farVao);
     if(ibo) glDeleteBuffers(1,&ibo);
     if(nbo) glDeleteBuffers(1,&nbo);
     if(vbo) glDeleteBuffers(1,&vbo);
@@ -159,6 +166,71 @@ void WaterRenderer::updateFromWater(const WaterGrid& water){
     glBufferSubData(GL_ARRAY_BUFFER, 0, normals.size()*sizeof(Vec3), normals.data());
 }
 
+void WaterRenderer::setFarField(float extent, int cells){
+    farExtent = extent;
+    farCells = std::max(1, cells);
+    const int n = farCells + 1;
+    const float cx = origin.x + 0.5f*(nx-1)*dx, cz = origin.z + 0.5f*(nz-1)*dx;
+    const float step = 2.0f*extent/farCells;
+    farPositions.resize(n*n);
+    farNormals.assign(n*n, Vec3(0,1,0));
+    for(int k=0;k<n;++k){
+        for(int i=0;i<n;++i){
+            farPositions[k*n+i] = Vec3(cx - extent + i*step, baseLevel, cz - extent + k*step);
+        }
+    }
+    const float x0 = origin.x, x1 = origin.x + (nx-1)*dx;
+    const float z0 = origin.z, z1 = origin.z + (nz-1)*dx;
+    farIndices.clear();
+    for(int k=0;k<farCells;++k){
+        for(int i=0;i<farCells;++i){
+            const Vec3& a = farPositions[k*n+i];
+            // Quads wholly inside the grid are drawn by the grid.
+            if(a.x >= x0 && a.x + step <= x1 && a.z >= z0 && a.z + step <= z1) continue;
+            unsigned int i0 = k*n + i, i1 = k*n + i+1, i2 = (k+1)*n + i+1, i3 = (k+1)*n + i;
+            farIndices.push_back(i0); farIndices.push_back(i1); farIndices.push_back(i2);
+            farIndices.push_back(i0); farIndices.push_back(i2); farIndices.push_back(i3);
+        }
+    }
+
+    if(!farVao){
+        glGenVertexArrays(1,&farVao);
+        glGenBuffers(1,&farVbo);
+        glGenBuffers(1,&farNbo);
+        glGenBuffers(1,&farIbo);
+    }
+    glBindVertexArray(farVao);
+    glBindBuffer(GL_ARRAY_BUFFER, farVbo);
+    glBufferData(GL_ARRAY_BUFFER, farPositions.size()*sizeof(Vec3), farPositions.data(), GL_DYNAMIC_DRAW);
+    glEnableVertexAttribArray(0); glVertexAttribPointer(0,3,GL_FLOAT,GL_FALSE,sizeof(Vec3),(void*)0);
+    glBindBuffer(GL_ARRAY_BUFFER, farNbo);
+    glBufferData(GL_ARRAY_BUFFER, farNormals.size()*sizeof(Vec3), farNormals.data(), GL_DYNAMIC_DRAW);
+    glEnableVertexAttribArray(1); glVertexAttribPointer(1,3,GL_FLOAT,GL_FALSE,sizeof(Vec3),(void*)0);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, farIbo);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, farIndices.size()*sizeof(unsigned int), farIndices.data(), GL_STATIC_DRAW);
+    glBindVertexArray(0);
+}
+
+void WaterRenderer::updateFromOcean(const SpectralOcean& ocean){
+    if(!farCells) return;
+    const int n = farCells + 1;
+    const float step = 2.0f*farExtent/farCells;
+    for(auto& p : farPositions) p.y = baseLevel + ocean.sampleHeight(p.x, p.z);
+    for(int k=0;k<n;++k){
+        for(int i=0;i<n;++i){
+            int il = std::max(0,i-1), ir = std::min(n-1,i+1);
+            int kd = std::max(0,k-1), ku = std::min(n-1,k+1);
+            float dhdx = (farPositions[k*n+ir].y - farPositions[k*n+il].y)/((ir-il)*step);
+            float dhdz = (farPositions[ku*n+i].y - farPositions[kd*n+i].y)/((ku-kd)*step);
+            farNormals[k*n+i] = Vec3(-dhdx, 1.0f, -dhdz).normalize();
+        }
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, farVbo);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, farPositions.size()*sizeof(Vec3), farPositions.data());
+    glBindBuffer(GL_ARRAY_BUFFER, farNbo);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, farNormals.size()*sizeof(Vec3), farNormals.data());
+}
+
 void WaterRenderer::draw(const float* view, const float* proj){
     auto inv4 = [](const float m[16], float invOut[16]){
         float inv[16];
@@ -297,6 +369,10 @@ void WaterRenderer::draw(const float* view, const float* proj){
     glEnable(GL_BLEND);
     glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
     glDrawElements(GL_TRIANGLES, (GLsizei)indices.size(), GL_UNSIGNED_INT, 0);
+    if(farVao && !farIndices.empty()){
+        glBindVertexArray(farVao);
+        glDrawElements(GL_TRIANGLES, (GLsizei)farIndices.size(), GL_UNSIGNED_INT, 0);
+    }
     glDisable(GL_BLEND);
     glBindVertexArray(0);
     glUseProgram(0);
@@ -0,0 +1,87 @@
+#include "XpbdSolver.h"
+#include "ThreadPool.h"
+#include <cmath>
+#include <algorithm>
+
+static const size_t kSpringGrain = 2048;
+static const size_t kParticleGrain = 4096;
+
+void XpbdSolver::projectSprings(ParticleStore& ps, const SpringStore& springs, size_t begin, size_t end, float h) {
+    for (size_t s = begin; s < end; ++s) {
+        int a = springs.p1[s], b = springs.p2[s];
+        float wa = ps.invMass[a], wb = ps.invMass[b];
+        float wSum = wa + wb;
+        if (wSum == 0.0f) continue;
+
+        float dx = ps.px[b] - ps.px[a];
+        float dy = ps.py[b] - ps.py[a];
+        float dz = ps.pz[b] - ps.pz[a];
+        float len = std::sqrt(dx * dx + dy * dy + dz * dz);
+        if (len < 1e-8f) continue;
+        float nx = dx / len, ny = dy / len, nz = dz / len;
+
+        float k = springs.stiffness[s];
+        float alphaTilde = 1.0f / (k * h * h);
+        float gamma = springs.damping[s] / (k * h);
+        float C = len - springs.rest[s];
+        // Gradient wrt b is n, wrt a is -n; relative motion over the substep
+        // feeds the damping term.
+        float relMove = nx * ((ps.px[b] - prevX[b]) - (ps.px[a] - prevX[a])) +
+                        ny * ((ps.py[b] - prevY[b]) - (ps.py[a] - prevY[a])) +
+                        nz * ((ps.pz[b] - prevZ[b]) - (ps.pz[a] - prevZ[a]));
+        float dLambda = (-C - alphaTilde * lambda[s] - gamma * relMove) / ((1.0f + gamma) * wSum + alphaTilde);
+        lambda[s] += dLambda;
+
+        ps.px[a] -= wa * dLambda * nx; ps.py[a] -= wa * dLambda * ny; ps.pz[a] -= wa * dLambda * nz;
+        ps.px[b] += wb * dLambda * nx; ps.py[b] += wb * dLambda * ny; ps.pz[b] += wb * dLambda * nz;
+    }
+}
+
+void XpbdSolver::step(ParticleStore& ps, const SpringStore& springs, const std::vector<size_t>& colorOffsets,
+                      float deltaTime, float velocityDamping, ThreadPool* pool) {
+    const size_t n = ps.size();
+    prevX.resize(n); prevY.resize(n); prevZ.resize(n);
+    lambda.resize(springs.size());
+    const float h = deltaTime / substeps;
+
+    for (int sub = 0; sub < substeps; ++sub) {
+        parallelFor(pool, 0, n, kParticleGrain, [&](size_t b, size_t e) {
+            for (size_t i = b; i < e; ++i) {
+                float w = ps.invMass[i] * h;
+                ps.vx[i] += ps.fx[i] * w;
+                ps.vy[i] += ps.fy[i] * w;
+                ps.vz[i] += ps.fz[i] * w;
+                prevX[i] = ps.px[i]; prevY[i] = ps.py[i]; prevZ[i] = ps.pz[i];
+                ps.px[i] += ps.vx[i] * h;
+                ps.py[i] += ps.vy[i] * h;
+                ps.pz[i] += ps.vz[i] * h;
+            }
+        });
+
+        std::fill(lambda.begin(), lambda.end(), 0.0f);
+        for (int it = 0; it < iterations; ++it) {
+            for (size_t c = 0; c + 1 < colorOffsets.size(); ++c) {
+                parallelFor(pool, colorOffsets[c], colorOffsets[c + 1], kSpringGrain, [&](size_t b, size_t e) {
+                    projectSprings(ps, springs, b, e, h);
+                });
+            }
+        }
+
+        const float invH = 1.0f / h;
+        parallelFor(pool, 0, n, kParticleGrain, [&](size_t b, size_t e) {
+            for (size_t i = b; i < e; ++i) {
+                ps.vx[i] = (ps.px[i] - prevX[i]) * invH;
+                ps.vy[i] = (ps.py[i] - prevY[i]) * invH;
+                ps.vz[i] = (ps.pz[i] - prevZ[i]) * invH;
+            }
+        });
+    }
+
+    parallelFor(pool, 0, n, kParticleGrain, [&](size_t b, size_t e) {
+        for (size_t i = b; i < e; ++i) {
+            ps.vx[i] *= velocityDamping;
+            ps.vy[i] *= velocityDamping;
+            ps.vz[i] *= velocityDamping;
+        }
+    });
+}
@@ -0,0 +1,299 @@
+#include "Cloth.h"
+#include "Water.h"
+#include "Coupling.h"
+#include "ClothWorld.h"
+#include "TimeStepController.h"
+#include "MultiRateScheduler.h"
+#include "SpectralOcean.h"
+#include "CollisionMesh.h"
+#include "ThreadPool.h"
+#include <iostream>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <vector>
+
+// The viewer's scene without a window: cloths in a row over the coupled
+// water, ocean waves at the boundary, stepped at a fixed frame time as fast
+// as the machine allows.
+struct Options {
+    int frames = 600;
+    float frameTime = 1.0f / 60.0f;
+    int clothCount = 1;
+    int clothSize = 15;
+    float clothSpacing = 0.15f;
+    ClothSolver solver = ClothSolver::ExplicitEuler;
+    bool sleep = true;
+    bool selfCollision = false;
+    bool water = true;
+    bool ocean = true;
+    int waterSize = 80;
+    WaterGrid::FieldStorage storage = WaterGrid::FieldStorage::Float32;
+    int threads = 0;
+    std::string obstacle;
+    bool checkStorage = false;
+};
+
+struct RunStats {
+    double seconds = 0.0;
+    double clothSubsteps = 0.0;
+    double waterSubsteps = 0.0;
+    size_t particles = 0;
+    std::vector<float> heights;
+};
+
+static void usage() {
+    std::cout << "Usage: ClothSimHeadless [options]" << std::endl;
+    std::cout << "  --frames N         frames to simulate (600)" << std::endl;
+    std::cout << "  --frame-time S     simulated seconds per frame (1/60)" << std::endl;
+    std::cout << "  --cloths N         cloths in a row (1)" << std::endl;
+    std::cout << "  --size N           particles along each cloth edge (15)" << std::endl;
+    std::cout << "  --solver NAME      explicit, implicit or xpbd (explicit)" << std::endl;
+    std::cout << "  --self-collision   enable cloth self-collision" << std::endl;
+    std::cout << "  --no-sleep         keep settled cloth regions awake" << std::endl;
+    std::cout << "  --water-size N     water cells along each side (80)" << std::endl;
+    std::cout << "  --storage NAME     water fields as fp32, half or fixed16 (fp32); 16-bit runs" << std::endl;
+    std::cout << "                     also report their height error against fp32" << std::endl;
+    std::cout << "  --no-water         cloth only" << std::endl;
+    std::cout << "  --no-ocean         calm water boundary" << std::endl;
+    std::cout << "  --threads N        worker threads including the caller (all cores)" << std::endl;
+    std::cout << "  --obstacle FILE    collide the cloth with an OBJ mesh" << std::endl;
+    std::cout << "  --check-storage    step a water-only scene on the 16-bit path and exit non-zero" << std::endl;
+    std::cout << "                     if half or fixed16 heights leave their error budget" << std::endl;
+}
+
+static bool parseOptions(int argc, char** argv, Options& o) {
+    for (int i = 1; i < argc; ++i) {
+        std::string a = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (a == "--frames" && hasValue) o.frames = std::atoi(argv[++i]);
+        else if (a == "--frame-time" && hasValue) o.frameTime = static_cast<float>(std::atof(argv[++i]));
+        else if (a == "--cloths" && hasValue) o.clothCount = std::atoi(argv[++i]);
+        else if (a == "--size" && hasValue) o.clothSize = std::atoi(argv[++i]);
+        else if (a == "--solver" && hasValue) {
+            std::string s = argv[++i];
+            if (s == "explicit") o.solver = ClothSolver::ExplicitEuler;
+            else if (s == "implicit") o.solver = ClothSolver::ImplicitEuler;
+            else if (s == "xpbd") o.solver = ClothSolver::XPBD;
+            else return false;
+        } else if (a == "--self-collision") o.selfCollision = true;
+        else if (a == "--no-sleep") o.sleep = false;
+        else if (a == "--water-size" && hasValue) o.waterSize = std::atoi(argv[++i]);
+        else if (a == "--storage" && hasValue) {
+            std::string s = argv[++i];
+            if (s == "fp32") o.storage = WaterGrid::FieldStorage::Float32;
+            else if (s == "half") o.storage = WaterGrid::FieldStorage::Half;
+            else if (s == "fixed16") o.storage = WaterGrid::FieldStorage::Fixed16;
+            else return false;
+        } else if (a == "--no-water") o.water = false;
+        else if (a == "--no-ocean") o.ocean = false;
+        else if (a == "--threads" && hasValue) o.threads = std::atoi(argv[++i]);
+        else if (a == "--obstacle" && hasValue) o.obstacle = argv[++i];
+        else if (a == "--check-storage") o.checkStorage = true;
+        else return false;
+    }
+    return o.frames > 0 && o.frameTime > 0.0f && o.clothCount > 0 && o.clothSize > 1 && o.waterSize > 2;
+}
+
+static RunStats runScenario(const Options& o, WaterGrid::FieldStorage storage, ThreadPool* pool,
+                            const CollisionMesh* obstacle) {
+    const float dx = 0.12f;
+    const float extent = o.waterSize * dx;
+    const Vec3 waterOrigin(-0.5f * extent, -1.3f, -0.5f * extent);
+    std::unique_ptr<WaterGrid> water;
+    std::unique_ptr<SpectralOcean> ocean;
+    if (o.water) {
+        water = std::make_unique<WaterGrid>(o.waterSize, o.waterSize, dx, waterOrigin, -0.8f);
+        water->setThreadPool(pool);
+        water->setRestDepth(0.6f);
+        water->setAdvectionScheme(WaterGrid::AdvectionScheme::MacCormack);
+        water->setWaveSolver(WaterGrid::WaveSolver::SemiImplicit);
+        water->setActiveTracking(true);
+        water->setFieldStorage(storage);
+        if (o.ocean) {
+            ocean = std::make_unique<SpectralOcean>(64, 32.0f);
+            ocean->setSpectrum(SpectralOcean::Spectrum::Jonswap);
+            ocean->setWind(Vec3(4.0f, 0.0f, 1.5f));
+            ocean->setAmplitude(0.01f);
+        }
+    }
+
+    ClothWorld world(pool);
+    if (water) world.setWater(water.get(), CouplingParams{ 400.0f, 2.0f, 1.0f });
+    if (obstacle) world.setObstacle(obstacle, 0.03f);
+    float stride = (o.clothSize + 2) * o.clothSpacing;
+    float start = -0.5f * stride * (o.clothCount - 1);
+    for (int c = 0; c < o.clothCount; ++c) {
+        Cloth& cloth = world.addCloth(std::make_unique<Cloth>(o.clothSize, o.clothSize, o.clothSpacing, o.solver));
+        cloth.setThreadPool(pool);
+        cloth.translate(Vec3(start + c * stride, 0.0f, 0.0f));
+        cloth.fixCorner(0);
+        cloth.setSleepEnabled(o.sleep);
+        cloth.setSelfCollisionEnabled(o.selfCollision);
+    }
+
+    ClothEnvironment env;
+    env.gravity = Vec3(0.0f, -2.0f, 0.0f);
+    env.dragCoefficient = 0.1f;
+    env.windCarry = 0.03f;
+    TimeStepController controller;
+    MultiRateScheduler scheduler;
+
+    RunStats stats;
+    stats.particles = world.getParticleCount();
+    float oceanTime = 0.0f;
+    auto startTime = std::chrono::steady_clock::now();
+    for (int f = 0; f < o.frames; ++f) {
+        const StepPlan& plan = controller.plan(o.frameTime, world, water.get());
+        if (ocean) {
+            oceanTime += plan.frameTime;
+            ocean->update(oceanTime);
+            ocean->driveBoundary(*water, 6, plan.frameTime);
+        }
+        scheduler.advance(world, plan, env);
+        stats.clothSubsteps += plan.clothSubsteps;
+        stats.waterSubsteps += water ? plan.waterSubsteps : 0;
+    }
+    stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+    if (water) stats.heights = water->getH();
+    return stats;
+}
+
+// Largest height error of 16-bit storage against fp32, as a fraction of the
+// largest fp32 disturbance from rest. Half keeps 11 significant bits of the
+// deviation; Fixed16 resolves heightRange / 32767 = 1.5e-5 absolute and
+// saturates velocities at speedRange.
+struct StorageBudget {
+    WaterGrid::FieldStorage storage;
+    const char* name;
+    float relativeError;
+};
+static const StorageBudget kStorageBudgets[] = {
+    { WaterGrid::FieldStorage::Half, "half", 0.01f },
+    { WaterGrid::FieldStorage::Fixed16, "fixed16", 0.02f },
+};
+
+// A wake dragged in a circle over the water, deposited the way the coupling
+// does it, on the one configuration that steps the 16-bit fields directly.
+static std::vector<float> runStorageScene(const Options& o, int frames, WaterGrid::FieldStorage storage,
+                                          WaterGrid::AdvectionScheme advection, ThreadPool* pool, bool& compact) {
+    const float dx = 0.12f;
+    const float extent = o.waterSize * dx;
+    WaterGrid water(o.waterSize, o.waterSize, dx, Vec3(-0.5f * extent, -1.3f, -0.5f * extent), -0.8f);
+    water.setThreadPool(pool);
+    water.setRestDepth(0.6f);
+    water.setFusedStep(true);
+    water.setDiffusionSolver(WaterGrid::DiffusionSolver::Jacobi);
+    water.setWaveSolver(WaterGrid::WaveSolver::Explicit);
+    water.setAdvectionScheme(advection);
+    water.setActiveTracking(false);
+    water.setFieldStorage(storage);
+    compact = storage == WaterGrid::FieldStorage::Float32 || water.stepsCompactFields();
+
+    const int points = 64;
+    std::vector<float> xs(points), zs(points), dhs(points);
+    for (int f = 0; f < frames; ++f) {
+        float t = f * o.frameTime;
+        float cx = 0.25f * extent * std::cos(0.7f * t), cz = 0.25f * extent * std::sin(0.7f * t);
+        for (int p = 0; p < points; ++p) {
+            float a = 6.2831853f * p / points;
+            xs[p] = cx + 0.4f * std::cos(a);
+            zs[p] = cz + 0.4f * std::sin(a);
+            dhs[p] = 0.003f * std::sin(3.0f * a + t);
+        }
+        water.addRadialImpulses(xs.data(), zs.data(), dhs.data(), points, 0.28f, 0.35f);
+        for (int p = 0; p < points; ++p) water.addImpulse(xs[p], zs[p], 0.02f * std::sin(6.2831853f * p / points), 0.02f * std::cos(6.2831853f * p / points), 0.0f);
+        water.step(o.frameTime);
+    }
+    return water.getH();
+}
+
+// Nearest truncates the backtrace, so a velocity rounding across zero moves
+// a value by a whole cell; over many steps its fp32 and 16-bit runs part
+// ways at any precision. It is checked over one frame, Bilinear over all.
+static bool checkStorage(const Options& o, ThreadPool* pool) {
+    bool passed = true;
+    const WaterGrid::AdvectionScheme schemes[] = { WaterGrid::AdvectionScheme::Bilinear,
+                                                   WaterGrid::AdvectionScheme::Nearest };
+    const char* schemeNames[] = { "bilinear", "nearest" };
+    const int frames[] = { o.frames, 1 };
+    for (int s = 0; s < 2; ++s) {
+        bool compact = true;
+        std::vector<float> reference =
+            runStorageScene(o, frames[s], WaterGrid::FieldStorage::Float32, schemes[s], pool, compact);
+        float maxDisturbance = 0.0f;
+        for (float h : reference) maxDisturbance = std::max(maxDisturbance, std::fabs(h + 0.8f));
+        for (const StorageBudget& budget : kStorageBudgets) {
+            std::vector<float> heights = runStorageScene(o, frames[s], budget.storage, schemes[s], pool, compact);
+            float maxError = 0.0f;
+            for (size_t i = 0; i < heights.size(); ++i) {
+                maxError = std::max(maxError, std::fabs(heights[i] - reference[i]));
+            }
+            bool ok = compact && maxError <= budget.relativeError * maxDisturbance;
+            std::cout << (ok ? "PASS " : "FAIL ") << budget.name << ", " << schemeNames[s] << " advection, " << frames[s]
+                      << " frame(s): height error "
+                      << maxError << ", budget " << budget.relativeError * maxDisturbance << " ("
+                      << budget.relativeError * 100.0f << "% of the largest disturbance " << maxDisturbance << ")"
+                      << (compact ? "" : ", not stepped on 16-bit fields") << std::endl;
+            passed = passed && ok;
+        }
+    }
+    return passed;
+}
+
+int main(int argc, char** argv) {
+    Options o;
+    if (!parseOptions(argc, argv, o)) {
+        usage();
+        return 1;
+    }
+
+    std::unique_ptr<ThreadPool> ownPool;
+    ThreadPool* pool = &ThreadPool::shared();
+    if (o.threads > 0) {
+        ownPool = std::make_unique<ThreadPool>(o.threads);
+        pool = ownPool.get();
+    }
+
+    if (o.checkStorage) return checkStorage(o, pool) ? 0 : 1;
+
+    std::unique_ptr<CollisionMesh> obstacle;
+    if (!o.obstacle.empty()) {
+        TriangleMesh mesh;
+        if (!mesh.loadObj(o.obstacle)) {
+            std::cerr << "Could not load obstacle mesh " << o.obstacle << std::endl;
+            return 1;
+        }
+        obstacle = std::make_unique<CollisionMesh>(mesh);
+    }
+
+    RunStats run = runScenario(o, o.storage, pool, obstacle.get());
+    const double frames = o.frames;
+    std::cout << "Simulated " << o.frames << " frames (" << frames * o.frameTime << " s) of " << o.clothCount
+              << " cloth(s), " << run.particles << " particles, on " << pool->size() << " thread(s)" << std::endl;
+    std::cout << "Wall time " << run.seconds << " s: " << frames / run.seconds << " frames/s, "
+              << 1000.0 * run.seconds / frames << " ms/frame" << std::endl;
+    std::cout << "Substeps per frame: cloth " << run.clothSubsteps / frames << ", water " << run.waterSubsteps / frames
+              << std::endl;
+    std::cout << "Throughput: " << run.particles * run.clothSubsteps / run.seconds << " particle steps/s";
+    if (o.water) {
+        std::cout << ", " << double(o.waterSize) * o.waterSize * run.waterSubsteps / run.seconds << " water cell steps/s";
+    }
+    std::cout << std::endl;
+
+    // The reference run is not timed; it only bounds the 16-bit error.
+    if (o.water && o.storage != WaterGrid::FieldStorage::Float32) {
+        RunStats reference = runScenario(o, WaterGrid::FieldStorage::Float32, pool, obstacle.get());
+        float maxError = 0.0f, maxDisturbance = 0.0f;
+        for (size_t i = 0; i < run.heights.size(); ++i) {
+            maxError = std::max(maxError, std::fabs(run.heights[i] - reference.heights[i]));
+            maxDisturbance = std::max(maxDisturbance, std::fabs(reference.heights[i] + 0.8f));
+        }
+        std::cout << "Height error against fp32: " << maxError << " (largest fp32 disturbance " << maxDisturbance
+                  << ")" << std::endl;
+    }
+    return 0;
+}
@@ -2,15 +2,25 @@
 #include "Cloth.h"
 #include "Water.h"
 #include "Coupling.h"
+#include "ClothWorld.h"
+#include "TimeStepController.h"
+#include "MultiRateScheduler.h"
 #include "ClothRender.h"
 #include "WaterRenderer.h"
+#include "SpectralOcean.h"
+#include "CollisionMesh.h"
 #include <iostream>
 #include <chrono>
 #include <algorithm>
 #include <vector>
 #include <GL/glut.h>
 
-Cloth* cloth = nullptr;
+ClothWorld* world = nullptr;
+int clothCount = 1;
+int clothWidth = 15;
+int clothHeight = 15;
+float clothSpacing = 0.15f;
+bool clothSleep = true;
 float cameraDistance = 10.0f;
 float cameraAngleX = 30.0f;
 float cameraAngleY = 0.0f;
@@ -29,12 +39,30 @@ Vec3 windDir = Vec3(0.0f, 0.0f, 0.0f);
 WaterGrid* water = nullptr;
 CouplingParams coupling{ 400.0f, 2.0f, 1.0f };
 WaterRenderer* waterRenderer = nullptr;
+SpectralOcean* ocean = nullptr;
+bool oceanWaves = true;
+float oceanTime = 0.0f;
+CollisionMesh* obstacle = nullptr;
+TimeStepController stepController;
+MultiRateScheduler scheduler;
 
 GLfloat light_position[] = { 1.0f, 10.0f, 1.0f, 1.0f };
 GLfloat light_ambient[]  = { 0.6f, 0.6f, 0.6f, 1.0f };
 GLfloat light_diffuse[]  = { 1.0f, 1.0f, 1.0f, 1.0f };
 GLfloat light_specular[] = { 1.0f, 1.0f, 1.0f, 1.0f };
 
+// Cloths are laid out in a row along x, each pinned at its first corner.
+void createCloths() {
+    world->clear();
+    float stride = (clothWidth + 2) * clothSpacing;
+    float start = -0.5f * stride * (clothCount - 1);
+    for (int c = 0; c < clothCount; ++c) {
+        Cloth& cloth = world->addCloth(std::make_unique<Cloth>(clothWidth, clothHeight, clothSpacing));
+        cloth.translate(Vec3(start + c * stride, 0.0f, 0.0f));
+        cloth.fixCorner(0);
+        cloth.setSleepEnabled(clothSleep);
+    }
+}
 
 void display() {
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
@@ -84,10 +112,10 @@ void display() {
         glColor3f(1.0f, 1.0f, 1.0f);
     }
     
-    {
+    for (size_t c = 0; c < world->size(); ++c) {
+        Cloth* cloth = &world->getCloth(c);
         auto& particles = cloth->getParticles();
-        int gridW = static_cast<int>(std::sqrt(particles.size()));
-        int gridH = gridW;
+        const ClothTopology& topology = cloth->getTopology();
         
         glDisable(GL_BLEND);
         glEnable(GL_TEXTURE_2D);
@@ -115,45 +143,37 @@ void display() {
         cloth->calculateNormals();
         
         glBegin(GL_TRIANGLES);
-        for (int y = 0; y < gridH - 1; ++y) {
-            for (int x = 0; x < gridW - 1; ++x) {
-                const auto& p1 = particles[y * gridW + x];
-                const auto& p2 = particles[y * gridW + x + 1];
-                const auto& p3 = particles[(y + 1) * gridW + x + 1];
-                const auto& p4 = particles[(y + 1) * gridW + x];
-                
-                float u1 = static_cast<float>(x) / (gridW - 1);
-                float v1 = static_cast<float>(y) / (gridH - 1);
-                float u2 = static_cast<float>(x + 1) / (gridW - 1);
-                float v2 = static_cast<float>(y + 1) / (gridH - 1);
-
-                // Triangle 1 (p1, p2, p3)
-                glNormal3f(p1.normal.x, p1.normal.y, p1.normal.z);
-                glTexCoord2f(u1, v1); glVertex3f(p1.position.x, p1.position.y, p1.position.z);
-                
-                glNormal3f(p2.normal.x, p2.normal.y, p2.normal.z);
-                glTexCoord2f(u2, v1); glVertex3f(p2.position.x, p2.position.y, p2.position.z);
-                
-                glNormal3f(p3.normal.x, p3.normal.y, p3.normal.z);
-                glTexCoord2f(u2, v2); glVertex3f(p3.position.x, p3.position.y, p3.position.z);
-
-                // Triangle 2 (p1, p3, p4)
-                glNormal3f(p1.normal.x, p1.normal.y, p1.normal.z);
-                glTexCoord2f(u1, v1); glVertex3f(p1.position.x, p1.position.y, p1.position.z);
-
-                glNormal3f(p3.normal.x, p3.normal.y, p3.normal.z);
-                glTexCoord2f(u2, v2); glVertex3f(p3.position.x, p3.position.y, p3.position.z);
-
-                glNormal3f(p4.normal.x, p4.normal.y, p4.normal.z);
-                glTexCoord2f(u1, v2); glVertex3f(p4.position.x, p4.position.y, p4.position.z);
-            }
-        }   
+        for (int idx : topology.triangles) {
+            const auto& p = particles[idx];
+            glNormal3f(p.normal.x, p.normal.y, p.normal.z);
+            glTexCoord2f(topology.u(idx), topology.v(idx));
+            glVertex3f(p.position.x, p.position.y, p.position.z);
+        }
                 glEnd();
                 glDisable(GL_TEXTURE_2D);
     }
 
+    if (obstacle) {
+        const TriangleMesh& mesh = obstacle->getMesh();
+        const auto& faceNormals = obstacle->getFaceNormals();
+        glDisable(GL_TEXTURE_2D);
+        glColor3f(0.55f, 0.5f, 0.45f);
+        glBegin(GL_TRIANGLES);
+        for (size_t t = 0; t < mesh.triangleCount(); ++t) {
+            const Vec3& n = faceNormals[t];
+            glNormal3f(n.x, n.y, n.z);
+            for (int k = 0; k < 3; ++k) {
+                const Vec3& v = mesh.vertices[mesh.indices[3 * t + k]];
+                glVertex3f(v.x, v.y, v.z);
+            }
+        }
+        glEnd();
+        glColor3f(1.0f, 1.0f, 1.0f);
+    }
+
     if (waterRenderer && water) {
         waterRenderer->updateFromWater(*water);
+        if (ocean) waterRenderer->updateFromOcean(*ocean);
         float view[16];
         float proj[16];
         glGetFloatv(GL_MODELVIEW_MATRIX, view);
@@ -164,15 +184,17 @@ void display() {
     //glBegin(GL_LINES);
     glColor3f(0.8f, 0.8f, 0.8f);
     
-    const auto& springs = cloth->getSprings();
-    const auto& particles = cloth->getParticles();
-    
-    for (const auto& spring : springs) {
-        const auto& p1 = particles[spring.particle1];
-        const auto& p2 = particles[spring.particle2];
-        
-        glVertex3f(p1.position.x, p1.position.y, p1.position.z);
-        glVertex3f(p2.position.x, p2.position.y, p2.position.z);
+    for (size_t c = 0; c < world->size(); ++c) {
+        const auto& springs = world->getCloth(c).getSprings();
+        const auto& particles = world->getCloth(c).getParticles();
+
+        for (const auto& spring : springs) {
+            const auto& p1 = particles[spring.particle1];
+            const auto& p2 = particles[spring.particle2];
+
+            glVertex3f(p1.position.x, p1.position.y, p1.position.z);
+            glVertex3f(p2.position.x, p2.position.y, p2.position.z);
+        }
     }
     glEnd();
     
@@ -180,13 +202,20 @@ void display() {
     glColor3f(1.0f, 0.0f, 0.0f);
     glPointSize(3.0f);
     
-    for (const auto& particle : particles) {
-        if (particle.fixed) {
-            glColor3f(0.0f, 1.0f, 0.0f);
-        } else {
-            glColor3f(1.0f, 0.0f, 0.0f);
+    for (size_t c = 0; c < world->size(); ++c) {
+        const Cloth& cloth = world->getCloth(c);
+        const auto& particles = cloth.getParticles();
+        for (size_t i = 0; i < particles.size(); ++i) {
+            if (cloth.isPinned(i)) {
+                glColor3f(0.0f, 1.0f, 0.0f);
+            } else if (cloth.isAsleep(i)) {
+                glColor3f(0.3f, 0.3f, 1.0f);
+            } else {
+                glColor3f(1.0f, 0.0f, 0.0f);
+            }
+            const auto particle = particles[i];
+            glVertex3f(particle.position.x, particle.position.y, particle.position.z);
         }
-        glVertex3f(particle.position.x, particle.position.y, particle.position.z);
     }
     glEnd();
 
@@ -240,7 +269,10 @@ void update() {
     float deltaTime = std::chrono::duration<float>(currentTime - lastTime).count();
     lastTime = currentTime;
     
-    deltaTime = std::min(deltaTime, 0.016f);
+    // The explicit integrator is substepped to its stability bound; backward
+    // Euler and XPBD take the whole frame. The water takes its own substeps,
+    // interleaved with the cloth's by the scheduler.
+    const StepPlan& plan = stepController.plan(deltaTime, *world, water);
     
     Vec3 gravity(0.0f, -2.0f, 0.0f);
     {
@@ -250,22 +282,17 @@ void update() {
     }
     bool windOn = (windStrength > 0.0f);
     Vec3 airVel = windOn ? windVelocity : Vec3(0.0f, 0.0f, 0.0f);
-    cloth->prepareForces();
-    applyWaterToCloth(*water, *cloth, coupling);
-    cloth->applyGravity(gravity);
-    cloth->applyAirDrag(airDragCoefficient, airVel);
-    {
-        auto& pts = cloth->getParticles();
-        for (auto& p : pts) {
-            if (!p.fixed) {
-                p.velocity.x += airVel.x * 0.03f * deltaTime;
-                p.velocity.z += airVel.z * 0.03f * deltaTime;
-            }
-        }
+    ClothEnvironment env;
+    env.gravity = gravity;
+    env.dragCoefficient = airDragCoefficient;
+    env.airVelocity = airVel;
+    env.windCarry = 0.03f;
+    if (oceanWaves) {
+        oceanTime += plan.frameTime;
+        ocean->update(oceanTime);
+        ocean->driveBoundary(*water, 6, plan.frameTime);
     }
-    cloth->finalizeIntegration(deltaTime);
-    applyClothToWater(*water, *cloth, coupling, deltaTime);
-    water->step(deltaTime);
+    scheduler.advance(*world, plan, env);
 
     if (windOn) {
         static int frameCount = 0;
@@ -323,14 +350,57 @@ void keyboard(unsigned char key, int x, int y) {
         case 'c': windStrength = 0.0f; break;
         case '4': windStrength = std::min(20.0f, windStrength + 1.0f); if (length(windDir) <= 1e-4f) windDir = Vec3(1.0f,0.0f,0.0f); break;
         case '5': windStrength = std::max(0.0f, windStrength - 1.0f); break;
+        case 'm': {
+            static const char* names[] = { "explicit", "implicit", "XPBD" };
+            int next = (static_cast<int>(world->getCloth(0).getSolver()) + 1) % 3;
+            for (size_t c = 0; c < world->size(); ++c) world->getCloth(c).setSolver(static_cast<ClothSolver>(next));
+            std::cout << "Cloth solver: " << names[next] << std::endl;
+            break;
+        }
+        case 'x': {
+            bool enabled = !world->getCloth(0).isSelfCollisionEnabled();
+            for (size_t c = 0; c < world->size(); ++c) world->getCloth(c).setSelfCollisionEnabled(enabled);
+            std::cout << "Self-collision " << (enabled ? "on" : "off") << std::endl;
+            break;
+        }
+        case 'z':
+            clothSleep = !clothSleep;
+            for (size_t c = 0; c < world->size(); ++c) world->getCloth(c).setSleepEnabled(clothSleep);
+            std::cout << "Cloth sleeping " << (clothSleep ? "on" : "off") << std::endl;
+            break;
+        case 'v': {
+            bool multigrid = water->getDiffusionSolver() == WaterGrid::DiffusionSolver::Jacobi;
+            water->setDiffusionSolver(multigrid ? WaterGrid::DiffusionSolver::Multigrid : WaterGrid::DiffusionSolver::Jacobi);
+            std::cout << "Water diffusion: " << (multigrid ? "multigrid" : "Jacobi") << std::endl;
+            break;
+        }
+        case 'b':
+            oceanWaves = !oceanWaves;
+            std::cout << "Ocean waves " << (oceanWaves ? "on" : "off") << std::endl;
+            break;
+        case 'n':
+            clothCount = clothCount >= 16 ? 1 : clothCount * 2;
+            createCloths();
+            std::cout << "Cloth count: " << clothCount << std::endl;
+            break;
         case 'r':
-            delete cloth;
-            cloth = new Cloth(7.5, 7.5, 0.3f);
-            cloth->fixCorner(0);
+            createCloths();
             windDir = Vec3(0.0f, 0.0f, 0.0f);
             windStrength = 0.0f;
             std::cout << "Cloth reset to original position with fixed corner" << std::endl;
             break;
+        case 't': {
+            const auto& times = world->getClothStepTimes();
+            double slowest = times.empty() ? 0.0 : *std::max_element(times.begin(), times.end());
+            std::cout << "Cloth world: " << world->size() << " cloths, step " << world->getLastStepTime()
+                      << " ms, slowest cloth " << slowest << " ms" << std::endl;
+            const StepPlan& plan = stepController.getLastPlan();
+            std::cout << "Substeps: cloth " << plan.clothSubsteps << " (margin " << plan.clothMargin << "), water "
+                      << plan.waterSubsteps << " (margin " << plan.waterMargin << ")" << std::endl;
+            std::cout << "Water: diffusion iterations " << water->getLastDiffusionIterations() << ", active fraction "
+                      << water->getActiveFraction() << std::endl;
+            break;
+        }
     }
     glutPostRedisplay();
 }
@@ -357,6 +427,13 @@ int main(int argc, char** argv) {
     std::cout << "    4/5 - Increase/decrease wind strength (wind active only if strength > 0)" << std::endl;
     std::cout << "    C - Clear wind (strength = 0)" << std::endl;
     std::cout << "    R - Reset cloth" << std::endl;
+    std::cout << "    M - Cycle cloth solver (explicit / implicit / XPBD)" << std::endl;
+    std::cout << "    X - Toggle cloth self-collision" << std::endl;
+    std::cout << "    N - Cycle cloth count (1 / 2 / 4 / 8 / 16)" << std::endl;
+    std::cout << "    Z - Toggle sleeping of settled cloth regions" << std::endl;
+    std::cout << "    V - Toggle water diffusion solver (Jacobi / multigrid)" << std::endl;
+    std::cout << "    B - Toggle ocean waves at the water boundary" << std::endl;
+    std::cout << "    T - Print step timings, substeps and water activity" << std::endl;
     std::cout << std::endl;
     
     glutInit(&argc, argv);
@@ -380,19 +457,40 @@ int main(int argc, char** argv) {
 
     
     generateTexture();
+
+    if (argc > 1) {
+        TriangleMesh mesh;
+        if (mesh.loadObj(argv[1])) {
+            obstacle = new CollisionMesh(mesh);
+            std::cout << "Loaded obstacle " << argv[1] << " (" << mesh.triangleCount() << " triangles)" << std::endl;
+        } else {
+            std::cerr << "Could not load obstacle mesh " << argv[1] << std::endl;
+        }
+    }
     
-    cloth = new Cloth(15, 15, 0.15f);
-    cloth->fixCorner(0);
     water = new WaterGrid(80, 80, 0.12f, Vec3(-4.0f, -1.3f, -4.0f), -0.8f);
+    water->setRestDepth(0.6f);
+    water->setAdvectionScheme(WaterGrid::AdvectionScheme::MacCormack);
+    water->setWaveSolver(WaterGrid::WaveSolver::SemiImplicit);
+    water->setActiveTracking(true);
+    world = new ClothWorld();
+    world->setWater(water, coupling);
+    if (obstacle) world->setObstacle(obstacle, 0.03f);
+    createCloths();
+    ocean = new SpectralOcean(64, 32.0f);
+    ocean->setSpectrum(SpectralOcean::Spectrum::Jonswap);
+    ocean->setWind(Vec3(4.0f, 0.0f, 1.5f));
+    ocean->setAmplitude(0.01f);
     waterRenderer = new WaterRenderer(80, 80, 0.12f, Vec3(-4.0f, -1.3f, -4.0f), -0.8f, -1.4f);
+    waterRenderer->setFarField(30.0f, 96);
     
     glutDisplayFunc(display);
     glutReshapeFunc(reshape);
     glutKeyboardFunc(keyboard);
     glutIdleFunc(update);
     
-    std::cout << "Created cloth with " << cloth->getParticles().size() << " particles" << std::endl;
-    std::cout << "Created " << cloth->getSprings().size() << " springs" << std::endl;
+    std::cout << "Created " << world->size() << " cloth(s) with " << world->getParticleCount() << " particles" << std::endl;
+    std::cout << "Created " << world->getCloth(0).getSprings().size() << " springs per cloth" << std::endl;
     std::cout << "Window opened - you should see the cloth falling!" << std::endl;
     std::cout << "Initial wind strength: " << windStrength << std::endl;
     std::cout << "Coordinate System:" << std::endl;
@@ -404,8 +502,10 @@ int main(int argc, char** argv) {
     
     glutMainLoop();
     
-    delete cloth;
+    delete world;
+    delete obstacle;
     delete waterRenderer;
+    delete ocean;
     delete water;
     return 0;
 } 
\ No newline at end of file